@@ -24,8 +24,14 @@ typedef struct {
     int                 ncpus;
 } unvme_context_t;
 
-/// Thread IO completion queue
-typedef struct io_u     *unvme_iocq_t;
+/// Thread IO completion queue (ring of completed io_u)
+typedef struct {
+    unsigned int        head;       ///< first completed io_u index
+    unsigned int        count;      ///< number of completed io_u
+    unsigned int        ret;        ///< number of io_u returned by getevents
+    unsigned int        mask;       ///< ring size - 1
+    struct io_u*        io_us[];    ///< completed io_u
+} unvme_iocq_t;
 
 
 // Static variables
@@ -85,8 +91,12 @@ static void do_unvme_init(struct thread_data *td)
  */
 static int fio_unvme_init(struct thread_data *td)
 {
-    unvme_iocq_t* iocq = calloc(td->o.iodepth, sizeof(void*));
+    unsigned int size = 1;
+    while (size < td->o.iodepth) size <<= 1;
+    unvme_iocq_t* iocq = calloc(1, sizeof(unvme_iocq_t) +
+                                   size * sizeof(struct io_u*));
     if (!iocq) return 1;
+    iocq->mask = size - 1;
     td->io_ops_data = iocq;
     return 0;
 }
@@ -152,8 +162,23 @@ static void fio_unvme_iomem_free(struct thread_data *td)
 static struct io_u* fio_unvme_event(struct thread_data *td, int event)
 {
     unvme_iocq_t* iocq = td->io_ops_data;
-    TDEBUG("GET.%d %p", event, iocq[event]->buf);
-    return iocq[event];
+    struct io_u* io_u = iocq->io_us[(iocq->head + event) & iocq->mask];
+    TDEBUG("GET.%d %p", event, io_u->buf);
+    return io_u;
+}
+
+/*
+ * UNVMe I/O completion callback to queue the completed io_u.
+ */
+static void fio_unvme_complete(unvme_iod_t iod, void* arg)
+{
+    struct io_u* io_u = arg;
+    unvme_iocq_t* iocq = io_u->engine_data;
+
+    if (iod->error)
+        FATAL("\nunvme I/O error %#x slba=%#lx nlb=%d", iod->error, iod->slba, iod->nlb);
+    io_u->engine_data = NULL;
+    iocq->io_us[(iocq->head + iocq->count++) & iocq->mask] = io_u;
 }
 
 /*
@@ -165,30 +190,23 @@ static struct io_u* fio_unvme_event(struct thread_data *td, int event)
 static int fio_unvme_getevents(struct thread_data *td, unsigned int min,
                                unsigned int max, const struct timespec *t)
 {
-    int i;
-    struct io_u* io_u;
     unvme_iocq_t* iocq = td->io_ops_data;
-    int ec = 0;
-
-    for (;;) {
-        io_u_qiter(&td->io_u_all, io_u, i) {
-            if (io_u->engine_data) {
-                int stat = unvme_apoll(io_u->engine_data, 0);
-                if (stat == 0) {
-                    io_u->engine_data = NULL;
-                    TDEBUG("PUT.%d %p (%d %d)", ec, io_u->buf, min, max);
-                    iocq[ec++] = io_u;
-                    if (ec == max) return ec;
-                } else if (stat == -1) {
-                    if (ec >= min) return ec;
-                } else {
-                    FATAL("\nunvme_apoll return %#x", stat);
-                }
-            }
-        }
-    }
+    int q = td->thread_number - 1;
 
-    return 0;
+    // drop the events returned by the previous call
+    // (completions may also be queued while submitting)
+    iocq->head += iocq->ret;
+    iocq->count -= iocq->ret;
+    iocq->ret = 0;
+
+    do {
+        if (iocq->count < max)
+            unvme_process(unvme.ns, q, max - iocq->count);
+    } while (iocq->count < min);
+
+    iocq->ret = iocq->count < max ? iocq->count : max;
+    TDEBUG("PUT %d (%d %d)", iocq->ret, min, max);
+    return iocq->ret;
 }
 
 
@@ -214,16 +232,18 @@ static int fio_unvme_queue(struct thread_data *td, struct io_u *io_u)
     switch (io_u->ddir) {
     case DDIR_READ:
         TDEBUG("READ q%d %p %#lx %d", q, buf, slba, nlb);
-        if ((io_u->engine_data = unvme_aread(unvme.ns, q, buf, slba, nlb)))
+        io_u->engine_data = td->io_ops_data;
+        if (!unvme_aread_cb(unvme.ns, q, buf, slba, nlb, fio_unvme_complete, io_u))
             return FIO_Q_QUEUED;
-        FATAL("\nunvme_aread q=%d slba=%#lx nlb=%d", q, slba, nlb);
+        FATAL("\nunvme_aread_cb q=%d slba=%#lx nlb=%d", q, slba, nlb);
         break;
 
     case DDIR_WRITE:
         TDEBUG("WRITE q%d %p %#lx %d", q, buf, slba, nlb);
-        if ((io_u->engine_data = unvme_awrite(unvme.ns, q, buf, slba, nlb)))
+        io_u->engine_data = td->io_ops_data;
+        if (!unvme_awrite_cb(unvme.ns, q, buf, slba, nlb, fio_unvme_complete, io_u))
             return FIO_Q_QUEUED;
-        FATAL("\nunvme_awrite q=%d slba=%#lx nlb=%d", q, slba, nlb);
+        FATAL("\nunvme_awrite_cb q=%d slba=%#lx nlb=%d", q, slba, nlb);
         break;
 
     default:
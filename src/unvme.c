@@ -37,16 +37,19 @@
 #include "unvme_core.h"
 
 /**
- * Open a client session with specified number of IO queues and queue size.
+ * Open a client session with the specified options.
+ * If UNVME_OPT_SHARED is set, each I/O queue may be used concurrently by
+ * multiple threads (see unvme_do_open).
  * @param   pciname     PCI device name (as %x:%x.%x[/NSID] format)
- * @param   qcount      number of io queues
- * @param   qsize       io queue size
+ * @param   opts        open options (NULL for default)
  * @return  namespace pointer or NULL if error.
  */
-const unvme_ns_t* unvme_openq(const char* pciname, int qcount, int qsize)
+const unvme_ns_t* unvme_openx(const char* pciname, const unvme_opts_t* opts)
 {
-    if (qcount < 0 || qsize < 0 || qsize == 1) {
-        ERROR("invalid qcount %d or qsize %d", qcount, qsize);
+    unvme_opts_t defopts = { 0 };
+    if (!opts) opts = &defopts;
+    if (opts->qcount < 0 || opts->qsize < 0 || opts->qsize == 1) {
+        ERROR("invalid qcount %d or qsize %d", opts->qcount, opts->qsize);
         return NULL;
     }
 
@@ -58,7 +61,20 @@ const unvme_ns_t* unvme_openq(const char* pciname, int qcount, int qsize)
     }
     int pci = (b << 16) + (d << 8) + f;
 
-    return unvme_do_open(pci, nsid, qcount, qsize);
+    return unvme_do_open(pci, nsid, opts);
+}
+
+/**
+ * Open a client session with specified number of IO queues and queue size.
+ * @param   pciname     PCI device name (as %x:%x.%x[/NSID] format)
+ * @param   qcount      number of io queues
+ * @param   qsize       io queue size
+ * @return  namespace pointer or NULL if error.
+ */
+const unvme_ns_t* unvme_openq(const char* pciname, int qcount, int qsize)
+{
+    unvme_opts_t opts = { .qcount = qcount, .qsize = qsize };
+    return unvme_openx(pciname, &opts);
 }
 
 /**
@@ -81,6 +97,114 @@ int unvme_close(const unvme_ns_t* ns)
     return unvme_do_close(ns);
 }
 
+/**
+ * Bind the calling thread to a dedicated I/O queue.  A queue whose memory
+ * is on the thread NUMA node is preferred.  The bound queue is used when
+ * UNVME_QID_AUTO is specified as qid (which binds a queue on first use).
+ * The binding is released upon unvme_unbind_queue or thread exit.
+ * @param   ns          namespace handle
+ * @return  the bound queue id or -1 if no queue is available.
+ */
+int unvme_bind_queue(const unvme_ns_t* ns)
+{
+    return unvme_do_bind(ns);
+}
+
+/**
+ * Release the calling thread bound I/O queue.
+ * @param   ns          namespace handle
+ * @return  0 if ok else -1 if the thread is not bound.
+ */
+int unvme_unbind_queue(const unvme_ns_t* ns)
+{
+    return unvme_do_unbind(ns);
+}
+
+/**
+ * Enable or disable interrupt coalescing of an I/O queue (opened with
+ * UNVME_OPT_INTR).  The coalescing threshold and time are set by the open
+ * options and coalescing is enabled by default.
+ * @param   ns          namespace handle
+ * @param   qid         client queue index
+ * @param   enable      1 to enable or 0 to disable coalescing
+ * @return  0 if ok else error status.
+ */
+int unvme_set_coalescing(const unvme_ns_t* ns, int qid, int enable)
+{
+    return unvme_do_coalesce(ns, qid, enable);
+}
+
+/**
+ * Get a pollable (e.g. by epoll) fd that becomes readable when the queue
+ * has completions.  Upon readable, the fd is to be read (to clear it) and
+ * the queue completions processed (e.g. by unvme_process) until empty.
+ * @param   ns          namespace handle
+ * @param   qid         client queue index
+ * @return  the fd (owned by the queue) or -1 if error.
+ */
+int unvme_queue_fd(const unvme_ns_t* ns, int qid)
+{
+    return unvme_do_queue_fd(ns, qid);
+}
+
+/**
+ * Set the completion wait strategy of an I/O queue (used by the blocking
+ * functions such as unvme_apoll, unvme_read and unvme_write).
+ * @param   ns          namespace handle
+ * @param   qid         client queue index
+ * @param   wait        wait strategy (UNVME_WAIT_*)
+ * @return  0 if ok else -1 if the strategy is not supported.
+ */
+int unvme_set_wait(const unvme_ns_t* ns, int qid, int wait)
+{
+    return unvme_do_set_wait(ns, qid, wait);
+}
+
+/**
+ * Get the completion wait statistics of an I/O queue per wait strategy
+ * (collected only if the device is opened with UNVME_OPT_WAIT_STATS).
+ * @param   ns          namespace handle
+ * @param   qid         client queue index
+ * @param   stats       returned statistics (indexed by wait strategy)
+ * @return  0 if ok else -1.
+ */
+int unvme_get_wait_stats(const unvme_ns_t* ns, int qid,
+                         unvme_wait_stats_t stats[UNVME_WAIT_COUNT])
+{
+    return unvme_do_wait_stats(ns, qid, stats);
+}
+
+/**
+ * Set the submission mode of an I/O queue.  By default (ovfdepth -1) a
+ * submission to a full queue waits for completions.  Otherwise a submission
+ * that does not have enough free queue entries returns NULL (or -1) with
+ * errno set to EAGAIN, after deferring up to ovfdepth read/write requests
+ * to a software overflow queue which is submitted as completions are
+ * processed (the deferred request descriptor is returned as usual).
+ * A read/write request split into more commands than the queue can hold
+ * fails with errno set to EINVAL.
+ * @param   ns          namespace handle
+ * @param   qid         client queue index
+ * @param   ovfdepth    overflow queue depth (-1 for blocking)
+ * @return  0 if ok else -1.
+ */
+int unvme_set_nonblock(const unvme_ns_t* ns, int qid, int ovfdepth)
+{
+    return unvme_do_set_nonblock(ns, qid, ovfdepth);
+}
+
+/**
+ * Get the occupancy of an I/O queue (to apply backpressure).
+ * @param   ns          namespace handle
+ * @param   qid         client queue index
+ * @param   queued      returned number of overflow queued requests (or NULL)
+ * @return  number of pending commands or -1 if error.
+ */
+int unvme_get_occupancy(const unvme_ns_t* ns, int qid, int* queued)
+{
+    return unvme_do_occupancy(ns, qid, queued);
+}
+
 /**
  * Allocate an I/O buffer associated with a session.
  * @param   ns          namespace handle
@@ -117,7 +241,8 @@ int unvme_free(const unvme_ns_t* ns, void* buf)
 inline unvme_iod_t unvme_acmd(const unvme_ns_t* ns, int qid, int opc, int nsid,
                               void* buf, u64 bufsz, u32 cdw10_15[6])
 {
-    return (unvme_iod_t)unvme_do_cmd(ns, qid, opc, nsid, buf, bufsz, cdw10_15);
+    return (unvme_iod_t)unvme_do_cmd(ns, qid, opc, nsid, buf, bufsz, cdw10_15,
+                                     NULL, NULL);
 }
 
 /**
@@ -131,7 +256,8 @@ inline unvme_iod_t unvme_acmd(const unvme_ns_t* ns, int qid, int opc, int nsid,
  */
 inline unvme_iod_t unvme_aread(const unvme_ns_t* ns, int qid, void* buf, u64 slba, u32 nlb)
 {
-    return (unvme_iod_t)unvme_do_rw(ns, qid, NVME_CMD_READ, buf, slba, nlb);
+    return (unvme_iod_t)unvme_do_rw(ns, qid, NVME_CMD_READ, buf, slba, nlb,
+                                    NULL, NULL);
 }
 
 /**
@@ -146,7 +272,218 @@ inline unvme_iod_t unvme_aread(const unvme_ns_t* ns, int qid, void* buf, u64 slb
 inline unvme_iod_t unvme_awrite(const unvme_ns_t* ns, int qid,
                          const void* buf, u64 slba, u32 nlb)
 {
-    return (unvme_iod_t)unvme_do_rw(ns, qid, NVME_CMD_WRITE, (void*)buf, slba, nlb);
+    return (unvme_iod_t)unvme_do_rw(ns, qid, NVME_CMD_WRITE, (void*)buf, slba, nlb,
+                                    NULL, NULL);
+}
+
+/**
+ * Read data from specified logical blocks on device into a list of buffers.
+ * Each buffer segment address and length must be a multiple of the block
+ * size and the segments are transferred without copying.
+ * @param   ns          namespace handle
+ * @param   qid         client queue index
+ * @param   iov         array of data buffer segments (from unvme_alloc)
+ * @param   iovcnt      number of segments
+ * @param   slba        starting logical block
+ * @return  I/O descriptor or NULL if failed.
+ */
+unvme_iod_t unvme_areadv(const unvme_ns_t* ns, int qid,
+                         const struct iovec* iov, int iovcnt, u64 slba)
+{
+    return (unvme_iod_t)unvme_do_rwv(ns, qid, NVME_CMD_READ, iov, iovcnt, slba,
+                                     NULL, NULL);
+}
+
+/**
+ * Write data from a list of buffers to specified logical blocks on device.
+ * Each buffer segment address and length must be a multiple of the block
+ * size and the segments are transferred without copying.
+ * @param   ns          namespace handle
+ * @param   qid         client queue index
+ * @param   iov         array of data buffer segments (from unvme_alloc)
+ * @param   iovcnt      number of segments
+ * @param   slba        starting logical block
+ * @return  I/O descriptor or NULL if failed.
+ */
+unvme_iod_t unvme_awritev(const unvme_ns_t* ns, int qid,
+                          const struct iovec* iov, int iovcnt, u64 slba)
+{
+    return (unvme_iod_t)unvme_do_rwv(ns, qid, NVME_CMD_WRITE, iov, iovcnt, slba,
+                                     NULL, NULL);
+}
+
+/**
+ * Read data from specified logical blocks on device striped across a
+ * range of queues.  The request is divided into a slice per queue and the
+ * returned descriptor completes when all the slices complete.
+ * @param   ns          namespace handle
+ * @param   qid         first client queue index
+ * @param   qcount      number of queues (qid to qid + qcount - 1)
+ * @param   buf         data buffer (from unvme_alloc)
+ * @param   slba        starting logical block
+ * @param   nlb         number of logical blocks
+ * @return  I/O descriptor or NULL if failed.
+ */
+inline unvme_iod_t unvme_aread_striped(const unvme_ns_t* ns, int qid, int qcount,
+                                       void* buf, u64 slba, u32 nlb)
+{
+    return (unvme_iod_t)unvme_do_rw_striped(ns, qid, qcount, NVME_CMD_READ,
+                                            buf, slba, nlb);
+}
+
+/**
+ * Write data to specified logical blocks on device striped across a
+ * range of queues (see unvme_aread_striped).
+ * @param   ns          namespace handle
+ * @param   qid         first client queue index
+ * @param   qcount      number of queues (qid to qid + qcount - 1)
+ * @param   buf         data buffer (from unvme_alloc)
+ * @param   slba        starting logical block
+ * @param   nlb         number of logical blocks
+ * @return  I/O descriptor or NULL if failed.
+ */
+inline unvme_iod_t unvme_awrite_striped(const unvme_ns_t* ns, int qid, int qcount,
+                                        const void* buf, u64 slba, u32 nlb)
+{
+    return (unvme_iod_t)unvme_do_rw_striped(ns, qid, qcount, NVME_CMD_WRITE,
+                                            (void*)buf, slba, nlb);
+}
+
+/**
+ * Write data to specified logical blocks on device without an I/O
+ * descriptor.  The completion only updates the queue write counters (see
+ * unvme_get_ff_stats) and unvme_drain waits for all of them.
+ * @param   ns          namespace handle
+ * @param   qid         client queue index
+ * @param   buf         data buffer (from unvme_alloc)
+ * @param   slba        starting logical block
+ * @param   nlb         number of logical blocks
+ * @return  0 if ok else -1.
+ */
+int unvme_awrite_ff(const unvme_ns_t* ns, int qid,
+                    const void* buf, u64 slba, u32 nlb)
+{
+    return unvme_do_write_ff(ns, qid, (void*)buf, slba, nlb);
+}
+
+/**
+ * Get the descriptor-less write counters of a queue.
+ * @param   ns          namespace handle
+ * @param   qid         client queue index
+ * @param   stats       returned counters
+ * @return  0 if ok else -1.
+ */
+int unvme_get_ff_stats(const unvme_ns_t* ns, int qid, unvme_ff_stats_t* stats)
+{
+    return unvme_do_ff_stats(ns, qid, stats);
+}
+
+/**
+ * Wait for all the pending requests of a queue to complete (processing
+ * the completions as unvme_process does).
+ * @param   ns          namespace handle
+ * @param   qid         client queue index
+ * @return  0 if ok else the first descriptor-less write error status
+ *          of the queue since the last drain (-1 means timeout).
+ */
+int unvme_drain(const unvme_ns_t* ns, int qid)
+{
+    return unvme_do_drain(ns, qid);
+}
+
+/**
+ * Submit a generic or vendor specific command with a completion callback.
+ * The callback is invoked upon completion from within the polling function
+ * (e.g. unvme_process) and the descriptor is released upon its return.
+ * @param   ns          namespace handle
+ * @param   qid         client queue index (-1 for admin queue)
+ * @param   opc         command op code
+ * @param   nsid        namespace id
+ * @param   buf         data buffer (from unvme_alloc)
+ * @param   bufsz       data buffer size
+ * @param   cdw10_15    NVMe command word 10 through 15
+ * @param   cb          completion callback
+ * @param   arg         user context passed to the callback
+ * @return  0 if ok else -1.
+ */
+int unvme_acmd_cb(const unvme_ns_t* ns, int qid, int opc, int nsid,
+                  void* buf, u64 bufsz, u32 cdw10_15[6], unvme_cb_t cb, void* arg)
+{
+    return unvme_do_cmd(ns, qid, opc, nsid, buf, bufsz, cdw10_15, cb, arg) ? 0 : -1;
+}
+
+/**
+ * Read data from specified logical blocks on device with a completion
+ * callback (see unvme_acmd_cb).
+ * @param   ns          namespace handle
+ * @param   qid         client queue index
+ * @param   buf         data buffer (from unvme_alloc)
+ * @param   slba        starting logical block
+ * @param   nlb         number of logical blocks
+ * @param   cb          completion callback
+ * @param   arg         user context passed to the callback
+ * @return  0 if ok else -1.
+ */
+int unvme_aread_cb(const unvme_ns_t* ns, int qid, void* buf, u64 slba, u32 nlb,
+                   unvme_cb_t cb, void* arg)
+{
+    return unvme_do_rw(ns, qid, NVME_CMD_READ, buf, slba, nlb, cb, arg) ? 0 : -1;
+}
+
+/**
+ * Write data to specified logical blocks on device with a completion
+ * callback (see unvme_acmd_cb).
+ * @param   ns          namespace handle
+ * @param   qid         client queue index
+ * @param   buf         data buffer (from unvme_alloc)
+ * @param   slba        starting logical block
+ * @param   nlb         number of logical blocks
+ * @param   cb          completion callback
+ * @param   arg         user context passed to the callback
+ * @return  0 if ok else -1.
+ */
+int unvme_awrite_cb(const unvme_ns_t* ns, int qid, const void* buf, u64 slba, u32 nlb,
+                    unvme_cb_t cb, void* arg)
+{
+    return unvme_do_rw(ns, qid, NVME_CMD_WRITE, (void*)buf, slba, nlb, cb, arg) ? 0 : -1;
+}
+
+/**
+ * Plug an I/O queue to defer the submission doorbell.  Subsequent
+ * asynchronous submissions on the queue are accumulated and published
+ * to the device with a single doorbell write upon unvme_unplug().
+ * Polling the queue for completion also publishes pending submissions.
+ * @param   ns          namespace handle
+ * @param   qid         client queue index
+ */
+void unvme_plug(const unvme_ns_t* ns, int qid)
+{
+    unvme_do_plug(ns, qid, 1);
+}
+
+/**
+ * Unplug an I/O queue and publish all pending submissions.
+ * @param   ns          namespace handle
+ * @param   qid         client queue index
+ */
+void unvme_unplug(const unvme_ns_t* ns, int qid)
+{
+    unvme_do_plug(ns, qid, 0);
+}
+
+/**
+ * Submit a batch of read/write requests with a single doorbell write.
+ * @param   ns          namespace handle
+ * @param   qid         client queue index
+ * @param   io          array of requests
+ * @param   count       number of requests
+ * @param   iods        array of returned I/O descriptors (one per request)
+ * @return  number of requests submitted.
+ */
+int unvme_submit_batch(const unvme_ns_t* ns, int qid,
+                       const unvme_io_t* io, int count, unvme_iod_t iods[])
+{
+    return unvme_do_batch(ns, qid, io, count, iods);
 }
 
 /**
@@ -174,6 +511,113 @@ inline int unvme_apoll_cs(unvme_iod_t iod, int timeout, u32* cqe_cs)
     return unvme_do_poll((unvme_desc_t*)iod, timeout, cqe_cs);
 }
 
+/**
+ * Poll for completion status of a previous IO submission, waiting with
+ * the given strategy for this call instead of the queue one.
+ * If there's no error, the descriptor will be freed.
+ * @param   iod         IO descriptor
+ * @param   timeout     in seconds
+ * @param   wait        wait strategy (UNVME_WAIT_*)
+ * @return  0 if ok else error status (-1 for timeout or, with errno set
+ *          to EINVAL, an unsupported strategy).
+ */
+int unvme_apoll_wait(unvme_iod_t iod, int timeout, int wait)
+{
+    return unvme_do_poll_wait((unvme_desc_t*)iod, timeout, wait, NULL);
+}
+
+/**
+ * Reap completed asynchronous I/O of a queue.  All the ready completions
+ * (up to max) are processed with a single completion doorbell write.
+ * The returned descriptors are already released (i.e. must not be polled)
+ * and their content remains valid only until the next submission.
+ * @param   ns          namespace handle
+ * @param   qid         client queue index
+ * @param   max         max number of descriptors to return
+ * @param   out         array to receive the completed I/O descriptors
+ * @return  number of completed descriptors returned.
+ */
+int unvme_reap(const unvme_ns_t* ns, int qid, int max, unvme_iod_t out[])
+{
+    return unvme_do_reap(ns, qid, max, out);
+}
+
+/**
+ * Process ready completions of a queue invoking the completion callbacks
+ * of the descriptors submitted with the callback variant functions.
+ * This is the progress function for callback based applications and
+ * does not wait for completion.
+ * @param   ns          namespace handle
+ * @param   qid         client queue index
+ * @param   max         max number of descriptors to complete
+ * @return  number of descriptors completed.
+ */
+int unvme_process(const unvme_ns_t* ns, int qid, int max)
+{
+    return unvme_do_process(ns, qid, max);
+}
+
+/**
+ * Create a poll group to drive multiple queues (of one or more devices)
+ * from a single thread.
+ * @return  poll group or NULL if failed.
+ */
+unvme_poll_group_t* unvme_poll_group_create(void)
+{
+    return unvme_do_pg_create();
+}
+
+/**
+ * Destroy a poll group.
+ * @param   pg          poll group
+ * @return  0 if ok else -1.
+ */
+int unvme_poll_group_destroy(unvme_poll_group_t* pg)
+{
+    return unvme_do_pg_destroy(pg);
+}
+
+/**
+ * Add a queue to a poll group.  The queue is to be removed (or the group
+ * destroyed) before the namespace is closed.
+ * @param   pg          poll group
+ * @param   ns          namespace handle
+ * @param   qid         client queue index
+ * @return  0 if ok else -1.
+ */
+int unvme_poll_group_add(unvme_poll_group_t* pg, const unvme_ns_t* ns, int qid)
+{
+    if (qid != UNVME_QID_AUTO && (qid < 0 || qid >= ns->qcount)) {
+        ERROR("invalid qid %d", qid);
+        return -1;
+    }
+    return unvme_do_pg_add(pg, ns, qid);
+}
+
+/**
+ * Remove a queue from a poll group.
+ * @param   pg          poll group
+ * @param   ns          namespace handle
+ * @param   qid         client queue index
+ * @return  0 if ok else -1 if the queue is not in the group.
+ */
+int unvme_poll_group_remove(unvme_poll_group_t* pg, const unvme_ns_t* ns, int qid)
+{
+    return unvme_do_pg_remove(pg, ns, qid);
+}
+
+/**
+ * Process ready completions of all the queues of a poll group invoking the
+ * completion callbacks (as unvme_process does for a single queue).
+ * @param   pg          poll group
+ * @param   max         max number of descriptors to complete
+ * @return  number of descriptors completed.
+ */
+int unvme_poll_group_process(unvme_poll_group_t* pg, int max)
+{
+    return unvme_do_pg_process(pg, max);
+}
+
 /**
  * Submit a generic or vendor specific command and then poll for completion.
  * @param   ns          namespace handle
@@ -190,10 +634,7 @@ int unvme_cmd(const unvme_ns_t* ns, int qid, int opc, int nsid,
               void* buf, u64 bufsz, u32 cdw10_15[6], u32* cqe_cs)
 {
     unvme_iod_t iod = unvme_acmd(ns, qid, opc, nsid, buf, bufsz, cdw10_15);
-    if (iod) {
-        sched_yield();
-        return unvme_apoll_cs(iod, UNVME_TIMEOUT, cqe_cs);
-    }
+    if (iod) return unvme_apoll_cs(iod, UNVME_TIMEOUT, cqe_cs);
     return -1;
 }
 
@@ -209,10 +650,7 @@ int unvme_cmd(const unvme_ns_t* ns, int qid, int opc, int nsid,
 int unvme_read(const unvme_ns_t* ns, int qid, void* buf, u64 slba, u32 nlb)
 {
     unvme_iod_t iod = unvme_aread(ns, qid, buf, slba, nlb);
-    if (iod) {
-        sched_yield();
-        return unvme_apoll(iod, UNVME_TIMEOUT);
-    }
+    if (iod) return unvme_apoll(iod, UNVME_TIMEOUT);
     return -1;
 }
 
@@ -229,10 +667,221 @@ int unvme_write(const unvme_ns_t* ns, int qid,
                 const void* buf, u64 slba, u32 nlb)
 {
     unvme_iod_t iod = unvme_awrite(ns, qid, buf, slba, nlb);
-    if (iod) {
-        sched_yield();
-        return unvme_apoll(iod, UNVME_TIMEOUT);
-    }
+    if (iod) return unvme_apoll(iod, UNVME_TIMEOUT);
+    return -1;
+}
+
+/**
+ * Read data from specified logical blocks on device into a list of buffers.
+ * @param   ns          namespace handle
+ * @param   qid         client queue index
+ * @param   iov         array of data buffer segments (from unvme_alloc)
+ * @param   iovcnt      number of segments
+ * @param   slba        starting logical block
+ * @return  0 if ok else error status.
+ */
+int unvme_readv(const unvme_ns_t* ns, int qid,
+                const struct iovec* iov, int iovcnt, u64 slba)
+{
+    unvme_iod_t iod = unvme_areadv(ns, qid, iov, iovcnt, slba);
+    if (iod) return unvme_apoll(iod, UNVME_TIMEOUT);
+    return -1;
+}
+
+/**
+ * Write data from a list of buffers to specified logical blocks on device.
+ * @param   ns          namespace handle
+ * @param   qid         client queue index
+ * @param   iov         array of data buffer segments (from unvme_alloc)
+ * @param   iovcnt      number of segments
+ * @param   slba        starting logical block
+ * @return  0 if ok else error status.
+ */
+int unvme_writev(const unvme_ns_t* ns, int qid,
+                 const struct iovec* iov, int iovcnt, u64 slba)
+{
+    unvme_iod_t iod = unvme_awritev(ns, qid, iov, iovcnt, slba);
+    if (iod) return unvme_apoll(iod, UNVME_TIMEOUT);
     return -1;
 }
 
+/**
+ * Create a work-stealing I/O executor with a worker thread per I/O queue
+ * (queues 0 to workers - 1, which are not to be used otherwise).
+ * @param   ns          namespace handle
+ * @param   workers     number of workers
+ * @param   depth       max pending requests per worker (0 for default)
+ * @param   flags       options (UNVME_EXEC_STEAL to rebalance idle workers)
+ * @return  executor or NULL if error.
+ */
+unvme_exec_t* unvme_exec_create(const unvme_ns_t* ns, int workers, int depth, u32 flags)
+{
+    return unvme_do_exec_create(ns, workers, depth, flags);
+}
+
+/**
+ * Wait for all the requests to complete and destroy an executor.
+ * @param   ex          executor
+ * @return  0 if ok else -1.
+ */
+int unvme_exec_destroy(unvme_exec_t* ex)
+{
+    return unvme_do_exec_destroy(ex);
+}
+
+/**
+ * Push a read/write request to an executor worker.  The request is submitted
+ * to the queue of the worker (or of a worker stealing it) and the callback
+ * is invoked on that worker thread upon completion.
+ * @param   ex          executor
+ * @param   worker      worker index (-1 for round robin)
+ * @param   io          request
+ * @param   cb          completion callback
+ * @param   arg         user context passed to the callback
+ * @return  0 if ok else -1 if the worker has too many pending requests.
+ */
+int unvme_exec_submit(unvme_exec_t* ex, int worker, const unvme_io_t* io,
+                      unvme_cb_t cb, void* arg)
+{
+    return unvme_do_exec_submit(ex, worker, io, cb, arg);
+}
+
+/**
+ * Wait for all the requests pushed to an executor to complete.
+ * @param   ex          executor
+ * @return  0 if ok else -1.
+ */
+int unvme_exec_wait(unvme_exec_t* ex)
+{
+    return unvme_do_exec_wait(ex);
+}
+
+/**
+ * Get the statistics of an executor worker.
+ * @param   ex          executor
+ * @param   worker      worker index
+ * @param   stats       returned statistics
+ * @return  0 if ok else -1.
+ */
+int unvme_exec_get_stats(unvme_exec_t* ex, int worker, unvme_exec_stats_t* stats)
+{
+    return unvme_do_exec_stats(ex, worker, stats);
+}
+
+/**
+ * Register fixed I/O buffers (from unvme_alloc) for prepared requests.
+ * The buffer DMA addresses and PRP lists are set up once, so the buffers
+ * are referred to by index and must not be freed while registered.
+ * @param   ns          namespace handle
+ * @param   iov         array of buffers (index is the buffer index)
+ * @param   count       number of buffers
+ * @return  0 if ok else -1.
+ */
+int unvme_register_buffers(const unvme_ns_t* ns, const struct iovec* iov, int count)
+{
+    return unvme_do_register_buffers(ns, iov, count);
+}
+
+/**
+ * Unregister the fixed I/O buffers (after destroying the prepared requests).
+ * @param   ns          namespace handle
+ * @return  0 if ok else -1.
+ */
+int unvme_unregister_buffers(const unvme_ns_t* ns)
+{
+    return unvme_do_unregister_buffers(ns);
+}
+
+/**
+ * Create a prepared read or write request on a fixed buffer.
+ * @param   ns          namespace handle
+ * @param   qid         client queue index (of a non-shared queue)
+ * @param   opc         op code (NVME_CMD_READ or NVME_CMD_WRITE)
+ * @param   bufidx      fixed buffer index
+ * @param   cb          completion callback (NULL for polled completion)
+ * @param   arg         user context passed to the callback
+ * @return  prepared request or NULL if error.
+ */
+unvme_prep_t* unvme_prep_create(const unvme_ns_t* ns, int qid, int opc,
+                                int bufidx, unvme_cb_t cb, void* arg)
+{
+    return unvme_do_prep_create(ns, qid, opc, bufidx, cb, arg);
+}
+
+/**
+ * Destroy a prepared request (the requests left are released on close).
+ * @param   prep        prepared request
+ * @return  0 if ok else -1 if pending.
+ */
+int unvme_prep_destroy(unvme_prep_t* prep)
+{
+    return unvme_do_prep_destroy(prep);
+}
+
+/**
+ * Submit a prepared request transferring nlb blocks between its fixed
+ * buffer (from the start) and the device.  The request is submitted as a
+ * single command so nlb is limited to the buffer size and the max blocks
+ * per command.  A request may only have one submission pending.
+ * @param   prep        prepared request
+ * @param   slba        starting logical block
+ * @param   nlb         number of logical blocks
+ * @return  I/O descriptor (to be polled unless a callback is set) or NULL
+ *          if failed (errno EBUSY if pending, EINVAL if nlb is too large).
+ */
+unvme_iod_t unvme_prep_submit(unvme_prep_t* prep, u64 slba, u32 nlb)
+{
+    return (unvme_iod_t)unvme_do_prep_submit(prep, slba, nlb);
+}
+
+
+/**
+ * Create a fiber scheduler.  Synchronous I/O calls made from a fiber park
+ * the fiber until completion and let the other fibers run.
+ * @param   stacksize   fiber stack size (0 for default)
+ * @return  scheduler or NULL if error.
+ */
+unvme_fiber_sched_t* unvme_fiber_sched_create(int stacksize)
+{
+    return unvme_do_fiber_sched_create(stacksize);
+}
+
+/**
+ * Destroy a fiber scheduler.
+ * @param   fs          scheduler
+ * @return  0 if ok else -1.
+ */
+int unvme_fiber_sched_destroy(unvme_fiber_sched_t* fs)
+{
+    return unvme_do_fiber_sched_destroy(fs);
+}
+
+/**
+ * Create a fiber to be run by a scheduler.
+ * @param   fs          scheduler
+ * @param   fn          fiber function
+ * @param   arg         fiber function argument
+ * @return  0 if ok else -1.
+ */
+int unvme_fiber_create(unvme_fiber_sched_t* fs, void (*fn)(void*), void* arg)
+{
+    return unvme_do_fiber_create(fs, fn, arg);
+}
+
+/**
+ * Run the fibers of a scheduler on the calling thread until they all exit.
+ * @param   fs          scheduler
+ * @return  0 if ok else -1.
+ */
+int unvme_fiber_run(unvme_fiber_sched_t* fs)
+{
+    return unvme_do_fiber_run(fs);
+}
+
+/**
+ * Yield the calling fiber to the other runnable fibers.
+ */
+void unvme_fiber_yield(void)
+{
+    unvme_do_fiber_yield();
+}
@@ -38,6 +38,7 @@
 #define _UNVME_H
 
 #include <stdint.h>
+#include <sys/uio.h>
 
 __BEGIN_DECLS
 
@@ -55,8 +56,10 @@ typedef uint64_t        u64;        ///< 64-bit unsigned
 
 #define UNVME_TIMEOUT   60          ///< default timeout in seconds
 #define UNVME_QSIZE     256         ///< default I/O queue size
+#define UNVME_QID_AUTO  (-2)        ///< use the calling thread bound queue
 
 #define UNVME_NOIOMMU_ENV	"UNVME_NOIOMMU"	///< env var for noiommu mode
+#define UNVME_SGL_ENV   "UNVME_SGL" ///< env var to disable SGL (set to 0)
 
 /// Namespace attributes structure
 typedef struct _unvme_ns {
@@ -70,7 +73,7 @@ typedef struct _unvme_ns {
     u64                 blockcount; ///< total number of available blocks
     u64                 pagecount;  ///< total number of available pages
     u16                 blocksize;  ///< logical block size
-    u16                 pagesize;   ///< page size
+    u32                 pagesize;   ///< page size (controller memory page size)
     u16                 blockshift; ///< block size shift value
     u16                 pageshift;  ///< page size shift value
     u16                 bpshift;    ///< block to page shift
@@ -84,8 +87,75 @@ typedef struct _unvme_ns {
     u32                 qsize;      ///< I/O queue size
     u32                 maxqsize;   ///< max queue size supported
     void*               ses;        ///< associated session
+    u32                 sgls;       ///< SGL support in use (0 if PRP only)
+    u32                 shared;     ///< I/O queues are shared among threads
+    u32                 intr;       ///< I/O completion interrupts enabled
+    u32                 reactor;    ///< completions reaped by reactor thread
+    u32                 noiob;      ///< optimal I/O boundary in blocks (or 0)
+    u32                 npwg;       ///< preferred write granularity in blocks (or 0)
+    u32                 npwa;       ///< preferred write alignment in blocks (or 0)
+    u32                 nows;       ///< optimal write size in blocks (or 0)
+    u32                 optsplit;   ///< I/O split on the optimal boundaries
 } unvme_ns_t;
 
+/// Open options (zero fields for default)
+typedef struct _unvme_opts {
+    int                 qcount;     ///< number of I/O queues
+    int                 qsize;      ///< I/O queue size
+    u32                 flags;      ///< option flags (UNVME_OPT_*)
+    u8                  icthr;      ///< interrupt coalescing threshold
+    u8                  ictime;     ///< interrupt coalescing time (100us)
+    int                 wait;       ///< completion wait strategy (UNVME_WAIT_*)
+    int                 rcpu;       ///< reactor thread CPU + 1 (0 if any)
+} unvme_opts_t;
+
+/// Open option flags
+#define UNVME_OPT_SHARED    0x1     ///< thread safe shared I/O queues
+#define UNVME_OPT_INTR      0x2     ///< interrupt driven I/O completion
+#define UNVME_OPT_REACTOR   0x4     ///< reap completions by a reactor thread
+#define UNVME_OPT_NAIVE_SPLIT 0x8   ///< split I/O only at the max transfer size
+#define UNVME_OPT_LARGE_MPS 0x10    ///< use the largest memory page size supported
+#define UNVME_OPT_WAIT_STATS 0x20   ///< collect the completion wait statistics
+
+/// Completion wait strategies
+enum {
+    UNVME_WAIT_DEFAULT = 0,     ///< INTR if interrupts or reactor else YIELD
+    UNVME_WAIT_YIELD,           ///< poll and yield the CPU between polls
+    UNVME_WAIT_SPIN,            ///< busy poll with pause
+    UNVME_WAIT_SPIN_YIELD,      ///< busy poll for a while then yield
+    UNVME_WAIT_HYBRID,          ///< sleep half the mean latency then spin
+    UNVME_WAIT_UMWAIT,          ///< UMWAIT on the next completion entry
+    UNVME_WAIT_INTR,            ///< block on the interrupt (or reactor ring)
+    UNVME_WAIT_COUNT            ///< number of wait strategies
+};
+
+/// Completion wait statistics (of a wait strategy)
+typedef struct _unvme_wait_stats {
+    u64                 waits;      ///< number of waits
+    u64                 polls;      ///< number of empty polls
+    u64                 wait_ns;    ///< total wait (latency) time
+    u64                 max_ns;     ///< max wait time
+    u64                 cpu_ns;     ///< total CPU time consumed by waits
+} unvme_wait_stats_t;
+
+/// I/O request entry for batched submission
+typedef struct _unvme_io {
+    void*               buf;        ///< data buffer (from unvme_alloc)
+    u64                 slba;       ///< starting logical block
+    u32                 nlb;        ///< number of logical blocks
+    u32                 opc;        ///< op code (NVME_CMD_READ or NVME_CMD_WRITE)
+} unvme_io_t;
+
+/// Descriptor-less write counters of a queue (per command)
+typedef struct _unvme_ff_stats {
+    u64                 submitted;  ///< commands submitted
+    u64                 completed;  ///< commands completed
+    u64                 errors;     ///< commands failed since last drain
+    int                 errstat;    ///< first error status since last drain
+    u32                 errnlb;     ///< first error number of blocks
+    u64                 errslba;    ///< first error starting lba
+} unvme_ff_stats_t;
+
 /// I/O descriptor (not to be copied and is cleared upon apoll completion)
 typedef struct _unvme_iod {
     void*               buf;        ///< data buffer (as submitted)
@@ -94,26 +164,112 @@ typedef struct _unvme_iod {
     u32                 qid;        ///< queue id (as submitted)
     u32                 opc;        ///< op code
     u32                 id;         ///< descriptor id
+    int                 error;      ///< error status (set upon completion)
+    void*               arg;        ///< user context (as submitted)
 } *unvme_iod_t;
 
+/// I/O completion callback (the descriptor is released upon return).
+/// It runs inline from any function processing the queue completions,
+/// including a submission waiting on a full queue, and may submit to
+/// the same queue (but must not poll it).
+typedef void (*unvme_cb_t)(unvme_iod_t iod, void* arg);
+
+/// Poll group of I/O queues (opaque, to be used by a single thread)
+typedef struct _unvme_poll_group unvme_poll_group_t;
+
+/// Fiber scheduler (opaque)
+typedef struct _unvme_fiber_sched unvme_fiber_sched_t;
+
+/// I/O executor (opaque)
+typedef struct _unvme_exec unvme_exec_t;
+
+/// Prepared I/O request on a registered fixed buffer (opaque)
+typedef struct _unvme_prep unvme_prep_t;
+
+/// I/O executor options
+#define UNVME_EXEC_STEAL    0x1     ///< idle workers steal pending requests
+
+/// I/O executor worker statistics
+typedef struct _unvme_exec_stats {
+    u64                 submitted;  ///< requests submitted to the worker queue
+    u64                 steals;     ///< successful steal attempts
+    u64                 stolen;     ///< requests stolen from other workers
+    u64                 idle;       ///< idle worker loop iterations
+} unvme_exec_stats_t;
+
 // Export functions
 const unvme_ns_t* unvme_open(const char* pciname);
 const unvme_ns_t* unvme_openq(const char* pciname, int qcount, int qsize);
+const unvme_ns_t* unvme_openx(const char* pciname, const unvme_opts_t* opts);
 int unvme_close(const unvme_ns_t* ns);
 
+int unvme_bind_queue(const unvme_ns_t* ns);
+int unvme_unbind_queue(const unvme_ns_t* ns);
+int unvme_set_coalescing(const unvme_ns_t* ns, int qid, int enable);
+int unvme_queue_fd(const unvme_ns_t* ns, int qid);
+int unvme_set_wait(const unvme_ns_t* ns, int qid, int wait);
+int unvme_get_wait_stats(const unvme_ns_t* ns, int qid, unvme_wait_stats_t stats[UNVME_WAIT_COUNT]);
+int unvme_set_nonblock(const unvme_ns_t* ns, int qid, int ovfdepth);
+int unvme_get_occupancy(const unvme_ns_t* ns, int qid, int* queued);
+
 void* unvme_alloc(const unvme_ns_t* ns, u64 size);
 int unvme_free(const unvme_ns_t* ns, void* buf);
 
 int unvme_write(const unvme_ns_t* ns, int qid, const void* buf, u64 slba, u32 nlb);
 int unvme_read(const unvme_ns_t* ns, int qid, void* buf, u64 slba, u32 nlb);
 int unvme_cmd(const unvme_ns_t* ns, int qid, int opc, int nsid, void* buf, u64 bufsz, u32 cdw10_15[6], u32* cqe_cs);
+int unvme_writev(const unvme_ns_t* ns, int qid, const struct iovec* iov, int iovcnt, u64 slba);
+int unvme_readv(const unvme_ns_t* ns, int qid, const struct iovec* iov, int iovcnt, u64 slba);
 
 unvme_iod_t unvme_awrite(const unvme_ns_t* ns, int qid, const void* buf, u64 slba, u32 nlb);
 unvme_iod_t unvme_aread(const unvme_ns_t* ns, int qid, void* buf, u64 slba, u32 nlb);
 unvme_iod_t unvme_acmd(const unvme_ns_t* ns, int qid, int opc, int nsid, void* buf, u64 bufsz, u32 cdw10_15[6]);
+unvme_iod_t unvme_awritev(const unvme_ns_t* ns, int qid, const struct iovec* iov, int iovcnt, u64 slba);
+unvme_iod_t unvme_areadv(const unvme_ns_t* ns, int qid, const struct iovec* iov, int iovcnt, u64 slba);
+unvme_iod_t unvme_awrite_striped(const unvme_ns_t* ns, int qid, int qcount, const void* buf, u64 slba, u32 nlb);
+unvme_iod_t unvme_aread_striped(const unvme_ns_t* ns, int qid, int qcount, void* buf, u64 slba, u32 nlb);
+
+int unvme_awrite_ff(const unvme_ns_t* ns, int qid, const void* buf, u64 slba, u32 nlb);
+int unvme_get_ff_stats(const unvme_ns_t* ns, int qid, unvme_ff_stats_t* stats);
+int unvme_drain(const unvme_ns_t* ns, int qid);
+
+int unvme_awrite_cb(const unvme_ns_t* ns, int qid, const void* buf, u64 slba, u32 nlb, unvme_cb_t cb, void* arg);
+int unvme_aread_cb(const unvme_ns_t* ns, int qid, void* buf, u64 slba, u32 nlb, unvme_cb_t cb, void* arg);
+int unvme_acmd_cb(const unvme_ns_t* ns, int qid, int opc, int nsid, void* buf, u64 bufsz, u32 cdw10_15[6], unvme_cb_t cb, void* arg);
+
+int unvme_submit_batch(const unvme_ns_t* ns, int qid, const unvme_io_t* io, int count, unvme_iod_t iods[]);
+void unvme_plug(const unvme_ns_t* ns, int qid);
+void unvme_unplug(const unvme_ns_t* ns, int qid);
 
 int unvme_apoll(unvme_iod_t iod, int timeout);
 int unvme_apoll_cs(unvme_iod_t iod, int timeout, u32* cqe_cs);
+int unvme_apoll_wait(unvme_iod_t iod, int timeout, int wait);
+int unvme_reap(const unvme_ns_t* ns, int qid, int max, unvme_iod_t out[]);
+int unvme_process(const unvme_ns_t* ns, int qid, int max);
+
+unvme_poll_group_t* unvme_poll_group_create(void);
+int unvme_poll_group_destroy(unvme_poll_group_t* pg);
+int unvme_poll_group_add(unvme_poll_group_t* pg, const unvme_ns_t* ns, int qid);
+int unvme_poll_group_remove(unvme_poll_group_t* pg, const unvme_ns_t* ns, int qid);
+int unvme_poll_group_process(unvme_poll_group_t* pg, int max);
+
+unvme_fiber_sched_t* unvme_fiber_sched_create(int stacksize);
+int unvme_fiber_sched_destroy(unvme_fiber_sched_t* fs);
+int unvme_fiber_create(unvme_fiber_sched_t* fs, void (*fn)(void*), void* arg);
+int unvme_fiber_run(unvme_fiber_sched_t* fs);
+void unvme_fiber_yield(void);
+
+unvme_exec_t* unvme_exec_create(const unvme_ns_t* ns, int workers, int depth, u32 flags);
+int unvme_exec_destroy(unvme_exec_t* ex);
+int unvme_exec_submit(unvme_exec_t* ex, int worker, const unvme_io_t* io, unvme_cb_t cb, void* arg);
+int unvme_exec_wait(unvme_exec_t* ex);
+int unvme_exec_get_stats(unvme_exec_t* ex, int worker, unvme_exec_stats_t* stats);
+
+int unvme_register_buffers(const unvme_ns_t* ns, const struct iovec* iov, int count);
+int unvme_unregister_buffers(const unvme_ns_t* ns);
+unvme_prep_t* unvme_prep_create(const unvme_ns_t* ns, int qid, int opc, int bufidx, unvme_cb_t cb, void* arg);
+int unvme_prep_destroy(unvme_prep_t* prep);
+unvme_iod_t unvme_prep_submit(unvme_prep_t* prep, u64 slba, u32 nlb);
 
 __END_DECLS
 
@@ -0,0 +1,413 @@
+/**
+ * Copyright (c) 2015-2016, Micron Technology, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the copyright holder nor the names of its
+ *      contributors may be used to endorse or promote products derived
+ *      from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @brief UNVMe C++20 client header file (RAII and coroutine wrappers).
+ *
+ * The I/O awaitables submit with a completion callback that resumes the
+ * awaiting coroutine from within the queue completion processing
+ * (unvme_process or unvme_poll_group_process).  An awaitable lives in the
+ * coroutine frame, so awaiting an I/O allocates no memory.
+ */
+
+#ifndef _UNVME_HPP
+#define _UNVME_HPP
+
+#if __cplusplus < 202002L
+#error "unvme.hpp requires C++20"
+#endif
+
+#include <climits>
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <memory_resource>
+#include <new>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#include "unvme.h"
+
+namespace unvme {
+
+/// NVMe I/O command op codes (see unvme_nvme.h)
+enum : int {
+    cmd_flush   = 0x00,     ///< flush
+    cmd_write   = 0x01,     ///< write
+    cmd_read    = 0x02,     ///< read
+};
+
+/**
+ * Device namespace connection (closed upon destruction).
+ */
+class device {
+public:
+    /**
+     * Open a device namespace.
+     * @param   pciname     PCI device name (as BB:DD.F[/NSID] format)
+     * @param   opts        open options (NULL for default)
+     */
+    explicit device(const char* pciname, const unvme_opts_t* opts = nullptr)
+        : ns_(unvme_openx(pciname, opts))
+    {
+        if (!ns_) throw std::runtime_error(std::string("unvme_open ") + pciname);
+    }
+    device(device&& d) noexcept : ns_(std::exchange(d.ns_, nullptr)) {}
+    device& operator=(device&& d) noexcept
+    {
+        if (this != &d) {
+            close();
+            ns_ = std::exchange(d.ns_, nullptr);
+        }
+        return *this;
+    }
+    device(const device&) = delete;
+    device& operator=(const device&) = delete;
+    ~device() { close(); }
+
+    const unvme_ns_t* ns() const noexcept { return ns_; }
+    const unvme_ns_t* operator->() const noexcept { return ns_; }
+    operator const unvme_ns_t*() const noexcept { return ns_; }
+
+private:
+    void close() noexcept
+    {
+        if (ns_) unvme_close(ns_);
+        ns_ = nullptr;
+    }
+
+    const unvme_ns_t*   ns_;        ///< namespace handle
+};
+
+/**
+ * DMA I/O buffer (freed upon destruction).
+ */
+class dma_buffer {
+public:
+    dma_buffer() noexcept = default;
+    /**
+     * Allocate a page aligned I/O buffer.
+     * @param   ns          namespace handle
+     * @param   size        buffer size
+     */
+    dma_buffer(const unvme_ns_t* ns, std::size_t size)
+        : ns_(ns), buf_(unvme_alloc(ns, size)), size_(size)
+    {
+        if (!buf_) throw std::bad_alloc();
+    }
+    dma_buffer(dma_buffer&& b) noexcept
+        : ns_(b.ns_), buf_(std::exchange(b.buf_, nullptr)),
+          size_(std::exchange(b.size_, 0)) {}
+    dma_buffer& operator=(dma_buffer&& b) noexcept
+    {
+        if (this != &b) {
+            reset();
+            ns_ = b.ns_;
+            buf_ = std::exchange(b.buf_, nullptr);
+            size_ = std::exchange(b.size_, 0);
+        }
+        return *this;
+    }
+    dma_buffer(const dma_buffer&) = delete;
+    dma_buffer& operator=(const dma_buffer&) = delete;
+    ~dma_buffer() { reset(); }
+
+    void* data() const noexcept { return buf_; }
+    std::size_t size() const noexcept { return size_; }
+    std::span<std::byte> bytes() const noexcept
+    {
+        return { static_cast<std::byte*>(buf_), size_ };
+    }
+    template <typename T> T* as() const noexcept { return static_cast<T*>(buf_); }
+
+    /// Free the buffer
+    void reset() noexcept
+    {
+        if (buf_) unvme_free(ns_, buf_);
+        buf_ = nullptr;
+        size_ = 0;
+    }
+
+private:
+    const unvme_ns_t*   ns_ = nullptr;  ///< namespace handle
+    void*               buf_ = nullptr; ///< buffer
+    std::size_t         size_ = 0;      ///< buffer size
+};
+
+/**
+ * Polymorphic memory resource allocating DMA I/O memory.  Each allocation
+ * is a separate DMA mapping, so small objects are better served through
+ * a std::pmr pool resource using this one as its upstream.
+ */
+class memory_resource : public std::pmr::memory_resource {
+public:
+    explicit memory_resource(const unvme_ns_t* ns) noexcept : ns_(ns) {}
+    const unvme_ns_t* ns() const noexcept { return ns_; }
+
+private:
+    void* do_allocate(std::size_t bytes, std::size_t align) override
+    {
+        // allocations are page aligned
+        if (align > ns_->pagesize) throw std::bad_alloc();
+        void* p = unvme_alloc(ns_, bytes ? bytes : 1);
+        if (!p) throw std::bad_alloc();
+        return p;
+    }
+    void do_deallocate(void* p, std::size_t, std::size_t) override
+    {
+        unvme_free(ns_, p);
+    }
+    bool do_is_equal(const std::pmr::memory_resource& r) const noexcept override
+    {
+        auto m = dynamic_cast<const memory_resource*>(&r);
+        return m && m->ns_ == ns_;
+    }
+
+    const unvme_ns_t*   ns_;        ///< namespace handle
+};
+
+/**
+ * I/O operation awaitable.  Awaiting submits the I/O and suspends the
+ * coroutine until the completion is processed; the result is 0 if ok,
+ * -1 if the submission failed, else the NVMe completion status.
+ */
+class io_op {
+public:
+    io_op(const unvme_ns_t* ns, int qid, int opc, void* buf,
+          u64 slba, u32 nlb) noexcept
+        : ns_(ns), qid_(qid), opc_(opc), buf_(buf), slba_(slba), nlb_(nlb) {}
+
+    bool await_ready() const noexcept { return false; }
+    bool await_suspend(std::coroutine_handle<> h) noexcept
+    {
+        handle_ = h;
+        state_ = submitting;
+        int err;
+        if (opc_ == cmd_read) {
+            err = unvme_aread_cb(ns_, qid_, buf_, slba_, nlb_, complete, this);
+        } else if (opc_ == cmd_write) {
+            err = unvme_awrite_cb(ns_, qid_, buf_, slba_, nlb_, complete, this);
+        } else {
+            u32 cdw10_15[6] = {};
+            err = unvme_acmd_cb(ns_, qid_, opc_, ns_->id, buf_,
+                                (u64)nlb_ << ns_->blockshift, cdw10_15,
+                                complete, this);
+        }
+        if (err) {
+            error_ = -1;
+            return false;
+        }
+        // an I/O completed within its own submission (e.g. while waiting
+        // on a full queue) is not suspended on, rather than resumed there
+        if (state_ == completed) return false;
+        state_ = pending;
+        return true;
+    }
+    int await_resume() const noexcept { return error_; }
+
+private:
+    /// Submission state
+    enum { submitting, pending, completed };
+
+    /// Completion callback resuming the awaiting coroutine (may run from
+    /// another operation's submission waiting on a full queue)
+    static void complete(unvme_iod_t iod, void* arg) noexcept
+    {
+        io_op* op = static_cast<io_op*>(arg);
+        op->error_ = iod->error;
+        if (op->state_ == submitting) op->state_ = completed;
+        else op->handle_.resume();
+    }
+
+    const unvme_ns_t*       ns_;        ///< namespace handle
+    int                     qid_;       ///< queue id
+    int                     opc_;       ///< op code
+    void*                   buf_;       ///< data buffer
+    u64                     slba_;      ///< starting logical block
+    u32                     nlb_;       ///< number of logical blocks
+    int                     error_ = 0; ///< completion status
+    int                     state_ = submitting; ///< submission state
+    std::coroutine_handle<> handle_;    ///< awaiting coroutine
+};
+
+/// Read logical blocks (co_await for the completion status)
+inline io_op read(const unvme_ns_t* ns, int qid, void* buf, u64 slba, u32 nlb) noexcept
+{
+    return io_op(ns, qid, cmd_read, buf, slba, nlb);
+}
+
+/// Write logical blocks (co_await for the completion status)
+inline io_op write(const unvme_ns_t* ns, int qid, const void* buf, u64 slba, u32 nlb) noexcept
+{
+    return io_op(ns, qid, cmd_write, const_cast<void*>(buf), slba, nlb);
+}
+
+/// Flush the volatile write cache (co_await for the completion status)
+inline io_op flush(const unvme_ns_t* ns, int qid) noexcept
+{
+    return io_op(ns, qid, cmd_flush, nullptr, 0, 0);
+}
+
+/**
+ * I/O queue of a device namespace.
+ */
+class queue {
+public:
+    queue(const unvme_ns_t* ns, int qid) noexcept : ns_(ns), qid_(qid) {}
+
+    const unvme_ns_t* ns() const noexcept { return ns_; }
+    int qid() const noexcept { return qid_; }
+
+    io_op read(void* buf, u64 slba, u32 nlb) const noexcept
+    {
+        return unvme::read(ns_, qid_, buf, slba, nlb);
+    }
+    io_op write(const void* buf, u64 slba, u32 nlb) const noexcept
+    {
+        return unvme::write(ns_, qid_, buf, slba, nlb);
+    }
+    io_op flush() const noexcept { return unvme::flush(ns_, qid_); }
+
+    /// Process completions resuming the awaiting coroutines
+    int process(int max = INT_MAX) const noexcept
+    {
+        return unvme_process(ns_, qid_, max);
+    }
+    /// Completion notification fd (see unvme_queue_fd)
+    int fd() const noexcept { return unvme_queue_fd(ns_, qid_); }
+
+private:
+    const unvme_ns_t*   ns_;        ///< namespace handle
+    int                 qid_;       ///< queue id
+};
+
+/**
+ * Poll group of queues progressed together (destroyed upon destruction).
+ */
+class poll_group {
+public:
+    poll_group() : pg_(unvme_poll_group_create())
+    {
+        if (!pg_) throw std::bad_alloc();
+    }
+    poll_group(poll_group&& g) noexcept : pg_(std::exchange(g.pg_, nullptr)) {}
+    poll_group(const poll_group&) = delete;
+    poll_group& operator=(const poll_group&) = delete;
+    ~poll_group() { if (pg_) unvme_poll_group_destroy(pg_); }
+
+    int add(const queue& q) noexcept { return unvme_poll_group_add(pg_, q.ns(), q.qid()); }
+    int remove(const queue& q) noexcept { return unvme_poll_group_remove(pg_, q.ns(), q.qid()); }
+
+    /// Process completions of all the queues resuming the awaiting coroutines
+    int process(int max = INT_MAX) noexcept
+    {
+        return unvme_poll_group_process(pg_, max);
+    }
+
+private:
+    unvme_poll_group_t* pg_;        ///< poll group
+};
+
+/**
+ * Coroutine task.  A task starts running upon invocation until its first
+ * suspension and may be awaited by another coroutine.  It must not be
+ * destroyed while suspended on an I/O.
+ */
+class task {
+public:
+    struct promise_type {
+        std::coroutine_handle<> cont;   ///< awaiting coroutine
+        std::exception_ptr      error;  ///< unhandled exception
+
+        task get_return_object() noexcept
+        {
+            return task(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        auto final_suspend() noexcept
+        {
+            struct final_awaiter {
+                bool await_ready() noexcept { return false; }
+                std::coroutine_handle<>
+                await_suspend(std::coroutine_handle<promise_type> h) noexcept
+                {
+                    auto c = h.promise().cont;
+                    return c ? c : std::noop_coroutine();
+                }
+                void await_resume() noexcept {}
+            };
+            return final_awaiter{};
+        }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { error = std::current_exception(); }
+    };
+
+    task(task&& t) noexcept : h_(std::exchange(t.h_, nullptr)) {}
+    task(const task&) = delete;
+    task& operator=(const task&) = delete;
+    ~task() { if (h_) h_.destroy(); }
+
+    /// Check if the task has completed
+    bool done() const noexcept { return !h_ || h_.done(); }
+    /// Rethrow the exception the task has completed with (if any)
+    void get() const
+    {
+        if (h_ && h_.promise().error) std::rethrow_exception(h_.promise().error);
+    }
+
+    bool await_ready() const noexcept { return done(); }
+    void await_suspend(std::coroutine_handle<> c) noexcept { h_.promise().cont = c; }
+    void await_resume() const { get(); }
+
+private:
+    explicit task(std::coroutine_handle<promise_type> h) noexcept : h_(h) {}
+
+    std::coroutine_handle<promise_type> h_; ///< coroutine
+};
+
+/**
+ * Process the completions of a queue (or poll group) until a task is done.
+ * @param   t           task
+ * @param   q           queue or poll group the task I/Os are submitted to
+ */
+template <typename Q>
+inline void run(const task& t, Q&& q)
+{
+    while (!t.done()) q.process();
+    t.get();
+}
+
+} // namespace unvme
+
+#endif // _UNVME_HPP
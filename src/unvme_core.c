@@ -35,9 +35,19 @@
  */
 
 #include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <linux/mempolicy.h>
+#include <linux/futex.h>
 #include <string.h>
+#include <limits.h>
 #include <signal.h>
+#include <errno.h>
 #include <sched.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
 
 #include "rdtsc.h"
 #include "unvme_core.h"
@@ -50,6 +60,33 @@
 static const char*      unvme_log = "/dev/shm/unvme.log";   ///< Log filename
 static unvme_session_t* unvme_ses = NULL;                   ///< session list
 static unvme_lock_t     unvme_lock = 0;                     ///< session lock
+static __thread unvme_queue_t* unvme_fcq = NULL;            ///< combined queue
+static __thread unvme_desc_t* unvme_fccb = NULL;            ///< deferred callbacks
+static __thread unvme_desc_t* unvme_fccbtail = NULL;        ///< last deferred
+static __thread int     unvme_fccbrun = 0;                  ///< running deferred
+static __thread unvme_queue_t* unvme_callwaitq = NULL;      ///< call wait queue
+static __thread int     unvme_callwait = 0;                 ///< call wait strategy
+static __thread unvme_binding_t* unvme_binds = NULL;        ///< queue bindings
+static pthread_key_t    unvme_bindkey;                      ///< binding release
+static pthread_once_t   unvme_bindonce = PTHREAD_ONCE_INIT; ///< key init once
+static u32              unvme_devid = 0;                    ///< device id count
+
+
+/**
+ * Resolve a queue id, mapping UNVME_QID_AUTO to the calling thread bound
+ * queue (binding one on first use).
+ * @param   ns          namespace handle
+ * @param   qid         queue id
+ * @return  queue id or -1 if no queue can be bound.
+ */
+static inline int unvme_ioqid(const unvme_ns_t* ns, int qid)
+{
+    if (qid != UNVME_QID_AUTO) return qid;
+    unvme_device_t* dev = ((unvme_session_t*)ns->ses)->dev;
+    unvme_binding_t* b = unvme_binds;
+    if (b && b->dev == dev && b->devid == dev->id) return b->qid;
+    return unvme_do_bind(ns);
+}
 
 
 /**
@@ -68,101 +105,499 @@ static unvme_desc_t* unvme_desc_get(unvme_queue_t* q)
 
         desc->error = 0;
         desc->cidcount = 0;
-        u64* cidmask = desc->cidmask;
-        int i = q->masksize >> 3;
-        while (i--) *cidmask++ = 0;
+        desc->done = 0;
+        desc->cb = NULL;
+        desc->arg = NULL;
+        desc->stripe = 0;
     } else {
-        desc = zalloc(sizeof(unvme_desc_t) + q->masksize);
+        desc = zalloc(sizeof(unvme_desc_t));
         desc->id = ++id;
         desc->q = q;
     }
     LIST_ADD(q->desclist, desc);
-    if (desc == desc->next) q->descpend = desc; // head of pending list
     q->desccount++;
     return desc;
 }
 
 /**
- * Put a descriptor entry back by moving it from the use to the free list.
+ * Put a descriptor entry back by moving it from the use (or done)
+ * to the free list.  A prepared request descriptor is only marked idle.
  * @param   desc    descriptor
  */
 static void unvme_desc_put(unvme_desc_t* desc)
 {
     unvme_queue_t* q = desc->q;
-
-    // check to change the pending head or clear the list
-    if (desc == q->descpend) {
-        if (desc != desc->next) q->descpend = desc->next;
-        else q->descpend = NULL;
+    if (desc->prep) {
+        desc->sentinel = NULL;
+        return;
+    }
+    if (desc->done) {
+        LIST_DEL(q->descdone, desc);
+    } else {
+        LIST_DEL(q->desclist, desc);
     }
-
-    LIST_DEL(q->desclist, desc);
     LIST_ADD(q->descfree, desc);
+    desc->sentinel = NULL;
     q->desccount--;
 }
 
 /**
- * Process an I/O completion.
+ * Move a fully completed descriptor from the use to the done list.
+ * The descriptor is only moved after its submission has been completed
+ * (i.e. the sentinel is set) since a split I/O may have all its earlier
+ * submissions completed before the remaining ones are submitted.
+ * @param   desc    descriptor
+ */
+static void unvme_desc_done(unvme_desc_t* desc)
+{
+    unvme_queue_t* q = desc->q;
+    if (!desc->prep) {
+        LIST_DEL(q->desclist, desc);
+        LIST_ADD(q->descdone, desc);
+    }
+    desc->done = 1;
+}
+
+/**
+ * Complete a descriptor whose commands have all completed.  A descriptor
+ * with a callback is handed to the callback and then released, otherwise
+ * it is moved to the done list to be polled or reaped.  A prepared request
+ * is released before its callback so the callback may resubmit it.
+ * Callbacks of a shared queue are deferred until the combiner role is
+ * released (see unvme_combine), so they may submit to any shared queue.
+ * @param   desc    descriptor
+ */
+static void unvme_desc_complete(unvme_desc_t* desc)
+{
+    if (desc->cb && unvme_fcq) {
+        desc->cbnext = NULL;
+        if (unvme_fccbtail) unvme_fccbtail->cbnext = desc;
+        else unvme_fccb = desc;
+        unvme_fccbtail = desc;
+    } else if (desc->cb && desc->prep) {
+        desc->sentinel = NULL;
+        desc->cb((unvme_iod_t)desc, desc->arg);
+    } else if (desc->cb) {
+        desc->cb((unvme_iod_t)desc, desc->arg);
+        unvme_desc_put(desc);
+    } else {
+        unvme_desc_done(desc);
+    }
+}
+
+/**
+ * Retire a completed cid and its owner descriptor bookkeeping.
  * @param   q           queue
- * @param   timeout     timeout in seconds
- * @param   cqe_cs      CQE command specific DW0 returned
- * @return  0 if ok else NVMe error code (-1 means timeout).
+ * @param   cid         completed cid
+ * @param   err         completion status
+ * @return  1 if the owner descriptor has completed else 0.
  */
-static int unvme_check_completion(unvme_queue_t* q, int timeout, u32* cqe_cs)
+static int unvme_complete_cid(unvme_queue_t* q, int cid, int err)
 {
-    // wait for completion
-    int err, cid;
-    u64 endtsc = 0;
-    do {
-        cid = nvme_check_completion(q->nvmeq, &err, cqe_cs);
-        if (timeout == 0 || cid >= 0) break;
-        if (endtsc) sched_yield();
-        else endtsc = rdtsc() + timeout * q->nvmeq->dev->rdtsec;
-    } while (rdtsc() < endtsc);
+    // lookup the descriptor owning the completed cid
+    unvme_desc_t* desc = q->cidtab[cid];
+    if (!desc) FATAL("pending cid %d not found", cid);
+    q->cidtab[cid] = NULL;
+    if (err) desc->error = err;
 
-    if (cid < 0) return cid;
+    // return the chained PRP list pages to the pool
+    unvme_prppage_t* pp = q->cidprp[cid];
+    if (pp) {
+        while (pp->next) pp = pp->next;
+        pp->next = q->prpfree;
+        q->prpfree = q->cidprp[cid];
+        q->cidprp[cid] = NULL;
+    }
 
-    // find the pending cid in the descriptor list to clear it
-    unvme_desc_t* desc = q->descpend;
-    int b = cid >> 6;
-    u64 mask = (u64)1 << (cid & 63);
-    while ((desc->cidmask[b] & mask) == 0) {
-        desc = desc->next;
-        if (desc == q->descpend)
-            FATAL("pending cid %d not found", cid);
+    // update the mean completion latency (for hybrid polling)
+    if (q->cidtsc[cid]) {
+        u64 lat = rdtsc() - q->cidtsc[cid];
+        q->lattsc = q->lattsc ? q->lattsc - (q->lattsc >> 3) + (lat >> 3) : lat;
+        q->cidtsc[cid] = 0;
     }
-    if (err) desc->error = err;
 
     // clear cid bit used
-    desc->cidmask[b] &= ~mask;
-    desc->cidcount--;
-    q->cidmask[b] &= ~mask;
+    q->cidmask[cid >> 6] &= ~((u64)1 << (cid & 63));
     q->cidcount--;
     q->cid = cid;
 
-    // check to advance next pending descriptor
-    if (q->cidcount) {
-        while (q->descpend->cidcount == 0) q->descpend = q->descpend->next;
+    // a descriptor-less write only updates the queue counters
+    if (desc == &q->ffdesc) {
+        desc->cidcount--;
+        q->ffstats.completed++;
+        if (err && q->ffstats.errors++ == 0) {
+            q->ffstats.errstat = err;
+            q->ffstats.errslba = q->ffio[cid].slba;
+            q->ffstats.errnlb = q->ffio[cid].nlb;
+        }
+        return 0;
     }
-    PDEBUG("# c q%d={%d %d %#lx} d={%d %d %#lx} @%d",
+
+    PDEBUG("# c q%d={%d %d %#lx} d={%d %d}",
            q->nvmeq->id, cid, q->cidcount, *q->cidmask,
-           desc->id, desc->cidcount, *desc->cidmask, q->descpend->id);
+           desc->id, desc->cidcount - 1);
+    if (--desc->cidcount || desc->sentinel != desc) return 0;
+    unvme_desc_complete(desc);
+    return 1;
+}
+
+/**
+ * Wait on (or wake the waiters of) a futex word.
+ * @param   addr        futex word
+ * @param   op          FUTEX_WAIT_PRIVATE or FUTEX_WAKE_PRIVATE
+ * @param   val         expected value (wait) or number of waiters (wake)
+ * @param   ts          relative timeout (NULL for none)
+ */
+static inline void unvme_futex(void* addr, int op, int val,
+                               const struct timespec* ts)
+{
+    if (syscall(SYS_futex, addr, op, val, ts, NULL, 0) < 0 &&
+        errno != EAGAIN && errno != EINTR && errno != ETIMEDOUT)
+        ERROR("futex: %s", strerror(errno));
+}
+
+/**
+ * Wake the parked reactor thread, once the first pending command of
+ * a queue has been published.
+ * @param   q           queue
+ */
+static inline void unvme_reactor_wake(unvme_queue_t* q)
+{
+    unvme_device_t* dev = q->dev;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&dev->rsleep, __ATOMIC_RELAXED) &&
+        __atomic_exchange_n(&dev->rsleep, 0, __ATOMIC_SEQ_CST))
+        unvme_futex(&dev->rsleep, FUTEX_WAKE_PRIVATE, 1, NULL);
+}
+
+/**
+ * Block until the reactor thread publishes a completion on the drained
+ * hand-off ring of a queue (or until a timeout).
+ * @param   r           reactor completion ring
+ * @param   ms          timeout in milliseconds
+ */
+static void unvme_cqring_wait(unvme_cqring_t* r, int ms)
+{
+    u32 tail = r->head;
+    __atomic_fetch_add(&r->waiters, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&r->tail, __ATOMIC_SEQ_CST) == tail) {
+        struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+        unvme_futex(&r->tail, FUTEX_WAIT_PRIVATE, tail, &ts);
+    }
+    __atomic_fetch_sub(&r->waiters, 1, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * Wake the blocked notifier thread of an armed queue (with a queue fd),
+ * once its commands pending or its arming has been published.
+ * @param   q           queue
+ */
+static inline void unvme_notifier_wake(unvme_queue_t* q)
+{
+    unvme_device_t* dev = q->dev;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&dev->nsleep, __ATOMIC_RELAXED) &&
+        __atomic_exchange_n(&dev->nsleep, 0, __ATOMIC_SEQ_CST)) {
+        u64 one = 1;
+        if (write(dev->nwfd, &one, sizeof(one)) < 0)
+            ERROR("notifier wake: %s", strerror(errno));
+    }
+}
+
+/**
+ * Signal the completion notification fd of an armed queue (disarming it).
+ * @param   q           queue
+ */
+static inline void unvme_notify(unvme_queue_t* q)
+{
+    if (__atomic_exchange_n(&q->armed, 0, __ATOMIC_SEQ_CST)) {
+        u64 one = 1;
+        if (write(q->qfd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+            ERROR("q%d notify: %s", q->nvmeq->id, strerror(errno));
+    }
+}
+
+/**
+ * Arm the completion notification of a queue (with a queue fd) to be
+ * signaled upon the next completion, as the queue has been drained.
+ * With interrupts, a completion posted before arming (whose interrupt
+ * the notifier has already seen) is signaled right away.
+ * @param   q           queue
+ */
+static inline void unvme_arm(unvme_queue_t* q)
+{
+    if (q->qfd >= 0 && !q->armed) {
+        __atomic_store_n(&q->armed, 1, __ATOMIC_SEQ_CST);
+        if (q->cqring) return;
+        if (q->efd >= 0) {
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            if (nvme_cq_ready(q->nvmeq)) unvme_notify(q);
+        } else if (q->cidcount) {
+            unvme_notifier_wake(q);
+        }
+    }
+}
+
+/**
+ * Consume the next completion of an I/O queue from the completion queue
+ * or, in reactor mode, from the reactor hand-off ring.  The caller is to
+ * invoke unvme_cq_flush() after consuming a batch of completions.
+ * @param   q           queue
+ * @param   stat        completion status returned
+ * @param   cqe_cs      CQE command specific DW0 returned
+ * @return  the completed command id or -1 if there's no completion.
+ */
+static inline int unvme_reap_cid(unvme_queue_t* q, int* stat, u32* cqe_cs)
+{
+    unvme_cqring_t* r = q->cqring;
+    if (!r) {
+        int cid = nvme_reap_completion(q->nvmeq, stat, cqe_cs);
+        if (cid < 0) unvme_arm(q);
+        return cid;
+    }
+
+    u32 head = r->head;
+    if (head == __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE)) {
+        unvme_arm(q);
+        return -1;
+    }
+    unvme_cqe_t* cqe = &r->ent[head & r->mask];
+    *stat = cqe->stat;
+    if (cqe_cs) *cqe_cs = cqe->cs;
+    int cid = cqe->cid;
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+    return cid;
+}
+
+/**
+ * Write the completion queue head doorbell for the consumed completions
+ * (done by the reactor thread in reactor mode).
+ * @param   q           queue
+ */
+static inline void unvme_cq_flush(unvme_queue_t* q)
+{
+    if (!q->cqring) nvme_cq_flush(q->nvmeq);
+}
+
+/**
+ * Check for a completion of an I/O queue.
+ * @param   q           queue
+ * @param   stat        completion status returned
+ * @param   cqe_cs      CQE command specific DW0 returned
+ * @return  the completed command id or -1 if there's no completion.
+ */
+static inline int unvme_check_cid(unvme_queue_t* q, int* stat, u32* cqe_cs)
+{
+    int cid = unvme_reap_cid(q, stat, cqe_cs);
+    if (cid >= 0) unvme_cq_flush(q);
+    return cid;
+}
+
+/// Completion wait context
+typedef struct {
+    u64                     start;      ///< wait start tsc
+    u64                     end;        ///< wait deadline tsc
+    u64                     cpu;        ///< wait start thread CPU time (ns)
+    int                     wait;       ///< wait strategy
+    int                     maxms;      ///< max blocking time (0 if no limit)
+    u64                     polls;      ///< number of empty polls
+} unvme_wait_ctx_t;
+
+/**
+ * Get the calling thread CPU time.
+ * @return  CPU time in nanoseconds.
+ */
+static inline u64 unvme_thread_cpu_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+/**
+ * Resolve a completion wait strategy for a queue.
+ * @param   q           queue
+ * @param   wait        wait strategy
+ * @return  the resolved strategy or -1 if not supported.
+ */
+static int unvme_wait_resolve(unvme_queue_t* q, int wait)
+{
+    // the completion queue entries are only watched by the reactor thread
+    // in reactor mode, where the interrupt wait blocks on the hand-off ring
+    if (wait == UNVME_WAIT_DEFAULT)
+        wait = (q->efd >= 0 || q->cqring) ? UNVME_WAIT_INTR : UNVME_WAIT_YIELD;
+    if (wait < 0 || wait >= UNVME_WAIT_COUNT ||
+        (wait == UNVME_WAIT_INTR && q->efd < 0 && !q->cqring) ||
+        (wait == UNVME_WAIT_UMWAIT && (!nvme_cq_umwait_supported() || q->cqring)))
+        return -1;
+    return wait;
+}
+
+/**
+ * Start waiting for a queue completion.
+ * @param   q           queue
+ * @param   w           wait context
+ * @param   timeout     timeout in seconds
+ * @param   maxms       max time to block at once (0 for no limit, but
+ *                      capped to 1ms on an interrupt vector shared by queues)
+ */
+static void unvme_wait_begin(unvme_queue_t* q, unvme_wait_ctx_t* w,
+                             int timeout, int maxms)
+{
+    w->start = rdtsc();
+    w->end = w->start + timeout * q->nvmeq->dev->rdtsec;
+    w->cpu = q->wstats ? unvme_thread_cpu_ns() : 0;
+    w->wait = (unvme_callwaitq == q) ? unvme_callwait : q->wait;
+    // another queue waiter may consume the event of a shared vector
+    if (q->efdshared && (!maxms || maxms > 1)) maxms = 1;
+    w->maxms = maxms;
+    w->polls = 0;
+}
+
+/**
+ * Wait a step for a queue completion using the queue wait strategy.
+ * The caller is to check the completion queue after each step.
+ * @param   q           queue
+ * @param   w           wait context
+ */
+static void unvme_wait_step(unvme_queue_t* q, unvme_wait_ctx_t* w)
+{
+    u64 rdtsec = q->nvmeq->dev->rdtsec;
+    u64 tsc;
+
+    switch (w->wait) {
+    case UNVME_WAIT_SPIN:
+        __builtin_ia32_pause();
+        break;
+
+    case UNVME_WAIT_SPIN_YIELD:
+        if ((rdtsc() - w->start) < (rdtsec / 1000000 * UNVME_SPIN_USEC))
+            __builtin_ia32_pause();
+        else
+            sched_yield();
+        break;
+
+    case UNVME_WAIT_HYBRID:
+        // sleep once for half the mean latency since the last submission
+        tsc = rdtsc();
+        if (w->polls == 0 && (q->lattsc >> 1) > (tsc - q->subtsc)) {
+            u64 ns = ((q->lattsc >> 1) - (tsc - q->subtsc)) * 1000000000UL / rdtsec;
+            struct timespec ts = { ns / 1000000000UL, ns % 1000000000UL };
+            nanosleep(&ts, NULL);
+        } else {
+            __builtin_ia32_pause();
+        }
+        break;
+
+    case UNVME_WAIT_UMWAIT:
+        // limit each wait as the entry being monitored may be stale
+        tsc = rdtsc() + rdtsec / 10000;
+        nvme_cq_umwait(q->nvmeq, tsc < w->end ? tsc : w->end);
+        break;
+
+    case UNVME_WAIT_INTR:
+        tsc = rdtsc();
+        if (tsc < w->end) {
+            int ms = (w->end - tsc) * 1000 / rdtsec + 1;
+            if (w->maxms && ms > w->maxms) ms = w->maxms;
+            if (q->cqring) {
+                unvme_cqring_wait(q->cqring, ms);
+                break;
+            }
+            struct pollfd pfd = { .fd = q->efd, .events = POLLIN };
+            if (poll(&pfd, 1, ms) > 0) {
+                u64 val;
+                if (read(q->efd, &val, sizeof(val)) > 0) {
+                    // let the notifier check the queues sharing the vector
+                    if (q->dev->nstart) unvme_notifier_wake(q);
+                } else if (errno != EAGAIN) {
+                    ERROR("q%d eventfd read: %s", q->nvmeq->id, strerror(errno));
+                }
+            }
+        }
+        break;
+
+    default:
+        sched_yield();
+    }
+    w->polls++;
+}
+
+/**
+ * End waiting for a queue completion and update the wait statistics
+ * (if enabled).
+ * @param   q           queue
+ * @param   w           wait context
+ */
+static void unvme_wait_end(unvme_queue_t* q, unvme_wait_ctx_t* w)
+{
+    if (!q->wstats) return;
+    unvme_wait_stats_t* st = &q->stats[w->wait];
+    u64 ns = (rdtsc() - w->start) * 1000000000UL / q->nvmeq->dev->rdtsec;
+    __sync_fetch_and_add(&st->waits, 1);
+    __sync_fetch_and_add(&st->polls, w->polls);
+    __sync_fetch_and_add(&st->wait_ns, ns);
+    __sync_fetch_and_add(&st->cpu_ns, unvme_thread_cpu_ns() - w->cpu);
+    u64 max = __atomic_load_n(&st->max_ns, __ATOMIC_RELAXED);
+    while (ns > max && !__atomic_compare_exchange_n(&st->max_ns, &max, ns, 1,
+                                                    __ATOMIC_RELAXED,
+                                                    __ATOMIC_RELAXED));
+}
+
+/**
+ * Process an I/O completion.
+ * @param   q           queue
+ * @param   timeout     timeout in seconds
+ * @param   cqe_cs      CQE command specific DW0 returned
+ * @return  0 if ok else NVMe error code (-1 means timeout).
+ */
+static int unvme_check_completion(unvme_queue_t* q, int timeout, u32* cqe_cs)
+{
+    // publish any deferred submissions before waiting on them
+    if (q->nvmeq->sq_pending) nvme_sq_flush(q->nvmeq);
+
+    // wait for completion
+    int err;
+    int cid = unvme_check_cid(q, &err, cqe_cs);
+    if (cid < 0 && timeout) {
+        unvme_wait_ctx_t w;
+        unvme_wait_begin(q, &w, timeout, 0);
+        do {
+            unvme_wait_step(q, &w);
+            cid = unvme_check_cid(q, &err, cqe_cs);
+        } while (cid < 0 && rdtsc() < w.end);
+        unvme_wait_end(q, &w);
+    }
+
+    if (cid < 0) return cid;
+    unvme_complete_cid(q, cid, err);
     return err;
 }
 
+/**
+ * Mark a descriptor submission as completed (i.e. handed to the caller)
+ * and complete it if all its commands have already completed.
+ * @param   desc        descriptor
+ */
+static void unvme_desc_submitted(unvme_desc_t* desc)
+{
+    desc->sentinel = desc;
+    if (desc->cidcount == 0) unvme_desc_complete(desc);
+}
+
 /**
  * Get a free cid.  If queue is full then process currently pending submissions.
+ * The completion callbacks invoked while doing so may submit (and take the
+ * freed cids), so the queue is checked again after each completion.
  * @param   desc        descriptor
  * @return  cid.
  */
 static u16 unvme_get_cid(unvme_desc_t* desc)
 {
-    u16 cid;
     unvme_queue_t* q = desc->q;
-    int qsize = q->size;
 
     // if submission queue is full then process completion first
-    if ((q->cidcount + 1) == qsize) {
+    while ((q->cidcount + 1) >= q->size) {
         int err = unvme_check_completion(q, UNVME_TIMEOUT, NULL);
         if (err) {
             if (err == -1) FATAL("q%d timeout", q->nvmeq->id);
@@ -170,50 +605,82 @@ static u16 unvme_get_cid(unvme_desc_t* desc)
         }
     }
 
-    // get a free cid
-    cid = q->cid;
-    while (q->cidmask[cid >> 6] & ((u64)1L << (cid & 63))) {
-        if (++cid >= qsize) cid = 0;
+    // get a free cid starting from the word of the last freed cid
+    // (bits beyond the queue size are always set so they are never picked)
+    int b = q->cid >> 6;
+    int nb = q->masksize >> 3;
+    u64 freemask;
+    while ((freemask = ~q->cidmask[b]) == 0) {
+        if (++b == nb) b = 0;
     }
+    u16 cid = (b << 6) + __builtin_ctzll(freemask);
 
-    // set cid bit used
-    int b = cid >> 6;
-    u64 mask = (u64)1 << (cid & 63);
-    desc->cidmask[b] |= mask;
-    desc->cidcount++;
-    q->cidmask[b] |= mask;
+    // set cid bit used and record the owner descriptor
+    q->cidmask[b] |= freemask & -freemask;
     q->cidcount++;
-    q->cid = cid;
-    if (++q->cid >= qsize) q->cid = 0;
+    q->cidtab[cid] = desc;
+    desc->cidcount++;
+    if (q->wait == UNVME_WAIT_HYBRID) q->cidtsc[cid] = q->subtsc = rdtsc();
+    if (q->armed && !q->cqring && q->efd < 0) unvme_notifier_wake(q);
+    if (q->cqring && q->cidcount == 1) unvme_reactor_wake(q);
 
     return cid;
 }
 
 /**
- * Lookup DMA address associated with the user buffer.
+ * Find the index of the last IO memory entry starting at or below
+ * a buffer address (i.e. the only entry that may contain it).
+ * The caller must hold the IO memory lock.
+ * @param   iomem       IO memory tracker
+ * @param   buf         buffer address
+ * @return  map index or -1 if buffer is below all entries.
+ */
+static int unvme_iomem_find(unvme_iomem_t* iomem, void* buf)
+{
+    int lo = 0, hi = iomem->count - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) >> 1;
+        if (iomem->map[mid]->buf <= buf) lo = mid + 1;
+        else hi = mid - 1;
+    }
+    return hi;
+}
+
+/**
+ * Lookup DMA address associated with the user buffer.  The queue keeps
+ * the last translated memory entry so repeated I/O on the same buffer
+ * skips the lookup until any IO memory is freed.
  * @param   ns          namespace handle
+ * @param   q           queue
  * @param   buf         user data buffer
  * @param   bufsz       buffer size
  * @return  DMA address or -1L if error.
  */
-static u64 unvme_map_dma(const unvme_ns_t* ns, void* buf, u64 bufsz)
+static u64 unvme_map_dma(const unvme_ns_t* ns, unvme_queue_t* q,
+                         void* buf, u64 bufsz)
 {
     unvme_device_t* dev = ((unvme_session_t*)ns->ses)->dev;
 #ifdef UNVME_IDENTITY_MAP_DMA
     u64 addr = (u64)buf & dev->vfiodev.iovamask;
 #else
-    vfio_dma_t* dma = NULL;
-    unvme_lockr(&dev->iomem.lock);
-    int i;
-    for (i = 0; i < dev->iomem.count; i++) {
-        dma = dev->iomem.map[i];
-        if (dma->buf <= buf && buf < (dma->buf + dma->size)) break;
-    }
-    unvme_unlockr(&dev->iomem.lock);
-    if (i == dev->iomem.count)
-        FATAL("invalid I/O buffer address");
-    u64 addr = dma->addr + (u64)(buf - dma->buf);
-    if ((addr + bufsz) > (dma->addr + dma->size))
+    unvme_dmacache_t* dc = &q->dmacache;
+    if (!(dc->buf <= buf && buf < (dc->buf + dc->size) &&
+          dc->gen == dev->iomem.gen)) {
+        unvme_lockr(&dev->iomem.lock);
+        int i = unvme_iomem_find(&dev->iomem, buf);
+        vfio_dma_t* dma = i >= 0 ? dev->iomem.map[i] : NULL;
+        if (!dma || buf >= (dma->buf + dma->size)) {
+            unvme_unlockr(&dev->iomem.lock);
+            FATAL("invalid I/O buffer address");
+        }
+        dc->buf = dma->buf;
+        dc->size = dma->size;
+        dc->addr = dma->addr;
+        dc->gen = dev->iomem.gen;
+        unvme_unlockr(&dev->iomem.lock);
+    }
+    u64 addr = dc->addr + (u64)(buf - dc->buf);
+    if ((addr + bufsz) > (dc->addr + dc->size))
         FATAL("buffer overrun");
 #endif
     //if ((addr & (ns->blocksize - 1)) != 0)
@@ -221,6 +688,73 @@ static u64 unvme_map_dma(const unvme_ns_t* ns, void* buf, u64 bufsz)
     return addr;
 }
 
+/**
+ * Get a chained PRP list page for a cid from the queue pool, growing the
+ * pool by a chunk of pages if it is empty.
+ * @param   ns          namespace handle
+ * @param   q           queue
+ * @param   cid         queue entry index
+ * @return  the PRP list page.
+ */
+static unvme_prppage_t* unvme_prppage_get(const unvme_ns_t* ns,
+                                          unvme_queue_t* q, int cid)
+{
+    if (!q->prpfree) {
+        unvme_device_t* dev = ((unvme_session_t*)ns->ses)->dev;
+        int n = UNVME_PRPCHUNK_SIZE >> ns->pageshift;
+        unvme_prpchunk_t* chunk = zalloc(sizeof(unvme_prpchunk_t) +
+                                         n * sizeof(unvme_prppage_t));
+        chunk->dma = vfio_dma_alloc(&dev->vfiodev, UNVME_PRPCHUNK_SIZE);
+        if (!chunk->dma) FATAL("vfio_dma_alloc");
+        int i;
+        for (i = 0; i < n; i++) {
+            unvme_prppage_t* pp = &chunk->page[i];
+            pp->buf = chunk->dma->buf + ((u64)i << ns->pageshift);
+            pp->addr = chunk->dma->addr + ((u64)i << ns->pageshift);
+            pp->next = (i + 1) < n ? pp + 1 : NULL;
+        }
+        q->prpfree = chunk->page;
+        chunk->next = q->prpchunk;
+        q->prpchunk = chunk;
+        DEBUG_FN("q%d +%d PRP list pages", q->nvmeq->id, n);
+    }
+
+    // add the page to the cid page list (in chained order)
+    unvme_prppage_t* pp = q->prpfree;
+    q->prpfree = pp->next;
+    pp->next = NULL;
+    unvme_prppage_t** tail = &q->cidprp[cid];
+    while (*tail) tail = &(*tail)->next;
+    *tail = pp;
+    return pp;
+}
+
+/**
+ * Append a PRP entry to the PRP list of a cid.  When the last entry of a
+ * list page is needed for another entry, it is moved to a new chained page
+ * and replaced by the pointer to that page.
+ * @param   ns          namespace handle
+ * @param   q           queue
+ * @param   cid         queue entry index
+ * @param   prplist     current list page entry pointer (updated)
+ * @param   n           number of entries in the current list page (updated)
+ * @param   addr        PRP entry
+ */
+static inline void unvme_prplist_add(const unvme_ns_t* ns, unvme_queue_t* q,
+                                     int cid, u64** prplist, int* n, u64 addr)
+{
+    if (*n == (ns->pagesize / sizeof(u64))) {
+        unvme_prppage_t* pp = unvme_prppage_get(ns, q, cid);
+        u64* next = pp->buf;
+        next[0] = (*prplist)[-1];
+        (*prplist)[-1] = pp->addr;
+        *prplist = next + 1;
+        *n = 1;
+    }
+    *(*prplist)++ = addr;
+    (*n)++;
+}
+
 /**
  * Map the user buffer to PRP addresses (compose PRP list as necessary).
  * @param   ns          namespace handle
@@ -235,29 +769,47 @@ static u64 unvme_map_dma(const unvme_ns_t* ns, void* buf, u64 bufsz)
 static int unvme_map_prps(const unvme_ns_t* ns, unvme_queue_t* q, int cid,
                           void* buf, u64 bufsz, u64* prp1, u64* prp2)
 {
-    u64 addr = unvme_map_dma(ns, buf, bufsz);
+    // commands without data transfer (e.g. flush)
+    if (!bufsz) {
+        *prp1 = *prp2 = 0;
+        return 0;
+    }
+    u64 addr = unvme_map_dma(ns, q, buf, bufsz);
     if (addr == -1L) return -1;
 
+    // PRP entries after the first one must be page aligned
     *prp1 = addr;
     *prp2 = 0;
-    int numpages = (bufsz + ns->pagesize - 1) >> ns->pageshift;
+    u64 offset = addr & (ns->pagesize - 1);
+    int numpages = (offset + bufsz + ns->pagesize - 1) >> ns->pageshift;
+    addr -= offset;
     if (numpages == 2) {
         *prp2 = addr + ns->pagesize;
     } else if (numpages > 2) {
-        int prpoff = cid << ns->pageshift;
+        int prpoff = cid << q->prpshift;
         u64* prplist = q->prplist->buf + prpoff;
         *prp2 = q->prplist->addr + prpoff;
-        int i;
-        for (i = 1; i < numpages; i++) {
-            addr += ns->pagesize;
-            *prplist++ = addr;
+
+        // fill each list page and chain to the next one if more follow
+        int nent = ns->pagesize / sizeof(u64);
+        int count = numpages - 1;
+        addr += ns->pagesize;
+        while (count > nent) {
+            nvme_prp_fill(prplist, addr, ns->pagesize, nent - 1);
+            addr += (u64)(nent - 1) << ns->pageshift;
+            count -= nent - 1;
+            unvme_prppage_t* pp = unvme_prppage_get(ns, q, cid);
+            prplist[nent - 1] = pp->addr;
+            prplist = pp->buf;
         }
+        nvme_prp_fill(prplist, addr, ns->pagesize, count);
     }
     return 0;
 }
 
 /**
- * Submit a generic (vendor specific) NVMe command.
+ * Submit a read/write NVMe command.  The buffer is described by a single
+ * SGL data block descriptor if SGL is in use, otherwise by PRPs.
  * @param   ns          namespace handle
  * @param   desc        descriptor
  * @param   buf         data buffer
@@ -268,67 +820,756 @@ static int unvme_map_prps(const unvme_ns_t* ns, unvme_queue_t* q, int cid,
 static int unvme_submit_io(const unvme_ns_t* ns, unvme_desc_t* desc,
                            void* buf, u64 slba, u32 nlb)
 {
-    u64 prp1, prp2;
     unvme_queue_t* ioq = desc->q;
     u16 cid = unvme_get_cid(desc);
     u64 bufsz = (u64)nlb << ns->blockshift;
-    if (unvme_map_prps(ns, ioq, cid, buf, bufsz, &prp1, &prp2)) return -1;
 
     // submit I/O command
-    if (nvme_cmd_rw(ioq->nvmeq, desc->opc, cid,
-                    ns->id, slba, nlb, prp1, prp2)) return -1;
-    PDEBUG("# %c %#lx %#x q%d={%d %d %#lx} d={%d %d %#lx}",
+    if (ns->sgls) {
+        nvme_sgl_desc_t sgl = { .addr = unvme_map_dma(ns, ioq, buf, bufsz),
+                                .length = bufsz,
+                                .type = NVME_SGL_DATA_BLOCK };
+        if (nvme_cmd_rw_sgl(ioq->nvmeq, desc->opc, cid,
+                            ns->id, slba, nlb, &sgl)) return -1;
+    } else {
+        u64 prp1, prp2;
+        if (unvme_map_prps(ns, ioq, cid, buf, bufsz, &prp1, &prp2)) return -1;
+        if (nvme_cmd_rw(ioq->nvmeq, desc->opc, cid,
+                        ns->id, slba, nlb, prp1, prp2)) return -1;
+    }
+    PDEBUG("# %c %#lx %#x q%d={%d %d %#lx} d={%d %d}",
            desc->opc == NVME_CMD_READ ? 'r' : 'w', slba, nlb,
            ioq->nvmeq->id, cid, ioq->cidcount, *ioq->cidmask,
-           desc->id, desc->cidcount, *desc->cidmask);
+           desc->id, desc->cidcount);
     return cid;
 }
 
 /**
- * Initialize a queue allocating descriptors and PRP list pages.
- * @param   dev         device context
- * @param   q           queue
- * @param   qsize       queue depth
+ * Submit a vectored read/write command whose PRP entries have been
+ * composed in the PRP list slot of the command cid.
+ * If the submission fails, the cid is retired.
+ * @param   ns          namespace handle
+ * @param   desc        descriptor
+ * @param   cid         command id
+ * @param   prp1        first PRP entry
+ * @param   npages      number of PRP entries
+ * @param   slba        starting lba
+ * @param   nlb         number of logical blocks
+ * @return  0 if ok else -1.
  */
-static void unvme_queue_init(unvme_device_t* dev, unvme_queue_t* q, int qsize)
+static int unvme_submit_prps(const unvme_ns_t* ns, unvme_desc_t* desc, u16 cid,
+                             u64 prp1, int npages, u64 slba, u32 nlb)
 {
-    memset(q, 0, sizeof(*q));
-    q->size = qsize;
-
-    // allocate queue entries and PRP list
-    q->sqdma = vfio_dma_alloc(&dev->vfiodev, qsize * sizeof(nvme_sq_entry_t));
-    q->cqdma = vfio_dma_alloc(&dev->vfiodev, qsize * sizeof(nvme_cq_entry_t));
-    q->prplist = vfio_dma_alloc(&dev->vfiodev, qsize << dev->ns.pageshift);
-    if (!q->sqdma || !q->cqdma || !q->prplist)
-        FATAL("vfio_dma_alloc");
+    unvme_queue_t* ioq = desc->q;
+    int prpoff = cid << ioq->prpshift;
+    u64 prp2 = 0;
+    if (npages == 2) prp2 = *(u64*)(ioq->prplist->buf + prpoff);
+    else if (npages > 2) prp2 = ioq->prplist->addr + prpoff;
 
-    // setup descriptors and pending masks
-    q->masksize = ((qsize + 63) >> 6) << 3; // (qsize + 63) / 64) * sizeof(u64)
-    q->cidmask = zalloc(q->masksize);
-    int i;
-    for (i = 0; i < 16; i++) unvme_desc_get(q);
-    q->descfree = q->desclist;
-    q->desclist = NULL;
-    q->desccount = 0;
+    if (nvme_cmd_rw(ioq->nvmeq, desc->opc, cid,
+                    ns->id, slba, nlb, prp1, prp2)) {
+        unvme_complete_cid(ioq, cid, -1);
+        return -1;
+    }
+    PDEBUG("# %cv %#lx %#x q%d={%d %d %#lx} d={%d %d}",
+           desc->opc == NVME_CMD_READ ? 'r' : 'w', slba, nlb,
+           ioq->nvmeq->id, cid, ioq->cidcount, *ioq->cidmask,
+           desc->id, desc->cidcount);
+    return 0;
 }
 
 /**
- * Clean up a queue freeing its memory allocation.
- * @param   q           queue
+ * Submit a vectored read/write command whose SGL descriptors have been
+ * composed in the list slot of the command cid.  A single data block
+ * descriptor is placed in the command itself, otherwise the command
+ * points to the list as the last segment.
+ * If the submission fails, the cid is retired.
+ * @param   ns          namespace handle
+ * @param   desc        descriptor
+ * @param   cid         command id
+ * @param   ndesc       number of SGL descriptors
+ * @param   slba        starting lba
+ * @param   nlb         number of logical blocks
+ * @return  0 if ok else -1.
  */
-static void unvme_queue_cleanup(unvme_queue_t* q)
+static int unvme_submit_sgl(const unvme_ns_t* ns, unvme_desc_t* desc, u16 cid,
+                            int ndesc, u64 slba, u32 nlb)
 {
-    // free all descriptors
-    unvme_desc_t* desc;
-    while ((desc = q->desclist) != NULL) {
-        LIST_DEL(q->desclist, desc);
-        free(desc);
+    unvme_queue_t* ioq = desc->q;
+    int sgloff = cid << ioq->prpshift;
+    nvme_sgl_desc_t* sgl = ioq->prplist->buf + sgloff;
+    nvme_sgl_desc_t sgl1 = *sgl;
+    if (ndesc > 1 || sgl->type != NVME_SGL_DATA_BLOCK) {
+        sgl1 = (nvme_sgl_desc_t){ .addr = ioq->prplist->addr + sgloff,
+                                  .length = ndesc * sizeof(nvme_sgl_desc_t),
+                                  .type = NVME_SGL_LAST_SEGMENT };
+    }
+
+    if (nvme_cmd_rw_sgl(ioq->nvmeq, desc->opc, cid,
+                        ns->id, slba, nlb, &sgl1)) {
+        unvme_complete_cid(ioq, cid, -1);
+        return -1;
+    }
+    PDEBUG("# %cs %#lx %#x %d q%d={%d %d %#lx} d={%d %d}",
+           desc->opc == NVME_CMD_READ ? 'r' : 'w', slba, nlb, ndesc,
+           ioq->nvmeq->id, cid, ioq->cidcount, *ioq->cidmask,
+           desc->id, desc->cidcount);
+    return 0;
+}
+
+/**
+ * Submit the commands of a vectored read/write using PRPs.  The PRP entries
+ * are composed from the page runs of all the segments and a new command is
+ * only started where the PRP rules require (i.e. a segment not ending or
+ * the next one not starting on a page boundary) or the max transfer size
+ * is reached.
+ * @param   ns          namespace handle
+ * @param   desc        descriptor
+ * @param   iov         array of data buffer segments
+ * @param   iovcnt      number of segments
+ * @param   slba        starting lba
+ * @return  0 if ok else -1.
+ */
+static int unvme_submit_iov_prps(const unvme_ns_t* ns, unvme_desc_t* desc,
+                                 const struct iovec* iov, int iovcnt, u64 slba)
+{
+    unvme_queue_t* q = desc->q;
+    u64 pagemask = ns->pagesize - 1;
+    u64 prp1 = 0, end = 0, cmdsize = 0;
+    u64* prplist = NULL;
+    int npages = 0, nent = 0, i;
+    u16 cid = 0;
+
+    for (i = 0; i < iovcnt; i++) {
+        u64 addr = unvme_map_dma(ns, q, iov[i].iov_base, iov[i].iov_len);
+        u64 segend = addr + iov[i].iov_len;
+        while (addr < segend) {
+            u64 next = (addr | pagemask) + 1;
+            if (next > segend) next = segend;
+
+            // start a new command where the PRP entries cannot continue
+            if (npages && ((addr & pagemask) || (end & pagemask) ||
+                           npages == ns->maxppio)) {
+                u32 nlb = cmdsize >> ns->blockshift;
+                if (unvme_submit_prps(ns, desc, cid, prp1, npages, slba, nlb))
+                    return -1;
+                slba += nlb;
+                npages = 0;
+            }
+            if (npages == 0) {
+                cid = unvme_get_cid(desc);
+                prplist = q->prplist->buf + (cid << q->prpshift);
+                prp1 = addr;
+                cmdsize = 0;
+                nent = 0;
+            } else {
+                unvme_prplist_add(ns, q, cid, &prplist, &nent, addr);
+            }
+            npages++;
+            cmdsize += next - addr;
+            end = addr = next;
+        }
+    }
+    return unvme_submit_prps(ns, desc, cid, prp1, npages, slba,
+                             cmdsize >> ns->blockshift);
+}
+
+/**
+ * Submit the commands of a vectored read/write using SGLs.  Each segment
+ * is described by one data block (or bit bucket for a NULL read segment)
+ * descriptor, merged with the previous one when contiguous, and a new
+ * command is only started when the list page is full or the max transfer
+ * size is reached.
+ * @param   ns          namespace handle
+ * @param   desc        descriptor
+ * @param   iov         array of data buffer segments
+ * @param   iovcnt      number of segments
+ * @param   slba        starting lba
+ * @return  0 if ok else -1.
+ */
+static int unvme_submit_iov_sgl(const unvme_ns_t* ns, unvme_desc_t* desc,
+                                const struct iovec* iov, int iovcnt, u64 slba)
+{
+    unvme_queue_t* q = desc->q;
+    int maxdesc = (1 << q->prpshift) / sizeof(nvme_sgl_desc_t);
+    u64 cmdmax = (u64)ns->maxbpio << ns->blockshift;
+    u64 cmdsize = 0;
+    nvme_sgl_desc_t* sgl = NULL;
+    int ndesc = 0, i;
+    u16 cid = 0;
+
+    for (i = 0; i < iovcnt; i++) {
+        int type = iov[i].iov_base ? NVME_SGL_DATA_BLOCK : NVME_SGL_BIT_BUCKET;
+        u64 len = iov[i].iov_len;
+        u64 addr = 0;
+        if (type == NVME_SGL_DATA_BLOCK)
+            addr = unvme_map_dma(ns, q, iov[i].iov_base, len);
+        while (len) {
+            if (ndesc && (ndesc == maxdesc || cmdsize == cmdmax)) {
+                u32 nlb = cmdsize >> ns->blockshift;
+                if (unvme_submit_sgl(ns, desc, cid, ndesc, slba, nlb))
+                    return -1;
+                slba += nlb;
+                ndesc = 0;
+            }
+            if (ndesc == 0) {
+                cid = unvme_get_cid(desc);
+                sgl = q->prplist->buf + (cid << q->prpshift);
+                cmdsize = 0;
+            }
+
+            u64 n = cmdmax - cmdsize;
+            if (n > len) n = len;
+            nvme_sgl_desc_t* d = sgl + ndesc - 1;
+            if (ndesc && d->type == type &&
+                (type == NVME_SGL_BIT_BUCKET || (d->addr + d->length) == addr)) {
+                d->length += n;
+            } else {
+                sgl[ndesc++] = (nvme_sgl_desc_t){ .addr = addr, .length = n,
+                                                  .type = type };
+            }
+            if (type == NVME_SGL_DATA_BLOCK) addr += n;
+            cmdsize += n;
+            len -= n;
+        }
+    }
+    return unvme_submit_sgl(ns, desc, cid, ndesc, slba,
+                            cmdsize >> ns->blockshift);
+}
+
+/**
+ * Release a descriptor whose deferred callback has returned.
+ * @param   arg         descriptor
+ */
+static void unvme_fc_put(void* arg)
+{
+    unvme_desc_put(arg);
+}
+
+/**
+ * Execute an operation on a shared queue using flat combining.  The request
+ * is published on the queue and whichever thread holds the combiner role
+ * executes all the published requests (in order) with the submission queue
+ * plugged, so the doorbell is written once for the whole batch.
+ * A thread waiting for its request takes the combiner role when it is free.
+ * The completion callbacks of the commands completed while combining are
+ * invoked after the combiner role is released (holding no queue lock, so
+ * they may submit to this or another shared queue without deadlocking),
+ * and their descriptors are then released through the combiner.
+ * @param   q           queue
+ * @param   fn          operation function
+ * @param   arg         operation arguments
+ */
+static void unvme_combine(unvme_queue_t* q, void (*fn)(void*), void* arg)
+{
+    // operations nested in an operation executed by the combiner itself
+    if (unvme_fcq == q) {
+        fn(arg);
+        return;
+    }
+
+    unvme_fcreq_t req = { .fn = fn, .arg = arg };
+    do {
+        req.next = q->fcpub;
+    } while (!__sync_bool_compare_and_swap(&q->fcpub, req.next, &req));
+
+    while (!__atomic_load_n(&req.done, __ATOMIC_ACQUIRE)) {
+        if (q->fclock || __sync_lock_test_and_set(&q->fclock, 1)) {
+            __builtin_ia32_pause();
+            continue;
+        }
+
+        unvme_queue_t* fcq = unvme_fcq;
+        unvme_fcq = q;
+        int plugged = q->nvmeq->sq_plug;
+        if (!plugged) nvme_sq_plug(q->nvmeq);
+
+        int pass;
+        for (pass = 0; pass < UNVME_FC_PASSES && q->fcpub; pass++) {
+            // take the published list and reverse it to submission order
+            unvme_fcreq_t* r = __sync_lock_test_and_set(&q->fcpub, NULL);
+            unvme_fcreq_t* list = NULL;
+            while (r) {
+                unvme_fcreq_t* next = r->next;
+                r->next = list;
+                list = r;
+                r = next;
+            }
+            while ((r = list) != NULL) {
+                list = r->next;
+                r->fn(r->arg);
+                __atomic_store_n(&r->done, 1, __ATOMIC_RELEASE);
+            }
+        }
+
+        if (!plugged) nvme_sq_unplug(q->nvmeq);
+        unvme_fcq = fcq;
+        __sync_lock_release(&q->fclock);
+    }
+
+    // callbacks deferred by a nested operation are run by the outer loop
+    if (unvme_fcq || unvme_fccbrun) return;
+    unvme_fccbrun = 1;
+    unvme_desc_t* desc;
+    while ((desc = unvme_fccb) != NULL) {
+        if (!(unvme_fccb = desc->cbnext)) unvme_fccbtail = NULL;
+        if (desc->prep) {
+            desc->sentinel = NULL;
+            desc->cb((unvme_iod_t)desc, desc->arg);
+        } else {
+            desc->cb((unvme_iod_t)desc, desc->arg);
+            unvme_combine(desc->q, unvme_fc_put, desc);
+        }
+    }
+    unvme_fccbrun = 0;
+}
+
+/// Shared queue read/write operation arguments
+typedef struct {
+    const unvme_ns_t*       ns;         ///< namespace handle
+    int                     qid;        ///< queue id
+    int                     opc;        ///< op code
+    void*                   buf;        ///< data buffer
+    const struct iovec*     iov;        ///< data buffer segments (vectored)
+    int                     iovcnt;     ///< number of segments (vectored)
+    u64                     slba;       ///< starting lba
+    u32                     nlb;        ///< number of blocks
+    unvme_cb_t              cb;         ///< completion callback
+    void*                   arg;        ///< user context
+    unvme_desc_t*           desc;       ///< returned descriptor
+    int                     err;        ///< returned errno (if no descriptor)
+    int                     ret;        ///< returned status (descriptor-less)
+} unvme_fcrw_t;
+
+/**
+ * Execute a published read/write operation.
+ * @param   arg         operation arguments
+ */
+static void unvme_fc_rw(void* arg)
+{
+    unvme_fcrw_t* a = arg;
+    a->desc = unvme_do_rw(a->ns, a->qid, a->opc, a->buf, a->slba, a->nlb,
+                          a->cb, a->arg);
+    if (!a->desc) a->err = errno;
+}
+
+/**
+ * Execute a published vectored read/write operation.
+ * @param   arg         operation arguments
+ */
+static void unvme_fc_rwv(void* arg)
+{
+    unvme_fcrw_t* a = arg;
+    a->desc = unvme_do_rwv(a->ns, a->qid, a->opc, a->iov, a->iovcnt, a->slba,
+                           a->cb, a->arg);
+    if (!a->desc) a->err = errno;
+}
+
+/**
+ * Execute a published descriptor-less write operation.
+ * @param   arg         operation arguments
+ */
+static void unvme_fc_write_ff(void* arg)
+{
+    unvme_fcrw_t* a = arg;
+    a->ret = unvme_do_write_ff(a->ns, a->qid, a->buf, a->slba, a->nlb);
+    if (a->ret) a->err = errno;
+}
+
+/// Shared queue command operation arguments
+typedef struct {
+    const unvme_ns_t*       ns;         ///< namespace handle
+    int                     qid;        ///< queue id
+    int                     opc;        ///< op code
+    int                     nsid;       ///< namespace id
+    void*                   buf;        ///< data buffer
+    u64                     bufsz;      ///< data buffer size
+    u32*                    cdw10_15;   ///< command word 10 through 15
+    unvme_cb_t              cb;         ///< completion callback
+    void*                   arg;        ///< user context
+    unvme_desc_t*           desc;       ///< returned descriptor
+    int                     err;        ///< returned errno (if no descriptor)
+} unvme_fccmd_t;
+
+/**
+ * Execute a published command operation.
+ * @param   arg         operation arguments
+ */
+static void unvme_fc_cmd(void* arg)
+{
+    unvme_fccmd_t* a = arg;
+    a->desc = unvme_do_cmd(a->ns, a->qid, a->opc, a->nsid, a->buf, a->bufsz,
+                           a->cdw10_15, a->cb, a->arg);
+    if (!a->desc) a->err = errno;
+}
+
+/// Shared queue completion operation arguments
+typedef struct {
+    const unvme_ns_t*       ns;         ///< namespace handle
+    int                     qid;        ///< queue id
+    int                     max;        ///< max number of descriptors
+    const unvme_io_t*       io;         ///< batch requests
+    unvme_iod_t*            iods;       ///< returned descriptors
+    unvme_desc_t*           desc;       ///< descriptor to poll
+    u32*                    cqe_cs;     ///< returned CQE command specific DW0
+    int                     err;        ///< polled descriptor error status
+    int                     ret;        ///< operation return value
+} unvme_fcpoll_t;
+
+/**
+ * Execute a published reap operation.
+ * @param   arg         operation arguments
+ */
+static void unvme_fc_reap(void* arg)
+{
+    unvme_fcpoll_t* a = arg;
+    a->ret = unvme_do_reap(a->ns, a->qid, a->max, a->iods);
+}
+
+/**
+ * Execute a published process operation.
+ * @param   arg         operation arguments
+ */
+static void unvme_fc_process(void* arg)
+{
+    unvme_fcpoll_t* a = arg;
+    a->ret = unvme_do_process(a->ns, a->qid, a->max);
+}
+
+/**
+ * Execute a published batch submission operation.
+ * @param   arg         operation arguments
+ */
+static void unvme_fc_batch(void* arg)
+{
+    unvme_fcpoll_t* a = arg;
+    a->ret = unvme_do_batch(a->ns, a->qid, a->io, a->max, a->iods);
+}
+
+/**
+ * Poll a descriptor on behalf of its submitter thread.  All the ready
+ * completions are processed for every thread and the descriptor is
+ * released if it has completed (setting ret to 1).
+ * @param   arg         operation arguments
+ */
+static void unvme_fc_poll(void* arg)
+{
+    unvme_fcpoll_t* a = arg;
+    unvme_desc_t* desc = a->desc;
+    unvme_queue_t* q = desc->q;
+
+    int err, cid;
+    while ((cid = unvme_reap_cid(q, &err,
+                                       desc->cidcount ? a->cqe_cs : NULL)) >= 0)
+        unvme_complete_cid(q, cid, err);
+    unvme_cq_flush(q);
+    if (q->ovfhead) unvme_ovf_drain(q);
+
+    if (desc->cidcount == 0) {
+        a->err = desc->error;
+        a->ret = 1;
+        unvme_desc_put(desc);
+    }
+}
+
+/**
+ * Completion reactor thread.  Reap the completion queues of all the I/O
+ * queues of a device and hand the completions to the submitting threads
+ * through the queue hand-off rings.  The descriptors (and all the other
+ * queue states) are only accessed by the submitting threads, which look
+ * up the command ids upon consuming the ring entries (and block on the
+ * ring tail while waiting).  The thread parks while no command is pending
+ * on any queue, until woken by the next submission.
+ * @param   arg         device context
+ */
+static void* unvme_reactor(void* arg)
+{
+    unvme_device_t* dev = arg;
+    int idle = 0;
+    while (!__atomic_load_n(&dev->rstop, __ATOMIC_ACQUIRE)) {
+        int i, n = 0;
+        for (i = 0; i < dev->ns.qcount; i++) {
+            unvme_queue_t* q = dev->ioqs + i;
+            unvme_cqring_t* r = q->cqring;
+            u32 tail = r->tail;
+            int cid, stat;
+            u32 cs;
+            // the ring never overflows as it holds up to a queue size of
+            // entries and a cid is only freed when its entry is consumed
+            while ((cid = nvme_reap_completion(q->nvmeq, &stat, &cs)) >= 0) {
+                unvme_cqe_t* cqe = &r->ent[tail & r->mask];
+                cqe->cid = cid;
+                cqe->stat = stat;
+                cqe->cs = cs;
+                tail++;
+            }
+            if (tail != r->tail) {
+                __atomic_store_n(&r->tail, tail, __ATOMIC_SEQ_CST);
+                nvme_cq_flush(q->nvmeq);
+                if (__atomic_load_n(&r->waiters, __ATOMIC_SEQ_CST))
+                    unvme_futex(&r->tail, FUTEX_WAKE_PRIVATE, INT_MAX, NULL);
+                n++;
+            }
+            // the queue fd is signaled while the ring is not drained (not
+            // just upon publishing) as the consumer arms after its last check
+            if (__atomic_load_n(&q->armed, __ATOMIC_SEQ_CST) &&
+                __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) != tail)
+                unvme_notify(q);
+        }
+        if (n) {
+            idle = 0;
+        } else if (++idle < 1024) {
+            __builtin_ia32_pause();
+        } else {
+            // park if no command is pending, else give up the CPU when idle
+            // for a while (the parked flag is published before checking the
+            // queues, so that a concurrent first submission wakes it up)
+            idle = 0;
+            __atomic_store_n(&dev->rsleep, 1, __ATOMIC_SEQ_CST);
+            for (i = 0; i < dev->ns.qcount; i++) {
+                if (__atomic_load_n(&dev->ioqs[i].cidcount, __ATOMIC_SEQ_CST))
+                    break;
+            }
+            if (i < dev->ns.qcount || __atomic_load_n(&dev->rstop, __ATOMIC_SEQ_CST))
+                sched_yield();
+            else
+                unvme_futex(&dev->rsleep, FUTEX_WAIT_PRIVATE, 1, NULL);
+            __atomic_store_n(&dev->rsleep, 0, __ATOMIC_SEQ_CST);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Start the completion reactor thread of a device.
+ * @param   dev         device context
+ * @param   cpu         CPU to run the thread on (-1 for any)
+ */
+static void unvme_reactor_start(unvme_device_t* dev, int cpu)
+{
+    int i;
+    for (i = 0; i < dev->ns.qcount; i++) {
+        unvme_queue_t* q = dev->ioqs + i;
+        u32 size = 1;
+        while (size < q->size) size <<= 1;
+        u64 len = sizeof(unvme_cqring_t) + size * sizeof(unvme_cqe_t);
+        len = (len + 63) & ~63UL;
+        if (!(q->cqring = aligned_alloc(64, len))) FATAL("aligned_alloc");
+        memset(q->cqring, 0, len);
+        q->cqring->mask = size - 1;
+    }
+
+    if (pthread_create(&dev->reactor, NULL, unvme_reactor, dev))
+        FATAL("pthread_create reactor");
+    if (cpu >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        if (pthread_setaffinity_np(dev->reactor, sizeof(cpus), &cpus))
+            ERROR("reactor CPU %d affinity failed", cpu);
+    }
+    DEBUG_FN("%x cpu=%d", dev->vfiodev.pci, cpu);
+}
+
+/**
+ * Stop the completion reactor thread of a device.
+ * @param   dev         device context
+ */
+static void unvme_reactor_stop(unvme_device_t* dev)
+{
+    __atomic_store_n(&dev->rstop, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_exchange_n(&dev->rsleep, 0, __ATOMIC_SEQ_CST))
+        unvme_futex(&dev->rsleep, FUTEX_WAKE_PRIVATE, 1, NULL);
+    pthread_join(dev->reactor, NULL);
+}
+
+/**
+ * Completion notifier thread with interrupts.  Block on the MSIX vector
+ * eventfds (and the wake eventfd) and signal the queue fd of each armed
+ * queue that has a completion entry posted once an interrupt has fired.
+ * The blocked flag stays set so that interrupt waiters consuming a vector
+ * event wake it up to check the queues sharing the vector.
+ * @param   dev         device context
+ */
+static void unvme_notifier_intr(unvme_device_t* dev)
+{
+    int i, n = dev->nefd;
+    struct pollfd* pfd = zalloc((n + 1) * sizeof(struct pollfd));
+    for (i = 0; i < n; i++) pfd[i] = (struct pollfd){ .fd = dev->efds[i], .events = POLLIN };
+    pfd[n] = (struct pollfd){ .fd = dev->nwfd, .events = POLLIN };
+
+    while (!__atomic_load_n(&dev->nstop, __ATOMIC_ACQUIRE)) {
+        __atomic_store_n(&dev->nsleep, 1, __ATOMIC_SEQ_CST);
+        for (i = 0; i < dev->ns.qcount; i++) {
+            unvme_queue_t* q = dev->ioqs + i;
+            if (__atomic_load_n(&q->armed, __ATOMIC_SEQ_CST) && nvme_cq_ready(q->nvmeq))
+                unvme_notify(q);
+        }
+        if (poll(pfd, n + 1, -1) < 0) {
+            if (errno != EINTR) ERROR("notifier poll: %s", strerror(errno));
+            continue;
+        }
+        for (i = 0; i <= n; i++) {
+            u64 val;
+            if ((pfd[i].revents & POLLIN) &&
+                read(pfd[i].fd, &val, sizeof(val)) < 0 && errno != EAGAIN)
+                ERROR("notifier read: %s", strerror(errno));
+        }
+    }
+    free(pfd);
+}
+
+/**
+ * Completion notifier thread.  Signal the queue fd of each armed queue
+ * (i.e. drained by its consumer) as soon as its next completion entry is
+ * posted.  The completion queues are only peeked and never consumed.
+ * With interrupts, the thread blocks on the interrupts.  Otherwise, it
+ * naps while the armed queues have commands pending, and blocks when
+ * none has (until woken by a submission or an arming).
+ * @param   arg         device context
+ */
+static void* unvme_notifier(void* arg)
+{
+    unvme_device_t* dev = arg;
+    if (dev->nefd) {
+        unvme_notifier_intr(dev);
+        return NULL;
+    }
+
+    int idle = 0;
+    int blocked = 0;
+    while (!__atomic_load_n(&dev->nstop, __ATOMIC_ACQUIRE)) {
+        int i, n = 0, busy = 0;
+        for (i = 0; i < dev->ns.qcount; i++) {
+            unvme_queue_t* q = dev->ioqs + i;
+            if (!__atomic_load_n(&q->armed, __ATOMIC_SEQ_CST)) continue;
+            if (nvme_cq_ready(q->nvmeq)) {
+                unvme_notify(q);
+                n++;
+            } else if (__atomic_load_n(&q->cidcount, __ATOMIC_RELAXED)) {
+                busy++;
+            }
+        }
+        if (!n && !busy) {
+            // publish the blocked flag and check the queues again before
+            // blocking, so a concurrent submission or arming wakes it up
+            if (!blocked) {
+                blocked = 1;
+                __atomic_store_n(&dev->nsleep, 1, __ATOMIC_SEQ_CST);
+                continue;
+            }
+            u64 val;
+            if (read(dev->nwfd, &val, sizeof(val)) < 0 && errno != EINTR)
+                ERROR("notifier read: %s", strerror(errno));
+        }
+        if (blocked) {
+            blocked = 0;
+            __atomic_store_n(&dev->nsleep, 0, __ATOMIC_SEQ_CST);
+        }
+        if (n || !busy) {
+            idle = 0;
+        } else if (++idle < 64) {
+            __builtin_ia32_pause();
+        } else {
+            struct timespec ts = { 0, UNVME_NOTIFY_USEC * 1000 };
+            nanosleep(&ts, NULL);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Get the size shift of the PRP list (or SGL) slot of each queue entry.
+ * A slot is a memory page, unless the pages are large enough for the
+ * PRP entries of a max size command to fit in less than 4K.
+ * @param   pageshift   memory page size shift
+ * @return  slot size shift.
+ */
+static int unvme_prp_slotshift(int pageshift)
+{
+    if (pageshift <= 12) return pageshift;
+
+    // entries of a command with up to 0xffff blocks of at least 512 bytes
+    u64 size = ((0xffff >> (pageshift - 9)) + 1) * sizeof(u64);
+    int shift = 64 - __builtin_clzll(size - 1);
+    if (shift < 12) shift = 12;
+    return shift < pageshift ? shift : pageshift;
+}
+
+/**
+ * Initialize a queue allocating descriptors and PRP list pages.
+ * @param   dev         device context
+ * @param   q           queue
+ * @param   qsize       queue depth
+ */
+static void unvme_queue_init(unvme_device_t* dev, unvme_queue_t* q, int qsize)
+{
+    memset(q, 0, sizeof(*q));
+    q->dev = dev;
+    q->size = qsize;
+    q->efd = -1;
+    q->qfd = -1;
+    q->wait = UNVME_WAIT_YIELD;
+    q->ovfmax = -1;
+
+    // allocate queue entries and PRP list
+    q->sqdma = vfio_dma_alloc(&dev->vfiodev, qsize * sizeof(nvme_sq_entry_t));
+    q->cqdma = vfio_dma_alloc(&dev->vfiodev, qsize * sizeof(nvme_cq_entry_t));
+    q->prpshift = unvme_prp_slotshift(dev->ns.pageshift);
+    q->prplist = vfio_dma_alloc(&dev->vfiodev, qsize << q->prpshift);
+    if (!q->sqdma || !q->cqdma || !q->prplist)
+        FATAL("vfio_dma_alloc");
+
+    // setup descriptors, pending masks and cid owner table
+    q->masksize = ((qsize + 63) >> 6) << 3; // (qsize + 63) / 64) * sizeof(u64)
+    q->cidmask = zalloc(q->masksize);
+    if (qsize & 63) q->cidmask[qsize >> 6] = ~0UL << (qsize & 63);
+    q->cidtab = zalloc(qsize * sizeof(unvme_desc_t*));
+    q->cidprp = zalloc(qsize * sizeof(unvme_prppage_t*));
+    q->cidtsc = zalloc(qsize * sizeof(u64));
+    q->ffio = zalloc(qsize * sizeof(unvme_io_t));
+    q->ffdesc.q = q;
+    q->ffdesc.opc = NVME_CMD_WRITE;
+    int i;
+    for (i = 0; i < 16; i++) unvme_desc_get(q);
+    q->descfree = q->desclist;
+    q->desclist = NULL;
+    q->desccount = 0;
+}
+
+/**
+ * Clean up a queue freeing its memory allocation.
+ * @param   q           queue
+ */
+static void unvme_queue_cleanup(unvme_queue_t* q)
+{
+    // free all descriptors
+    unvme_desc_t* desc;
+    while ((desc = q->desclist) != NULL) {
+        LIST_DEL(q->desclist, desc);
+        free(desc);
+    }
+    while ((desc = q->descdone) != NULL) {
+        LIST_DEL(q->descdone, desc);
+        free(desc);
     }
     while ((desc = q->descfree) != NULL) {
         LIST_DEL(q->descfree, desc);
         free(desc);
     }
 
+    unvme_prpchunk_t* chunk;
+    while ((chunk = q->prpchunk) != NULL) {
+        q->prpchunk = chunk->next;
+        vfio_dma_free(chunk->dma);
+        free(chunk);
+    }
+    if (q->cidprp) free(q->cidprp);
+    if (q->cidtsc) free(q->cidtsc);
+    if (q->ffio) free(q->ffio);
+    if (q->cqring) free(q->cqring);
+    if (q->qfd >= 0) close(q->qfd);
+    if (q->cidtab) free(q->cidtab);
     if (q->cidmask) free(q->cidmask);
     if (q->prplist) vfio_dma_free(q->prplist);
     if (q->cqdma) vfio_dma_free(q->cqdma);
@@ -362,6 +1603,28 @@ static void unvme_adminq_delete(unvme_device_t* dev)
     unvme_queue_cleanup(&dev->adminq);
 }
 
+/**
+ * Get the NUMA node to place the memory of an I/O queue on.  The queues
+ * are spread over the memory nodes allowed to the process, so threads on
+ * every node may bind to a queue with local memory.
+ * @param   q           queue index starting at 0
+ * @return  node or -1 if there's a single node.
+ */
+static int unvme_ioq_node(int q)
+{
+    u64 mask[16] = { 0 };
+    int i, n = 0, maxnode = sizeof(mask) * 8;
+    if (syscall(SYS_get_mempolicy, NULL, mask, maxnode, NULL, MPOL_F_MEMS_ALLOWED))
+        return -1;
+    for (i = 0; i < maxnode; i++) n += (mask[i >> 6] >> (i & 63)) & 1;
+    if (n < 2) return -1;
+    n = q % n;
+    for (i = 0; i < maxnode; i++) {
+        if (((mask[i >> 6] >> (i & 63)) & 1) && n-- == 0) return i;
+    }
+    return -1;
+}
+
 /**
  * Create an I/O queue.
  * @param   dev         device context
@@ -371,11 +1634,42 @@ static void unvme_ioq_create(unvme_device_t* dev, int q)
 {
     DEBUG_FN("%x q=%d", dev->vfiodev.pci, q+1);
     unvme_queue_t* ioq = dev->ioqs + q;
+
+    // allocate (and first touch) the queue memory on its target node by
+    // preferring the node while the queue is initialized
+    u64 oldmask[16] = { 0 }, mask[16] = { 0 };
+    int maxnode = sizeof(mask) * 8, mode = MPOL_DEFAULT;
+    int node = unvme_ioq_node(q);
+    if (node >= 0) {
+        mask[node >> 6] = 1UL << (node & 63);
+        if (syscall(SYS_get_mempolicy, &mode, oldmask, maxnode, NULL, 0) ||
+            syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask, maxnode)) {
+            ERROR("q%d node %d policy: %s", q+1, node, strerror(errno));
+            node = -1;
+        }
+    }
     unvme_queue_init(dev, ioq, dev->ns.qsize);
+    if (node >= 0 && syscall(SYS_set_mempolicy, mode, oldmask, maxnode))
+        ERROR("restore memory policy: %s", strerror(errno));
+
+    // share the MSIX vectors (vector 0 is for the admin queue) if necessary
+    int iv = -1;
+    if (dev->nefd) {
+        iv = 1 + q % dev->nefd;
+        ioq->efd = dev->efds[iv - 1];
+        ioq->efdshared = dev->nefd < dev->ns.qcount;
+    }
     if (!(ioq->nvmeq = nvme_ioq_create(&dev->nvmedev, NULL, q+1, ioq->size,
                                        ioq->sqdma->buf, ioq->sqdma->addr,
-                                       ioq->cqdma->buf, ioq->cqdma->addr)))
+                                       ioq->cqdma->buf, ioq->cqdma->addr, iv)))
         FATAL("nvme_ioq_create %d failed", q+1);
+
+    // record the NUMA node the queue memory is actually on for thread
+    // binding (e.g. preallocated huge pages are not placed by the policy)
+    ioq->node = -1;
+    if (syscall(SYS_get_mempolicy, &ioq->node, NULL, 0, ioq->sqdma->buf,
+                MPOL_F_NODE | MPOL_F_ADDR))
+        ioq->node = -1;
     DEBUG_FN("%x q=%d qd=%d db=%#04lx", dev->vfiodev.pci, ioq->nvmeq->id,
              ioq->size, (u64)ioq->nvmeq->sq_doorbell - (u64)dev->nvmedev.reg);
 }
@@ -414,24 +1708,76 @@ static void unvme_ns_init(unvme_ns_t* ns, int nsid)
     ns->bpshift = ns->pageshift - ns->blockshift;
     ns->nbpp = 1 << ns->bpshift;
     ns->pagecount = ns->blockcount >> ns->bpshift;
+    if (ns->maxppio > (0xffff >> ns->bpshift))
+        ns->maxppio = 0xffff >> ns->bpshift;
     ns->maxbpio = ns->maxppio << ns->bpshift;
+
+    // optimal boundaries (the write ones are only valid if OPTPERF is set)
+    ns->noiob = idns->noiob;
+    if (idns->nsfeat & NVME_NSFEAT_OPTPERF) {
+        ns->npwg = idns->npwg + 1;
+        ns->npwa = idns->npwa + 1;
+        ns->nows = idns->nows + 1;
+    }
+    if (ns->optsplit)
+        ns->optsplit = ns->noiob || ns->npwg > 1 || ns->npwa > 1 || ns->nows > 1;
     vfio_dma_free(dma);
 
     sprintf(ns->device + strlen(ns->device), "/%d", nsid);
-    DEBUG_FN("%s qc=%d qd=%d bs=%d bc=%#lx mbio=%d", ns->device, ns->qcount,
-             ns->qsize, ns->blocksize, ns->blockcount, ns->maxbpio);
+    DEBUG_FN("%s qc=%d qd=%d bs=%d bc=%#lx mbio=%d iob=%d pwg=%d pwa=%d ows=%d",
+             ns->device, ns->qcount, ns->qsize, ns->blocksize, ns->blockcount,
+             ns->maxbpio, ns->noiob, ns->npwg, ns->npwa, ns->nows);
 }
 
 /**
- * Clean up.
+ * Free the fixed buffers and their PRP list chunks.
+ * @param   fixbufs     fixed buffers
+ * @param   fixprp      PRP list chunks
+ * @param   nchunk      number of allocated chunks
+ */
+static void unvme_fixbuf_free(unvme_fixbuf_t* fixbufs, vfio_dma_t** fixprp,
+                              int nchunk)
+{
+    while (nchunk > 0) vfio_dma_free(fixprp[--nchunk]);
+    free(fixprp);
+    free(fixbufs);
+}
+
+/**
+ * Clean up.  The prepared requests left are released (except a pending
+ * one while the device remains open, as its command may still complete).
  */
 static void unvme_cleanup(unvme_session_t* ses)
 {
     unvme_device_t* dev = ses->dev;
+    unvme_prep_t* prep;
+    while ((prep = ses->preplist) != NULL) {
+        LIST_DEL(ses->preplist, prep);
+        if (prep->desc.sentinel && dev->refcount > 1) {
+            ERROR("prepared request pending on close");
+        } else {
+            free(prep);
+        }
+    }
+    if (ses->fixbufs) unvme_fixbuf_free(ses->fixbufs, ses->fixprp, ses->fixchunks);
     if (--dev->refcount == 0) {
         DEBUG_FN("%s", ses->ns.device);
         int q;
+        if (dev->ns.reactor) unvme_reactor_stop(dev);
+        if (dev->nstart) {
+            u64 one = 1;
+            __atomic_store_n(&dev->nstop, 1, __ATOMIC_RELEASE);
+            if (write(dev->nwfd, &one, sizeof(one)) < 0)
+                ERROR("notifier wake: %s", strerror(errno));
+            pthread_join(dev->notifier, NULL);
+            close(dev->nwfd);
+        }
         for (q = 0; q < dev->ns.qcount; q++) unvme_ioq_delete(dev, q);
+        if (dev->nefd) {
+            vfio_msix_disable(&dev->vfiodev);
+            for (q = 0; q < dev->nefd; q++) close(dev->efds[q]);
+            free(dev->efds);
+        }
         unvme_adminq_delete(dev);
         nvme_delete(&dev->nvmedev);
         vfio_delete(&dev->vfiodev);
@@ -446,13 +1792,18 @@ static void unvme_cleanup(unvme_session_t* ses)
 
 /**
  * Open and attach to a UNVMe driver.
+ * The open options (number of queues, queue size and shared mode) only
+ * apply to the first session opened on a device.
+ * With UNVME_OPT_SHARED, each I/O queue may be used by multiple threads
+ * concurrently.  Operations are published to the queue and executed by
+ * whichever thread holds the combiner role (see unvme_combine), so
+ * completion callbacks may be invoked on any of the threads using the queue.
  * @param   pci         PCI device id
  * @param   nsid        namespace id
- * @param   qcount      number of queues (0 for max number of queues support)
- * @param   qsize       size of each queue (0 default to 65)
+ * @param   opts        open options
  * @return  namespace pointer or NULL if error.
  */
-unvme_ns_t* unvme_do_open(int pci, int nsid, int qcount, int qsize)
+unvme_ns_t* unvme_do_open(int pci, int nsid, const unvme_opts_t* opts)
 {
     unvme_lockw(&unvme_lock);
     if (!unvme_ses) {
@@ -496,6 +1847,7 @@ unvme_ns_t* unvme_do_open(int pci, int nsid, int qcount, int qsize)
     } else {
         // setup controller namespace
         dev = zalloc(sizeof(unvme_device_t));
+        dev->id = ++unvme_devid;
         vfio_create(&dev->vfiodev, pci, noiommu);
         nvme_create(&dev->nvmedev, dev->vfiodev.fd);
         unvme_adminq_create(dev, 64);
@@ -516,7 +1868,27 @@ unvme_ns_t* unvme_do_open(int pci, int nsid, int qcount, int qsize)
         ns->nscount = idc->nn;
         sprintf(ns->device, "%02x:%02x.%x", pci >> 16, (pci >> 8) & 0xff, pci & 0xff);
         ns->maxqsize = dev->nvmedev.maxqsize;
-        ns->pageshift = dev->nvmedev.pageshift;
+
+        // switch to the largest memory page size supported by both the
+        // controller and the DMA allocator, within the max transfer size
+        // and the PRP list page pool chunk, by re-enabling the controller
+        nvme_device_t* nvmedev = &dev->nvmedev;
+        if (opts->flags & UNVME_OPT_LARGE_MPS) {
+            int shift = 12 + nvmedev->mpsmax;
+            int maxshift = 63 - __builtin_clzll(dev->vfiodev.maxalign);
+            if (shift > maxshift) shift = maxshift;
+            maxshift = 63 - __builtin_clzll(UNVME_PRPCHUNK_SIZE);
+            if (shift > maxshift) shift = maxshift;
+            maxshift = 12 + nvmedev->mpsmin + idc->mdts;
+            if (idc->mdts && shift > maxshift) shift = maxshift;
+            if (shift > nvmedev->pageshift) {
+                nvmedev->pageshift = shift;
+                dev->vfiodev.dmaalign = 1UL << shift;
+                unvme_adminq_delete(dev);
+                unvme_adminq_create(dev, 64);
+            }
+        }
+        ns->pageshift = nvmedev->pageshift;
         ns->pagesize = 1 << ns->pageshift;
         int i;
         ns->vid = idc->vid;
@@ -527,12 +1899,20 @@ unvme_ns_t* unvme_do_open(int pci, int nsid, int qcount, int qsize)
         memcpy(ns->fr, idc->fr, sizeof (ns->fr));
         for (i = sizeof (ns->fr) - 1; i > 0 && ns->fr[i] == ' '; i--) ns->fr[i] = 0;
 
-        // set limit to 1 PRP list page per IO submission
-        ns->maxppio = ns->pagesize / sizeof(u64);
+        // set limit to the controller MDTS (using chained PRP list pages)
+        // or to 1 PRP list page per IO submission if MDTS is unlimited
+        // (MDTS is in minimum memory page size units)
+        u32 mp = ns->pagesize / sizeof(u64);
         if (idc->mdts) {
-            int mp = 2 << (idc->mdts - 1);
-            if (ns->maxppio > mp) ns->maxppio = mp;
+            mp = idc->mdts < 15 ? 1 << idc->mdts : 0x8000;
+            mp >>= ns->pageshift - 12 - nvmedev->mpsmin;
         }
+        ns->maxppio = mp < 0xffff ? mp : 0xffff;
+
+        // use SGL for I/O data transfer if supported (unless disabled)
+        ns->sgls = (idc->sgls & NVME_SGLS_SUPPORT) ? idc->sgls : 0;
+        char* sgl_env = secure_getenv(UNVME_SGL_ENV);
+        if (sgl_env && !atoi(sgl_env)) ns->sgls = 0;
         vfio_dma_free(dma);
 
         // get max number of queues supported
@@ -541,16 +1921,66 @@ unvme_ns_t* unvme_do_open(int pci, int nsid, int qcount, int qsize)
                                    NVME_FEATURE_NUM_QUEUES, 0, 0, (u32*)&nq))
             FATAL("nvme_acmd_get_features number of queues failed");
         int maxqcount = (nq.nsq < nq.ncq ? nq.nsq : nq.ncq) + 1;
+        int qcount = opts->qcount;
+        int qsize = opts->qsize;
         if (qcount <= 0) qcount = maxqcount;
         if (qsize <= 1) qsize = UNVME_QSIZE;
         if (qsize > dev->nvmedev.maxqsize) qsize = dev->nvmedev.maxqsize;
         ns->maxqcount = maxqcount;
         ns->qcount = qcount;
         ns->qsize = qsize;
+        ns->shared = (opts->flags & UNVME_OPT_SHARED) != 0;
+        ns->optsplit = !(opts->flags & UNVME_OPT_NAIVE_SPLIT);
+
+        // setup completion interrupts (MSIX vector 0 is for the admin queue)
+        if (opts->flags & UNVME_OPT_INTR) {
+            int nvec = dev->vfiodev.msixsize - 1;
+            if (nvec > qcount) nvec = qcount;
+            if (nvec > 0) {
+                dev->efds = zalloc(nvec * sizeof(int));
+                for (i = 0; i < nvec; i++) {
+                    dev->efds[i] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+                    if (dev->efds[i] < 0) FATAL("eventfd: %s", strerror(errno));
+                }
+                vfio_msix_enable(&dev->vfiodev, 1, nvec, dev->efds);
+                dev->nefd = nvec;
+
+                nvme_feature_int_coalescing_t ic = { .thr = opts->icthr,
+                                                     .time = opts->ictime };
+                if (opts->icthr || opts->ictime) {
+                    u32 res;
+                    memcpy(&res, &ic, sizeof(res));
+                    if (nvme_acmd_set_features(&dev->nvmedev, 0,
+                                               NVME_FEATURE_INT_COALESCING,
+                                               0, 0, &res))
+                        ERROR("set interrupt coalescing %d %d failed",
+                              opts->icthr, opts->ictime);
+                }
+            } else {
+                ERROR("%s no MSIX vector for I/O queues (using polling)",
+                      ns->device);
+            }
+        }
+        ns->intr = dev->nefd > 0;
 
         // setup IO queues
         dev->ioqs = zalloc(qcount * sizeof(unvme_queue_t));
         for (i = 0; i < qcount; i++) unvme_ioq_create(dev, i);
+
+        // start the completion reactor thread
+        ns->reactor = (opts->flags & UNVME_OPT_REACTOR) != 0;
+        if (ns->reactor) unvme_reactor_start(dev, opts->rcpu - 1);
+
+        for (i = 0; i < qcount; i++) {
+            dev->ioqs[i].shared = ns->shared;
+            dev->ioqs[i].wstats = (opts->flags & UNVME_OPT_WAIT_STATS) != 0;
+            int wait = unvme_wait_resolve(dev->ioqs + i, opts->wait);
+            if (wait < 0) {
+                ERROR("%s wait strategy %d not supported", ns->device, opts->wait);
+                wait = unvme_wait_resolve(dev->ioqs + i, UNVME_WAIT_DEFAULT);
+            }
+            dev->ioqs[i].wait = wait;
+        }
     }
 
     // allocate new session
@@ -584,132 +2014,1224 @@ int unvme_do_close(const unvme_ns_t* ns)
 }
 
 /**
- * Allocate an I/O buffer.
- * @param   ns          namespace handle
- * @param   size        buffer size
- * @return  the allocated buffer or NULL if failure.
+ * Check if a queue binding refers to an opened device.
+ * The caller must hold the session lock.
+ * @param   b           binding
+ * @return  1 if valid else 0.
  */
-void* unvme_do_alloc(const unvme_ns_t* ns, u64 size)
+static int unvme_bind_valid(unvme_binding_t* b)
 {
-    DEBUG_FN("%s %#lx", ns->device, size);
-    unvme_device_t* dev = ((unvme_session_t*)ns->ses)->dev;
-    unvme_iomem_t* iomem = &dev->iomem;
-    void* buf = NULL;
+    unvme_session_t* ses = unvme_ses;
+    while (ses) {
+        if (ses->dev == b->dev && ses->dev->id == b->devid) return 1;
+        ses = ses->next;
+        if (ses == unvme_ses) break;
+    }
+    return 0;
+}
 
-    unvme_lockw(&iomem->lock);
-    vfio_dma_t* dma = vfio_dma_alloc(&dev->vfiodev, size);
+/**
+ * Release a list of queue bindings (e.g. of an exiting thread).
+ * @param   arg         binding list
+ */
+static void unvme_bind_release(void* arg)
+{
+    unvme_binding_t* b = arg;
+    unvme_lockw(&unvme_lock);
+    while (b) {
+        unvme_binding_t* next = b->next;
+        if (unvme_bind_valid(b)) b->dev->ioqs[b->qid].bound--;
+        free(b);
+        b = next;
+    }
+    unvme_unlockw(&unvme_lock);
+}
+
+/**
+ * Create the thread exit key to release the queue bindings.
+ */
+static void unvme_bind_init(void)
+{
+    if (pthread_key_create(&unvme_bindkey, unvme_bind_release))
+        FATAL("pthread_key_create");
+}
+
+/**
+ * Bind the calling thread to an I/O queue of a device.  A free queue whose
+ * memory is on the thread NUMA node is preferred over any other free queue.
+ * If all queues are bound, the queue with the fewest threads is shared if
+ * the device is opened in shared mode.  The binding is released upon
+ * unvme_do_unbind or thread exit.
+ * @param   ns          namespace handle
+ * @return  the bound queue id or -1 if no queue is available.
+ */
+int unvme_do_bind(const unvme_ns_t* ns)
+{
+    unvme_device_t* dev = ((unvme_session_t*)ns->ses)->dev;
+
+    // look up an existing binding (and move it to front for quick lookup)
+    unvme_binding_t* b;
+    unvme_binding_t** pb;
+    for (pb = &unvme_binds; (b = *pb) != NULL; pb = &b->next) {
+        if (b->dev == dev && b->devid == dev->id) {
+            if (b != unvme_binds) {
+                *pb = b->next;
+                b->next = unvme_binds;
+                unvme_binds = b;
+                pthread_setspecific(unvme_bindkey, unvme_binds);
+            }
+            return b->qid;
+        }
+    }
+    pthread_once(&unvme_bindonce, unvme_bind_init);
+
+    unsigned int cpu, node;
+    int tnode = syscall(SYS_getcpu, &cpu, &node, NULL) ? -1 : (int)node;
+
+    unvme_lockw(&unvme_lock);
+    int i, qid = -1, score = 0;
+    for (i = 0; i < dev->ns.qcount; i++) {
+        unvme_queue_t* q = dev->ioqs + i;
+        int sc = (q->bound << 1) + (q->node != tnode);
+        if (qid < 0 || sc < score) {
+            qid = i;
+            score = sc;
+        }
+    }
+    if (qid < 0 || (dev->ioqs[qid].bound && !dev->ns.shared)) {
+        unvme_unlockw(&unvme_lock);
+        ERROR("%s no free queue to bind", ns->device);
+        return -1;
+    }
+    dev->ioqs[qid].bound++;
+    unvme_unlockw(&unvme_lock);
+
+    b = zalloc(sizeof(unvme_binding_t));
+    b->dev = dev;
+    b->devid = dev->id;
+    b->qid = qid;
+    b->next = unvme_binds;
+    unvme_binds = b;
+    pthread_setspecific(unvme_bindkey, unvme_binds);
+
+    DEBUG_FN("%s q%d node=%d/%d", ns->device, qid + 1,
+             dev->ioqs[qid].node, tnode);
+    return qid;
+}
+
+/**
+ * Release the calling thread binding to an I/O queue of a device.
+ * @param   ns          namespace handle
+ * @return  0 if ok else -1 if the thread is not bound.
+ */
+int unvme_do_unbind(const unvme_ns_t* ns)
+{
+    unvme_device_t* dev = ((unvme_session_t*)ns->ses)->dev;
+    unvme_binding_t* b;
+    unvme_binding_t** pb;
+    for (pb = &unvme_binds; (b = *pb) != NULL; pb = &b->next) {
+        if (b->dev == dev && b->devid == dev->id) {
+            *pb = b->next;
+            pthread_setspecific(unvme_bindkey, unvme_binds);
+            b->next = NULL;
+            unvme_bind_release(b);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Enable or disable interrupt coalescing of an I/O queue completion vector
+ * (which applies to all the queues sharing the vector).  The coalescing
+ * threshold and time are set by the open options.
+ * @param   ns          namespace handle
+ * @param   qid         queue id
+ * @param   enable      1 to enable or 0 to disable coalescing
+ * @return  0 if ok else error status (-1 if interrupts are not enabled).
+ */
+int unvme_do_coalesce(const unvme_ns_t* ns, int qid, int enable)
+{
+    if ((qid = unvme_ioqid(ns, qid)) < 0) return -1;
+    unvme_device_t* dev = ((unvme_session_t*)ns->ses)->dev;
+    nvme_queue_t* nvmeq = dev->ioqs[qid].nvmeq;
+    if (nvmeq->iv < 0) return -1;
+
+    nvme_feature_int_vector_t iv = { .iv = nvmeq->iv, .cd = !enable };
+    u32 res;
+    memcpy(&res, &iv, sizeof(res));
+    unvme_lockw(&unvme_lock);
+    int err = nvme_acmd_set_features(&dev->nvmedev, 0, NVME_FEATURE_INT_VECTOR,
+                                     0, 0, &res);
+    unvme_unlockw(&unvme_lock);
+    if (err) ERROR("q%d set interrupt vector %d failed", qid + 1, nvmeq->iv);
+    return err;
+}
+
+/**
+ * Get the completion notification fd of an I/O queue.  The fd is an
+ * eventfd of the queue signaled by the reactor thread or by a notifier
+ * thread (started upon the first request on a device) when a completion
+ * is posted to the queue after it has been drained.  With interrupts, the
+ * notifier blocks on the MSIX vector eventfds (which may be shared by
+ * queues), and the interrupt waits are then limited to 1ms at a time as
+ * the notifier may consume their events.
+ * @param   ns          namespace handle
+ * @param   qid         queue id
+ * @return  the fd or -1 if error.
+ */
+int unvme_do_queue_fd(const unvme_ns_t* ns, int qid)
+{
+    if ((qid = unvme_ioqid(ns, qid)) < 0) return -1;
+    unvme_device_t* dev = ((unvme_session_t*)ns->ses)->dev;
+    unvme_queue_t* q = dev->ioqs + qid;
+
+    unvme_lockw(&unvme_lock);
+    if (q->qfd < 0) {
+        if (!q->cqring && !dev->nstart) {
+            if ((dev->nwfd = eventfd(0, EFD_CLOEXEC)) < 0)
+                FATAL("eventfd: %s", strerror(errno));
+            // the notifier may consume the vector events of interrupt waiters
+            int i;
+            for (i = 0; dev->nefd && i < dev->ns.qcount; i++) dev->ioqs[i].efdshared = 1;
+            if (pthread_create(&dev->notifier, NULL, unvme_notifier, dev))
+                FATAL("pthread_create notifier");
+            dev->nstart = 1;
+        }
+        if ((q->qfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+            ERROR("eventfd: %s", strerror(errno));
+        } else {
+            __atomic_store_n(&q->armed, 1, __ATOMIC_SEQ_CST);
+            if (!q->cqring && q->efd < 0 && q->cidcount) unvme_notifier_wake(q);
+        }
+        DEBUG_FN("%s q%d fd=%d", ns->device, qid + 1, q->qfd);
+    }
+    unvme_unlockw(&unvme_lock);
+    return q->qfd;
+}
+
+/**
+ * Set the completion wait strategy of an I/O queue.
+ * @param   ns          namespace handle
+ * @param   qid         queue id
+ * @param   wait        wait strategy (UNVME_WAIT_*)
+ * @return  0 if ok else -1 if the strategy is not supported.
+ */
+int unvme_do_set_wait(const unvme_ns_t* ns, int qid, int wait)
+{
+    if ((qid = unvme_ioqid(ns, qid)) < 0) return -1;
+    unvme_queue_t* q = ((unvme_session_t*)ns->ses)->dev->ioqs + qid;
+    if ((wait = unvme_wait_resolve(q, wait)) < 0) return -1;
+    q->wait = wait;
+    return 0;
+}
+
+/**
+ * Get the completion wait statistics of an I/O queue.
+ * @param   ns          namespace handle
+ * @param   qid         queue id
+ * @param   stats       returned statistics (indexed by wait strategy)
+ * @return  0 if ok else -1.
+ */
+int unvme_do_wait_stats(const unvme_ns_t* ns, int qid, unvme_wait_stats_t stats[])
+{
+    if ((qid = unvme_ioqid(ns, qid)) < 0) return -1;
+    unvme_queue_t* q = ((unvme_session_t*)ns->ses)->dev->ioqs + qid;
+    memcpy(stats, q->stats, sizeof(q->stats));
+    return 0;
+}
+
+/**
+ * Set the submission mode of an I/O queue.  A blocking queue waits for
+ * completions when it is full, while a non-blocking queue fails the
+ * submissions with EAGAIN instead, after deferring up to the overflow
+ * depth of read/write requests to be submitted as cids are freed.
+ * The already overflow queued requests remain queued.
+ * @param   ns          namespace handle
+ * @param   qid         queue id
+ * @param   ovfdepth    overflow queue depth (-1 for blocking)
+ * @return  0 if ok else -1.
+ */
+int unvme_do_set_nonblock(const unvme_ns_t* ns, int qid, int ovfdepth)
+{
+    if ((qid = unvme_ioqid(ns, qid)) < 0) return -1;
+    unvme_queue_t* q = ((unvme_session_t*)ns->ses)->dev->ioqs + qid;
+    q->ovfmax = ovfdepth < 0 ? -1 : ovfdepth;
+    return 0;
+}
+
+/**
+ * Get the occupancy of an I/O queue.
+ * @param   ns          namespace handle
+ * @param   qid         queue id
+ * @param   queued      returned number of overflow queued requests (or NULL)
+ * @return  number of pending commands or -1 if error.
+ */
+int unvme_do_occupancy(const unvme_ns_t* ns, int qid, int* queued)
+{
+    if ((qid = unvme_ioqid(ns, qid)) < 0) return -1;
+    unvme_queue_t* q = ((unvme_session_t*)ns->ses)->dev->ioqs + qid;
+    if (queued) *queued = q->ovfcount;
+    return q->cidcount;
+}
+
+/**
+ * Allocate an I/O buffer.
+ * @param   ns          namespace handle
+ * @param   size        buffer size
+ * @return  the allocated buffer or NULL if failure.
+ */
+void* unvme_do_alloc(const unvme_ns_t* ns, u64 size)
+{
+    DEBUG_FN("%s %#lx", ns->device, size);
+    unvme_device_t* dev = ((unvme_session_t*)ns->ses)->dev;
+    unvme_iomem_t* iomem = &dev->iomem;
+    void* buf = NULL;
+
+    unvme_lockw(&iomem->lock);
+    vfio_dma_t* dma = vfio_dma_alloc(&dev->vfiodev, size);
     if (dma) {
         if (iomem->count == iomem->size) {
             iomem->size += 256;
             iomem->map = realloc(iomem->map, iomem->size * sizeof(void*));
         }
-        iomem->map[iomem->count++] = dma;
+        // insert keeping the map sorted by buffer address
+        int i = unvme_iomem_find(iomem, dma->buf) + 1;
+        memmove(iomem->map + i + 1, iomem->map + i,
+                (iomem->count - i) * sizeof(void*));
+        iomem->map[i] = dma;
+        iomem->count++;
         buf = dma->buf;
     }
-    unvme_unlockw(&iomem->lock);
-    return buf;
+    unvme_unlockw(&iomem->lock);
+    return buf;
+}
+
+/**
+ * Free an I/O buffer.
+ * @param   ns          namespace handle
+ * @param   buf         buffer pointer
+ * @return  0 if ok else -1.
+ */
+int unvme_do_free(const unvme_ns_t* ns, void* buf)
+{
+    DEBUG_FN("%s %p", ns->device, buf);
+    unvme_device_t* dev = ((unvme_session_t*)ns->ses)->dev;
+    unvme_iomem_t* iomem = &dev->iomem;
+
+    unvme_lockw(&iomem->lock);
+    int i = unvme_iomem_find(iomem, buf);
+    if (i >= 0 && buf == iomem->map[i]->buf) {
+        // invalidate the queue translation caches
+        __sync_fetch_and_add(&iomem->gen, 1);
+        vfio_dma_free(iomem->map[i]);
+        iomem->count--;
+        memmove(iomem->map + i, iomem->map + i + 1,
+                (iomem->count - i) * sizeof(void*));
+        unvme_unlockw(&iomem->lock);
+        return 0;
+    }
+    unvme_unlockw(&iomem->lock);
+    return -1;
+}
+
+/**
+ * Process the ready completions of the queues of a striped descriptor.
+ * @param   desc        striped descriptor
+ * @return  number of completions processed.
+ */
+static int unvme_stripe_reap(unvme_desc_t* desc)
+{
+    int i, n = 0;
+    for (i = 0; i < desc->stripe; i++) {
+        unvme_queue_t* q = desc->q + i;
+        if (q->nvmeq->sq_pending) nvme_sq_flush(q->nvmeq);
+        int err, cid;
+        while ((cid = unvme_reap_cid(q, &err, NULL)) >= 0) {
+            unvme_complete_cid(q, cid, err);
+            n++;
+        }
+        unvme_cq_flush(q);
+        if (q->ovfhead) unvme_ovf_drain(q);
+    }
+    return n;
+}
+
+/**
+ * Poll for completion of a striped descriptor by processing all its queues.
+ * The descriptor is released upon completion.
+ * @param   desc        striped descriptor
+ * @param   timeout     timeout in seconds
+ * @return  0 if ok else error status (-1 means timeout).
+ */
+static int unvme_stripe_poll(unvme_desc_t* desc, int timeout)
+{
+    unvme_stripe_reap(desc);
+    if (desc->cidcount && timeout) {
+        // block on the first queue only briefly as the others may complete
+        unvme_wait_ctx_t w;
+        unvme_wait_begin(desc->q, &w, timeout, 1);
+        do {
+            unvme_wait_step(desc->q, &w);
+            unvme_stripe_reap(desc);
+        } while (desc->cidcount && rdtsc() < w.end);
+        unvme_wait_end(desc->q, &w);
+    }
+    if (desc->cidcount) return -1;
+    int err = desc->error;
+    unvme_desc_put(desc);
+    return err;
+}
+
+/**
+ * Poll for completion status of a previous IO submission.
+ * If there's no error, the descriptor will be released.
+ * Within a fiber, a blocking poll parks the fiber until the fiber
+ * scheduler finds the descriptor completed (see unvme_fiber_poll).
+ * A striped descriptor is polled across all its queues.
+ * @param   desc        IO descriptor
+ * @param   timeout     in seconds
+ * @param   cqe_cs      CQE command specific DW0 returned
+ * @return  0 if ok else error status (-1 means timeout).
+ */
+int unvme_do_poll(unvme_desc_t* desc, int timeout, u32* cqe_cs)
+{
+    if (desc->sentinel != desc)
+        FATAL("bad IO descriptor");
+
+    PDEBUG("# POLL d={%d %d}", desc->id, desc->cidcount);
+    if (timeout && unvme_in_fiber()) return unvme_fiber_poll(desc, timeout, cqe_cs);
+    if (desc->stripe) return unvme_stripe_poll(desc, timeout);
+    unvme_queue_t* q = desc->q;
+    if (q->shared && unvme_fcq != q) {
+        // poll through the combiner without holding it while waiting
+        unvme_fcpoll_t a = { .desc = desc, .cqe_cs = cqe_cs };
+        unvme_combine(q, unvme_fc_poll, &a);
+        if (!a.ret && timeout) {
+            // bound the blocking time since another thread may have consumed
+            // the interrupt event and completed this descriptor
+            unvme_wait_ctx_t w;
+            unvme_wait_begin(q, &w, timeout, 1);
+            do {
+                unvme_wait_step(q, &w);
+                unvme_combine(q, unvme_fc_poll, &a);
+            } while (!a.ret && rdtsc() < w.end);
+            unvme_wait_end(q, &w);
+        }
+        return a.ret ? a.err : -1;
+    }
+
+    int err = 0;
+    while (desc->cidcount) {
+        if (q->ovfhead) unvme_ovf_drain(q);
+        if ((err = unvme_check_completion(q, timeout, cqe_cs)) != 0) break;
+    }
+    if (desc->cidcount == 0) {
+        err = desc->error;
+        unvme_desc_put(desc);
+    }
+    PDEBUG("# q%d +%d", desc->q->nvmeq->id, desc->q->desccount);
+
+    return err;
+}
+
+/**
+ * Poll for completion status of a previous IO submission, waiting with
+ * the given strategy instead of the queue one for this call only (see
+ * unvme_do_poll).  HYBRID relies on the latency of the queue, which is only
+ * tracked if the queue strategy is also HYBRID (and otherwise spins).
+ * @param   desc        IO descriptor
+ * @param   timeout     in seconds
+ * @param   wait        wait strategy (UNVME_WAIT_*)
+ * @param   cqe_cs      CQE command specific DW0 returned
+ * @return  0 if ok else error status (-1 means timeout or, with errno set
+ *          to EINVAL, the strategy is not supported by the queue).
+ */
+int unvme_do_poll_wait(unvme_desc_t* desc, int timeout, int wait, u32* cqe_cs)
+{
+    if (desc->sentinel != desc)
+        FATAL("bad IO descriptor");
+    if ((wait = unvme_wait_resolve(desc->q, wait)) < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // nested polls (e.g. from a completion callback) keep their own strategy
+    unvme_queue_t* savedq = unvme_callwaitq;
+    int saved = unvme_callwait;
+    unvme_callwaitq = desc->q;
+    unvme_callwait = wait;
+    int err = unvme_do_poll(desc, timeout, cqe_cs);
+    unvme_callwaitq = savedq;
+    unvme_callwait = saved;
+    return err;
+}
+
+/**
+ * Reap completed I/O descriptors of a queue.  All the ready completion
+ * entries (up to the max descriptor count) are processed and the
+ * completion queue head doorbell is written once at the end.
+ * The returned descriptors are released and their content remains valid
+ * only until the next submission on the queue.
+ * @param   ns          namespace handle
+ * @param   qid         queue id
+ * @param   max         max number of descriptors to return
+ * @param   out         array of returned completed descriptors
+ * @return  number of completed descriptors returned.
+ */
+int unvme_do_reap(const unvme_ns_t* ns, int qid, int max, unvme_iod_t out[])
+{
+    if ((qid = unvme_ioqid(ns, qid)) < 0) return 0;
+    unvme_queue_t* q = ((unvme_session_t*)ns->ses)->dev->ioqs + qid;
+    if (q->shared && unvme_fcq != q) {
+        unvme_fcpoll_t a = { .ns = ns, .qid = qid, .max = max, .iods = out };
+        unvme_combine(q, unvme_fc_reap, &a);
+        return a.ret;
+    }
+    if (q->nvmeq->sq_pending) nvme_sq_flush(q->nvmeq);
+
+    int n = 0;
+    for (;;) {
+        while (q->descdone && n < max) {
+            unvme_desc_t* desc = q->descdone;
+            out[n++] = (unvme_iod_t)desc;
+            unvme_desc_put(desc);
+        }
+        if (n == max) break;
+
+        int err;
+        int cid = unvme_reap_cid(q, &err, NULL);
+        if (cid < 0) break;
+        unvme_complete_cid(q, cid, err);
+    }
+    unvme_cq_flush(q);
+    if (q->ovfhead) unvme_ovf_drain(q);
+
+    PDEBUG("# REAP q%d n=%d +%d", q->nvmeq->id, n, q->desccount);
+    return n;
+}
+
+/**
+ * Process the ready completions of an I/O queue invoking the completion
+ * callbacks inline.  Submissions made from within the callbacks are
+ * published with a single doorbell write and the completion queue head
+ * doorbell is written once at the end.
+ * @param   ns          namespace handle
+ * @param   qid         queue id
+ * @param   max         max number of descriptors to complete
+ * @return  number of descriptors completed.
+ */
+int unvme_do_process(const unvme_ns_t* ns, int qid, int max)
+{
+    if ((qid = unvme_ioqid(ns, qid)) < 0) return 0;
+    unvme_queue_t* q = ((unvme_session_t*)ns->ses)->dev->ioqs + qid;
+    if (q->shared && unvme_fcq != q) {
+        unvme_fcpoll_t a = { .ns = ns, .qid = qid, .max = max };
+        unvme_combine(q, unvme_fc_process, &a);
+        return a.ret;
+    }
+    int plugged = q->nvmeq->sq_plug;
+    if (q->nvmeq->sq_pending) nvme_sq_flush(q->nvmeq);
+    if (!plugged) nvme_sq_plug(q->nvmeq);
+
+    int n = 0;
+    while (n < max) {
+        int err;
+        int cid = unvme_reap_cid(q, &err, NULL);
+        if (cid < 0) break;
+        n += unvme_complete_cid(q, cid, err);
+    }
+    unvme_cq_flush(q);
+    if (q->ovfhead) unvme_ovf_drain(q);
+    if (!plugged) nvme_sq_unplug(q->nvmeq);
+
+    PDEBUG("# PROCESS q%d n=%d +%d", q->nvmeq->id, n, q->desccount);
+    return n;
+}
+
+/**
+ * Wait for an I/O queue to become idle (i.e. no pending command and no
+ * overflow queued request) processing its completions, and return the
+ * first descriptor-less write error of the queue since the last drain.
+ * The error status and count are cleared once reported.
+ * @param   ns          namespace handle
+ * @param   qid         queue id
+ * @return  0 if ok else the first error status (-1 means timeout).
+ */
+int unvme_do_drain(const unvme_ns_t* ns, int qid)
+{
+    if ((qid = unvme_ioqid(ns, qid)) < 0) return -1;
+    unvme_queue_t* q = ((unvme_session_t*)ns->ses)->dev->ioqs + qid;
+
+    // a shared queue is processed through the combiner (without blocking)
+    unvme_wait_ctx_t w;
+    unvme_wait_begin(q, &w, UNVME_TIMEOUT, q->shared);
+    for (;;) {
+        unvme_do_process(ns, qid, q->size);
+        if (!__atomic_load_n(&q->cidcount, __ATOMIC_ACQUIRE) && !q->ovfhead) break;
+        if (rdtsc() >= w.end) break;
+        unvme_wait_step(q, &w);
+    }
+    unvme_wait_end(q, &w);
+    if (q->cidcount || q->ovfhead) return -1;
+
+    int err = q->ffstats.errstat;
+    PDEBUG("# DRAIN q%d err=%#x errors=%lu", q->nvmeq->id, err, q->ffstats.errors);
+    q->ffstats.errors = 0;
+    q->ffstats.errstat = 0;
+    q->ffstats.errnlb = 0;
+    q->ffstats.errslba = 0;
+    return err;
+}
+
+/**
+ * Get the descriptor-less write counters of an I/O queue.
+ * @param   ns          namespace handle
+ * @param   qid         queue id
+ * @param   stats       returned counters
+ * @return  0 if ok else -1.
+ */
+int unvme_do_ff_stats(const unvme_ns_t* ns, int qid, unvme_ff_stats_t* stats)
+{
+    if ((qid = unvme_ioqid(ns, qid)) < 0) return -1;
+    unvme_queue_t* q = ((unvme_session_t*)ns->ses)->dev->ioqs + qid;
+    *stats = q->ffstats;
+    return 0;
+}
+
+/**
+ * Plug or unplug an I/O queue.  While plugged, submissions are accumulated
+ * and the submission queue doorbell is written once upon unplug.
+ * A shared queue is only plugged by its combiner, so the request is
+ * ignored (the doorbell is already written once per combining pass).
+ * @param   ns          namespace handle
+ * @param   qid         queue id
+ * @param   plug        1 to plug or 0 to unplug
+ * @return  the previous plug state.
+ */
+int unvme_do_plug(const unvme_ns_t* ns, int qid, int plug)
+{
+    if ((qid = unvme_ioqid(ns, qid)) < 0) return 0;
+    unvme_queue_t* q = ((unvme_session_t*)ns->ses)->dev->ioqs + qid;
+    if (q->shared) return 1;
+    int plugged = q->nvmeq->sq_plug;
+    if (plug) nvme_sq_plug(q->nvmeq);
+    else nvme_sq_unplug(q->nvmeq);
+    return plugged;
+}
+
+/**
+ * Check if an I/O queue has work for its poller without touching the
+ * queue states (an idle queue costs a read of its cached next completion
+ * entry or reactor ring indexes).
+ * @param   q           queue
+ * @return  1 if the queue has ready completions or deferred submissions.
+ */
+static inline int unvme_pg_ready(unvme_queue_t* q)
+{
+    unvme_cqring_t* r = q->cqring;
+    if (r) return r->head != __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+    return q->nvmeq->sq_pending || nvme_cq_ready(q->nvmeq);
+}
+
+/**
+ * Create an empty poll group.
+ * @return  the poll group.
+ */
+unvme_poll_group_t* unvme_do_pg_create(void)
+{
+    return zalloc(sizeof(unvme_poll_group_t));
+}
+
+/**
+ * Destroy a poll group (the queues themselves are not affected).
+ * @param   pg          poll group
+ * @return  0 if ok.
+ */
+int unvme_do_pg_destroy(unvme_poll_group_t* pg)
+{
+    free(pg->ent);
+    free(pg);
+    return 0;
+}
+
+/**
+ * Add an I/O queue to a poll group.  The entries are kept ordered by
+ * device and queue so a pass walks the queue contexts in memory order.
+ * @param   pg          poll group
+ * @param   ns          namespace handle
+ * @param   qid         queue id
+ * @return  0 if ok else -1.
+ */
+int unvme_do_pg_add(unvme_poll_group_t* pg, const unvme_ns_t* ns, int qid)
+{
+    if ((qid = unvme_ioqid(ns, qid)) < 0) return -1;
+    unvme_device_t* dev = ((unvme_session_t*)ns->ses)->dev;
+    unvme_queue_t* q = dev->ioqs + qid;
+
+    int i;
+    for (i = 0; i < pg->count; i++) {
+        unvme_pgent_t* e = pg->ent + i;
+        if (e->q == q) return 0;
+        if (e->devid > dev->id || (e->devid == dev->id && e->qid > qid)) break;
+    }
+    if (pg->count == pg->size) {
+        int size = pg->size ? pg->size * 2 : 8;
+        unvme_pgent_t* ent = realloc(pg->ent, size * sizeof(unvme_pgent_t));
+        if (!ent) {
+            ERROR("realloc");
+            return -1;
+        }
+        pg->ent = ent;
+        pg->size = size;
+    }
+    memmove(pg->ent + i + 1, pg->ent + i, (pg->count - i) * sizeof(unvme_pgent_t));
+    pg->ent[i] = (unvme_pgent_t){ .q = q, .ns = ns, .qid = qid, .devid = dev->id };
+    pg->count++;
+    pg->next = 0;
+    DEBUG_FN("%s q%d n=%d", ns->device, qid + 1, pg->count);
+    return 0;
+}
+
+/**
+ * Remove an I/O queue from a poll group.
+ * @param   pg          poll group
+ * @param   ns          namespace handle
+ * @param   qid         queue id
+ * @return  0 if ok else -1 if the queue is not in the group.
+ */
+int unvme_do_pg_remove(unvme_poll_group_t* pg, const unvme_ns_t* ns, int qid)
+{
+    if ((qid = unvme_ioqid(ns, qid)) < 0) return -1;
+    unvme_queue_t* q = ((unvme_session_t*)ns->ses)->dev->ioqs + qid;
+
+    int i;
+    for (i = 0; i < pg->count; i++) {
+        if (pg->ent[i].q == q) {
+            pg->count--;
+            memmove(pg->ent + i, pg->ent + i + 1,
+                    (pg->count - i) * sizeof(unvme_pgent_t));
+            pg->next = 0;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Process the ready completions of all the queues of a poll group
+ * invoking the completion callbacks inline.  Queues with nothing posted
+ * are skipped after peeking their next completion entry (prefetched one
+ * queue ahead, or the next reactor ring entry in reactor mode).  When the max is reached, the next pass starts at the
+ * following queue so no queue is starved.
+ * @param   pg          poll group
+ * @param   max         max number of descriptors to complete
+ * @return  number of descriptors completed.
+ */
+int unvme_do_pg_process(unvme_poll_group_t* pg, int max)
+{
+    int count = pg->count;
+    int i, e = pg->next, n = 0;
+    for (i = 0; i < count && n < max; i++) {
+        unvme_pgent_t* p = pg->ent + e;
+        if (++e == count) e = 0;
+        // the completion queue head is owned by the reactor in reactor mode
+        unvme_queue_t* nextq = pg->ent[e].q;
+        unvme_cqring_t* r = nextq->cqring;
+        if (r) {
+            __builtin_prefetch(&r->ent[r->head & r->mask]);
+        } else {
+            nvme_queue_t* nq = nextq->nvmeq;
+            __builtin_prefetch(nq->cq + nq->cq_head);
+        }
+        if (unvme_pg_ready(p->q)) {
+            n += unvme_do_process(p->ns, p->qid, max - n);
+            if (n >= max) pg->next = e;
+        }
+    }
+    return n;
+}
+
+/**
+ * Submit a batch of read/write requests with a single doorbell write.
+ * @param   ns          namespace handle
+ * @param   qid         queue id
+ * @param   io          array of requests
+ * @param   count       number of requests
+ * @param   iods        array of returned I/O descriptors
+ * @return  number of requests submitted.
+ */
+int unvme_do_batch(const unvme_ns_t* ns, int qid,
+                   const unvme_io_t* io, int count, unvme_iod_t iods[])
+{
+    if ((qid = unvme_ioqid(ns, qid)) < 0) return 0;
+    unvme_queue_t* q = ((unvme_session_t*)ns->ses)->dev->ioqs + qid;
+    if (q->shared && unvme_fcq != q) {
+        unvme_fcpoll_t a = { .ns = ns, .qid = qid, .max = count,
+                             .io = io, .iods = iods };
+        unvme_combine(q, unvme_fc_batch, &a);
+        return a.ret;
+    }
+
+    int i;
+    int plugged = q->nvmeq->sq_plug;
+    if (!plugged) nvme_sq_plug(q->nvmeq);
+    for (i = 0; i < count; i++) {
+        iods[i] = (unvme_iod_t)unvme_do_rw(ns, qid, io[i].opc, io[i].buf,
+                                           io[i].slba, io[i].nlb, NULL, NULL);
+        if (!iods[i]) break;
+    }
+    if (!plugged) nvme_sq_unplug(q->nvmeq);
+    return i;
 }
 
 /**
- * Free an I/O buffer.
+ * Get the number of blocks of the next command of a split read/write.
+ * Unless naive splitting is requested, a command does not cross an
+ * optimal I/O boundary, and a split write ends on the optimal write size
+ * (or the preferred write granularity and alignment) so the following
+ * write starts aligned.
  * @param   ns          namespace handle
- * @param   buf         buffer pointer
- * @return  0 if ok else -1.
+ * @param   opc         op code
+ * @param   slba        starting lba
+ * @param   nlb         number of remaining blocks
+ * @return  number of blocks.
  */
-int unvme_do_free(const unvme_ns_t* ns, void* buf)
+static inline u32 unvme_split_nlb(const unvme_ns_t* ns, int opc,
+                                  u64 slba, u32 nlb)
 {
-    DEBUG_FN("%s %p", ns->device, buf);
-    unvme_device_t* dev = ((unvme_session_t*)ns->ses)->dev;
-    unvme_iomem_t* iomem = &dev->iomem;
+    u32 n = nlb < ns->maxbpio ? nlb : ns->maxbpio;
+    if (!ns->optsplit) return n;
 
-    unvme_lockw(&iomem->lock);
-    int i;
-    for (i = 0; i < iomem->count; i++) {
-        if (buf == iomem->map[i]->buf) {
-            vfio_dma_free(iomem->map[i]);
-            iomem->count--;
-            if (i != iomem->count)
-                iomem->map[i] = iomem->map[iomem->count];
-            unvme_unlockw(&iomem->lock);
-            return 0;
+    if (ns->noiob) {
+        u32 b = ns->noiob - slba % ns->noiob;
+        if (n > b) n = b;
+    }
+    if (opc == NVME_CMD_WRITE && n < nlb) {
+        u32 u = ns->npwg > ns->npwa ? ns->npwg : ns->npwa;
+        if (ns->nows > u && ns->nows <= ns->maxbpio) u = ns->nows;
+        if (u > 1) {
+            u32 e = (slba + n) % u;
+            if (e < n) n -= e;
         }
     }
-    unvme_unlockw(&iomem->lock);
-    return -1;
+    return n;
 }
 
 /**
- * Poll for completion status of a previous IO submission.
- * If there's no error, the descriptor will be released.
- * @param   desc        IO descriptor
- * @param   timeout     in seconds
- * @param   cqe_cs      CQE command specific DW0 returned
- * @return  0 if ok else error status (-1 means timeout).
+ * Get the number of commands a read/write request is split into.
+ * @param   ns          namespace handle
+ * @param   opc         op code
+ * @param   slba        starting lba
+ * @param   nlb         number of logical blocks
+ * @return  number of commands.
  */
-int unvme_do_poll(unvme_desc_t* desc, int timeout, u32* cqe_cs)
+int unvme_rw_ncmds(const unvme_ns_t* ns, int opc, u64 slba, u32 nlb)
 {
-    if (desc->sentinel != desc)
-        FATAL("bad IO descriptor");
+    int count = 1;
+    u32 n = unvme_split_nlb(ns, opc, slba, nlb);
+    while (n < nlb) {
+        slba += n;
+        nlb -= n;
+        n = unvme_split_nlb(ns, opc, slba, nlb);
+        count++;
+    }
+    return count;
+}
 
-    PDEBUG("# POLL d={%d %d %#lx}", desc->id, desc->cidcount, *desc->cidmask);
-    int err = 0;
-    while (desc->cidcount) {
-        if ((err = unvme_check_completion(desc->q, timeout, cqe_cs)) != 0) break;
+/**
+ * Submit the commands of a read/write descriptor.  Upon error, the already
+ * submitted commands are waited for before returning.
+ * @param   ns          namespace handle
+ * @param   desc        descriptor
+ * @return  0 if ok else -1.
+ */
+static int unvme_rw_submit(const unvme_ns_t* ns, unvme_desc_t* desc)
+{
+    unvme_queue_t* q = desc->q;
+    void* buf = desc->buf;
+    u64 slba = desc->slba;
+    u32 nlb = desc->nlb;
+
+    // ring the doorbell once for all the split submissions
+    u32 n = unvme_split_nlb(ns, desc->opc, slba, nlb);
+    int plugged = q->nvmeq->sq_plug;
+    if (!plugged && n < nlb) nvme_sq_plug(q->nvmeq);
+    while (nlb) {
+        if (unvme_submit_io(ns, desc, buf, slba, n) < 0) {
+            // wait for the already submitted commands
+            while (desc->cidcount) {
+                if (unvme_check_completion(q, UNVME_TIMEOUT, NULL) == -1)
+                    FATAL("q%d timeout", q->nvmeq->id);
+            }
+            break;
+        }
+
+        buf += n << ns->blockshift;
+        slba += n;
+        nlb -= n;
+        n = unvme_split_nlb(ns, desc->opc, slba, nlb);
     }
-    if (desc->cidcount == 0) unvme_desc_put(desc);
-    PDEBUG("# q%d +%d", desc->q->nvmeq->id, desc->q->desccount);
+    if (!plugged) nvme_sq_unplug(q->nvmeq);
+    return nlb ? -1 : 0;
+}
 
-    return err;
+/**
+ * Submit the overflow queued read/write requests of a non-blocking queue
+ * (in order) while there are enough free cids for their commands.
+ * A deferred descriptor holds a placeholder pending cid count so it
+ * cannot complete before it is submitted.
+ * @param   q           queue
+ */
+void unvme_ovf_drain(unvme_queue_t* q)
+{
+    int plugged = q->nvmeq->sq_plug;
+    if (!plugged) nvme_sq_plug(q->nvmeq);
+    unvme_desc_t* desc;
+    while ((desc = q->ovfhead) != NULL) {
+        int n = unvme_rw_ncmds(desc->ns, desc->opc, desc->slba, desc->nlb);
+        if (n > (int)q->size - 1 - q->cidcount) break;
+        q->ovfhead = desc->ovfnext;
+        if (!q->ovfhead) q->ovftail = NULL;
+        q->ovfcount--;
+
+        PDEBUG("# OVF q%d @%d -%d", q->nvmeq->id, desc->id, q->ovfcount);
+        desc->sentinel = NULL;
+        desc->cidcount--;
+        if (unvme_rw_submit(desc->ns, desc)) desc->error = -1;
+        unvme_desc_submitted(desc);
+    }
+    if (!plugged) nvme_sq_unplug(q->nvmeq);
 }
 
 /**
  * Submit a read/write command that may require multiple I/O submissions
  * and processing some completions.
+ * On a non-blocking queue, a request that does not have enough free cids
+ * (or would pass earlier overflow queued requests) is deferred to the
+ * overflow queue, or fails with EAGAIN if the overflow queue is full
+ * (and with EINVAL if it needs more commands than the queue can hold).
+ * A deferred request is submitted as cids are freed when completions are
+ * processed (e.g. by unvme_do_poll, unvme_do_reap or unvme_do_process).
  * @param   ns          namespace handle
  * @param   qid         queue id
  * @param   opc         op code
  * @param   buf         data buffer
  * @param   slba        starting lba
  * @param   nlb         number of logical blocks
+ * @param   cb          completion callback (NULL for polled completion)
+ * @param   arg         user context
  * @return  I/O descriptor or NULL if error.
  */
 unvme_desc_t* unvme_do_rw(const unvme_ns_t* ns, int qid, int opc,
-                          void* buf, u64 slba, u32 nlb)
+                          void* buf, u64 slba, u32 nlb,
+                          unvme_cb_t cb, void* arg)
 {
+    if ((qid = unvme_ioqid(ns, qid)) < 0) return NULL;
     unvme_queue_t* q = ((unvme_session_t*)ns->ses)->dev->ioqs + qid;
+    if (q->shared && unvme_fcq != q) {
+        unvme_fcrw_t a = { .ns = ns, .qid = qid, .opc = opc, .buf = buf,
+                           .slba = slba, .nlb = nlb, .cb = cb, .arg = arg };
+        unvme_combine(q, unvme_fc_rw, &a);
+        if (!a.desc) errno = a.err;
+        return a.desc;
+    }
+
+    int defer = 0;
+    if (q->ovfmax >= 0) {
+        // a request needing more cids than the queue has could never be
+        // submitted without blocking
+        int n = unvme_rw_ncmds(ns, opc, slba, nlb);
+        if (n > (int)q->size - 1) {
+            errno = EINVAL;
+            return NULL;
+        }
+        if (q->ovfhead || n > (int)q->size - 1 - q->cidcount) {
+            if (q->ovfcount >= q->ovfmax) {
+                errno = EAGAIN;
+                return NULL;
+            }
+            defer = 1;
+        }
+    }
+
     unvme_desc_t* desc = unvme_desc_get(q);
+    desc->cb = cb;
+    desc->arg = arg;
     desc->opc = opc;
     desc->buf = buf;
     desc->qid = qid;
     desc->slba = slba;
     desc->nlb = nlb;
-    desc->sentinel = desc;
 
     PDEBUG("# %s %#lx %#x @%d +%d", opc == NVME_CMD_READ ? "READ" : "WRITE",
            slba, nlb, desc->id, q->desccount);
-    while (nlb) {
-        int n = ns->maxbpio;
-        if (n > nlb) n = nlb;
-        int cid = unvme_submit_io(ns, desc, buf, slba, n);
-        if (cid < 0) {
-            // poll currently pending descriptor
-            int err = unvme_do_poll(desc, UNVME_TIMEOUT, NULL);
-            if (err) {
-                if (err == -1) FATAL("q%d timeout", q->nvmeq->id);
-                else ERROR("q%d error %#x", q->nvmeq->id, err);
-            }
+
+    if (defer) {
+        desc->ns = ns;
+        desc->ovfnext = NULL;
+        desc->cidcount = 1;
+        desc->sentinel = desc;
+        if (q->ovftail) q->ovftail->ovfnext = desc;
+        else q->ovfhead = desc;
+        q->ovftail = desc;
+        q->ovfcount++;
+        PDEBUG("# OVF q%d @%d +%d", q->nvmeq->id, desc->id, q->ovfcount);
+        return desc;
+    }
+
+    if (unvme_rw_submit(ns, desc)) {
+        unvme_desc_put(desc);
+        return NULL;
+    }
+    unvme_desc_submitted(desc);
+    return desc;
+}
+
+/**
+ * Submit a descriptor-less write command.  The split commands are owned by
+ * the queue pseudo descriptor and their completions only update the queue
+ * descriptor-less write counters (see unvme_do_drain).  Upon a submission
+ * error, the already submitted split commands still complete.
+ * On a non-blocking queue, the write fails with EAGAIN unless there are
+ * enough free cids for all its commands (or with EINVAL if it needs more
+ * commands than the queue can hold).
+ * @param   ns          namespace handle
+ * @param   qid         queue id
+ * @param   buf         data buffer
+ * @param   slba        starting lba
+ * @param   nlb         number of logical blocks
+ * @return  0 if ok else -1.
+ */
+int unvme_do_write_ff(const unvme_ns_t* ns, int qid, void* buf, u64 slba, u32 nlb)
+{
+    if ((qid = unvme_ioqid(ns, qid)) < 0) return -1;
+    unvme_queue_t* q = ((unvme_session_t*)ns->ses)->dev->ioqs + qid;
+    if (q->shared && unvme_fcq != q) {
+        unvme_fcrw_t a = { .ns = ns, .qid = qid, .buf = buf,
+                           .slba = slba, .nlb = nlb };
+        unvme_combine(q, unvme_fc_write_ff, &a);
+        if (a.ret) errno = a.err;
+        return a.ret;
+    }
+
+    u32 n = unvme_split_nlb(ns, NVME_CMD_WRITE, slba, nlb);
+    if (q->ovfmax >= 0) {
+        int ncmds = n < nlb ? unvme_rw_ncmds(ns, NVME_CMD_WRITE, slba, nlb) : 1;
+        if (ncmds > (int)q->size - 1) {
+            errno = EINVAL;
+            return -1;
         }
+        if (q->ovfhead || ncmds > (int)q->size - 1 - q->cidcount) {
+            errno = EAGAIN;
+            return -1;
+        }
+    }
+
+    PDEBUG("# WRITE_FF %#lx %#x q%d", slba, nlb, q->nvmeq->id);
+
+    // ring the doorbell once for all the split submissions
+    int plugged = q->nvmeq->sq_plug;
+    if (!plugged && n < nlb) nvme_sq_plug(q->nvmeq);
+    while (nlb) {
+        int cid = unvme_submit_io(ns, &q->ffdesc, buf, slba, n);
+        if (cid < 0) break;
+        q->ffio[cid] = (unvme_io_t){ .buf = buf, .slba = slba, .nlb = n,
+                                     .opc = NVME_CMD_WRITE };
+        q->ffstats.submitted++;
 
         buf += n << ns->blockshift;
         slba += n;
         nlb -= n;
+        n = unvme_split_nlb(ns, NVME_CMD_WRITE, slba, nlb);
+    }
+    if (!plugged) nvme_sq_unplug(q->nvmeq);
+    return nlb ? -1 : 0;
+}
+
+/**
+ * Stripe chunk completion callback to account the chunk in its striped
+ * descriptor and complete the striped descriptor after its last chunk.
+ * @param   iod         chunk descriptor
+ * @param   arg         striped descriptor
+ */
+static void unvme_stripe_done(unvme_iod_t iod, void* arg)
+{
+    unvme_desc_t* desc = arg;
+    if (iod->error) desc->error = iod->error;
+    if (--desc->cidcount == 0 && desc->sentinel == desc) unvme_desc_complete(desc);
+}
+
+/**
+ * Submit a large read/write command striped across a range of queues.
+ * The request is divided into a contiguous slice per queue (in multiples
+ * of the max transfer size), each submitted as a chunk descriptor, and the
+ * returned striped descriptor completes when all the chunks complete.
+ * Shared queues are not striped as their completions may be processed by
+ * other threads, so the request is then submitted to the first queue.
+ * @param   ns          namespace handle
+ * @param   qid         first queue id
+ * @param   qcount      number of queues (qid to qid + qcount - 1)
+ * @param   opc         op code
+ * @param   buf         data buffer
+ * @param   slba        starting lba
+ * @param   nlb         number of logical blocks
+ * @return  I/O descriptor or NULL if error.
+ */
+unvme_desc_t* unvme_do_rw_striped(const unvme_ns_t* ns, int qid, int qcount,
+                                  int opc, void* buf, u64 slba, u32 nlb)
+{
+    if ((qid = unvme_ioqid(ns, qid)) < 0) return NULL;
+    if (qcount < 1 || (qid + qcount) > ns->qcount) {
+        ERROR("bad stripe q%d-%d (qcount=%d)", qid, qid + qcount - 1, ns->qcount);
+        return NULL;
+    }
+    unvme_queue_t* q = ((unvme_session_t*)ns->ses)->dev->ioqs + qid;
+
+    // slice size per queue rounded up to the max transfer size
+    u32 slice = (nlb + qcount - 1) / qcount;
+    slice = (slice + ns->maxbpio - 1) / ns->maxbpio * ns->maxbpio;
+    if (qcount == 1 || q->shared || slice >= nlb)
+        return unvme_do_rw(ns, qid, opc, buf, slba, nlb, NULL, NULL);
+
+    unvme_desc_t* desc = unvme_desc_get(q);
+    desc->opc = opc;
+    desc->buf = buf;
+    desc->qid = qid;
+    desc->slba = slba;
+    desc->nlb = nlb;
+    desc->stripe = qcount;
+
+    PDEBUG("# STRIPE %#lx %#x q%d-%d @%d", slba, nlb, qid, qid + qcount - 1, desc->id);
+
+    // the chunks are accounted as the pending commands of the descriptor
+    int i;
+    for (i = 0; i < qcount && nlb; i++) {
+        u32 n = slice < nlb ? slice : nlb;
+        desc->cidcount++;
+        if (!unvme_do_rw(ns, qid + i, opc, buf, slba, n, unvme_stripe_done, desc)) {
+            // wait for the already submitted chunks and fail the request
+            desc->cidcount--;
+            u64 endtsc = rdtsc() + UNVME_TIMEOUT * q->nvmeq->dev->rdtsec;
+            while (desc->cidcount) {
+                if (!unvme_stripe_reap(desc) && rdtsc() > endtsc)
+                    FATAL("q%d-%d timeout", qid, qid + qcount - 1);
+            }
+            unvme_desc_put(desc);
+            return NULL;
+        }
+        buf += (u64)n << ns->blockshift;
+        slba += n;
+        nlb -= n;
+    }
+
+    unvme_desc_submitted(desc);
+    return desc;
+}
+
+/**
+ * Submit a vectored read/write command.  The request is only split into
+ * multiple commands where the PRP rules require or the max transfer size
+ * is reached (see unvme_submit_iov_prps and unvme_submit_iov_sgl).
+ * Each segment length must be a multiple of the block size.  Each segment
+ * address must also be block aligned when using PRPs and dword aligned
+ * when using SGLs.  A NULL read segment is discarded using an SGL bit
+ * bucket if the device supports it.
+ * On a non-blocking queue, the request fails with EAGAIN unless there are
+ * enough free cids for its worst case split.
+ * @param   ns          namespace handle
+ * @param   qid         queue id
+ * @param   opc         op code
+ * @param   iov         array of data buffer segments
+ * @param   iovcnt      number of segments
+ * @param   slba        starting lba
+ * @param   cb          completion callback (NULL for polled completion)
+ * @param   arg         user context
+ * @return  I/O descriptor or NULL if error.
+ */
+unvme_desc_t* unvme_do_rwv(const unvme_ns_t* ns, int qid, int opc,
+                           const struct iovec* iov, int iovcnt, u64 slba,
+                           unvme_cb_t cb, void* arg)
+{
+    u64 amask = ns->sgls ? 3 : ns->blocksize - 1;
+    u64 size = 0;
+    int i;
+    for (i = 0; i < iovcnt; i++) {
+        if (((u64)iov[i].iov_base & amask) ||
+            (iov[i].iov_len & (ns->blocksize - 1))) {
+            ERROR("iov %d %p %#lx not aligned",
+                  i, iov[i].iov_base, iov[i].iov_len);
+            return NULL;
+        }
+        if (!iov[i].iov_base && (opc != NVME_CMD_READ ||
+                                 !(ns->sgls & NVME_SGLS_BIT_BUCKET))) {
+            ERROR("iov %d NULL buffer not supported", i);
+            return NULL;
+        }
+        size += iov[i].iov_len;
+    }
+    if (size == 0) {
+        ERROR("empty iov");
+        return NULL;
+    }
+    if ((qid = unvme_ioqid(ns, qid)) < 0) return NULL;
+
+    unvme_queue_t* q = ((unvme_session_t*)ns->ses)->dev->ioqs + qid;
+    if (q->shared && unvme_fcq != q) {
+        unvme_fcrw_t a = { .ns = ns, .qid = qid, .opc = opc, .iov = iov,
+                           .iovcnt = iovcnt, .slba = slba, .cb = cb, .arg = arg };
+        unvme_combine(q, unvme_fc_rwv, &a);
+        if (!a.desc) errno = a.err;
+        return a.desc;
+    }
+
+    // a non-blocking queue requires free cids for the worst case split
+    // (a command per memory page and segment) as rwv is not deferred
+    if (q->ovfmax >= 0) {
+        u64 n = iovcnt + (size >> ns->pageshift);
+        if (n > q->size - 1) n = q->size - 1;
+        if (q->ovfhead || n > q->size - 1 - q->cidcount) {
+            errno = EAGAIN;
+            return NULL;
+        }
+    }
+
+    unvme_desc_t* desc = unvme_desc_get(q);
+    desc->cb = cb;
+    desc->arg = arg;
+    desc->opc = opc;
+    desc->buf = iov[0].iov_base;
+    desc->qid = qid;
+    desc->slba = slba;
+    desc->nlb = size >> ns->blockshift;
+
+    PDEBUG("# %sV %#lx %#x %d @%d +%d", opc == NVME_CMD_READ ? "READ" : "WRITE",
+           slba, desc->nlb, iovcnt, desc->id, q->desccount);
+
+    // ring the doorbell once for all the split submissions
+    int plugged = q->nvmeq->sq_plug;
+    if (!plugged) nvme_sq_plug(q->nvmeq);
+    int err = ns->sgls ? unvme_submit_iov_sgl(ns, desc, iov, iovcnt, slba)
+                       : unvme_submit_iov_prps(ns, desc, iov, iovcnt, slba);
+    if (!plugged) nvme_sq_unplug(q->nvmeq);
+
+    if (err) {
+        // wait for the already submitted commands and fail the request
+        while (desc->cidcount) {
+            if (unvme_check_completion(q, UNVME_TIMEOUT, NULL) == -1)
+                FATAL("q%d timeout", q->nvmeq->id);
+        }
+        unvme_desc_put(desc);
+        return NULL;
     }
 
+    unvme_desc_submitted(desc);
     return desc;
 }
 
 /**
  * Submit a generic or vendor specific command.
+ * On a non-blocking queue, the command fails with EAGAIN if no cid is free.
  * @param   ns          namespace handle
  * @param   qid         client queue index (-1 for admin queue)
  * @param   opc         command op code
@@ -717,18 +3239,36 @@ unvme_desc_t* unvme_do_rw(const unvme_ns_t* ns, int qid, int opc,
  * @param   cdw10_15    NVMe command word 10 through 15
  * @param   buf         data buffer (from unvme_alloc)
  * @param   bufsz       data buffer size
+ * @param   cb          completion callback (NULL for polled completion)
+ * @param   arg         user context
  * @return  command descriptor or NULL if error.
  */
 unvme_desc_t* unvme_do_cmd(const unvme_ns_t* ns, int qid, int opc, int nsid,
-                           void* buf, u64 bufsz, u32 cdw10_15[6])
+                           void* buf, u64 bufsz, u32 cdw10_15[6],
+                           unvme_cb_t cb, void* arg)
 {
+    if (qid == UNVME_QID_AUTO && (qid = unvme_ioqid(ns, qid)) < 0) return NULL;
     unvme_device_t* dev = ((unvme_session_t*)ns->ses)->dev;
     unvme_queue_t* q = (qid == -1) ? &dev->adminq : &dev->ioqs[qid];
+    if (q->shared && unvme_fcq != q) {
+        unvme_fccmd_t a = { .ns = ns, .qid = qid, .opc = opc, .nsid = nsid,
+                            .buf = buf, .bufsz = bufsz, .cdw10_15 = cdw10_15,
+                            .cb = cb, .arg = arg };
+        unvme_combine(q, unvme_fc_cmd, &a);
+        if (!a.desc) errno = a.err;
+        return a.desc;
+    }
+    if (q->ovfmax >= 0 && (q->ovfhead || (q->cidcount + 1) == q->size)) {
+        errno = EAGAIN;
+        return NULL;
+    }
+
     unvme_desc_t* desc = unvme_desc_get(q);
+    desc->cb = cb;
+    desc->arg = arg;
     desc->opc = opc;
     desc->buf = buf;
     desc->qid = qid;
-    desc->sentinel = desc;
 
     u64 prp1, prp2;
     u16 cid = unvme_get_cid(desc);
@@ -738,9 +3278,245 @@ unvme_desc_t* unvme_do_cmd(const unvme_ns_t* ns, int qid, int opc, int nsid,
         return NULL;
     }
 
-    PDEBUG("# CMD=%#x %d q%d={%d %d %#lx} d={%d %d %#lx}",
+    PDEBUG("# CMD=%#x %d q%d={%d %d %#lx} d={%d %d}",
            opc, nsid, q->nvmeq->id, cid, q->cidcount, *q->cidmask,
-           desc->id, desc->cidcount, *desc->cidmask);
+           desc->id, desc->cidcount);
+    unvme_desc_submitted(desc);
     return desc;
 }
 
+
+/**
+ * Register fixed I/O buffers (from unvme_alloc) to be used by prepared
+ * requests by index.  Each buffer DMA address is translated once and its
+ * PRP list is built up front, in a slot sized for the entries of a max
+ * size command (up to 4K) allocated from 2MB chunks.
+ * The buffers must not be freed while registered.
+ * @param   ns          namespace handle
+ * @param   iov         array of buffers
+ * @param   count       number of buffers
+ * @return  0 if ok else -1.
+ */
+int unvme_do_register_buffers(const unvme_ns_t* ns, const struct iovec* iov, int count)
+{
+    unvme_session_t* ses = ns->ses;
+    unvme_device_t* dev = ses->dev;
+    if (ses->fixbufs) {
+        ERROR("buffers already registered");
+        return -1;
+    }
+    if (count <= 0) {
+        ERROR("bad buffer count %d", count);
+        return -1;
+    }
+
+    // PRP list entries of a max size command (at any page offset)
+    u64 nent = (((u64)ns->maxbpio << ns->blockshift) + ns->pagesize - 1) >> ns->pageshift;
+    u64 maxent = sizeof(unvme_page_t) / sizeof(u64);
+    if (nent > ns->pagesize / sizeof(u64)) nent = ns->pagesize / sizeof(u64);
+    if (nent > maxent) nent = maxent;
+    int slotshift = nent > 1 ? 64 - __builtin_clzll(nent * sizeof(u64) - 1) : 3;
+    int perchunk = UNVME_PRPCHUNK_SIZE >> slotshift;
+
+    int nchunk = (count + perchunk - 1) / perchunk;
+    unvme_fixbuf_t* fixbufs = zalloc(count * sizeof(unvme_fixbuf_t));
+    vfio_dma_t** fixprp = zalloc(nchunk * sizeof(vfio_dma_t*));
+    int i;
+    for (i = 0; i < nchunk; i++) {
+        int n = (i + 1) < nchunk ? perchunk : count - i * perchunk;
+        if (!(fixprp[i] = vfio_dma_alloc(&dev->vfiodev, (u64)n << slotshift))) {
+            ERROR("vfio_dma_alloc");
+            unvme_fixbuf_free(fixbufs, fixprp, i);
+            return -1;
+        }
+    }
+
+    for (i = 0; i < count; i++) {
+        unvme_fixbuf_t* fb = fixbufs + i;
+        fb->buf = iov[i].iov_base;
+        fb->size = iov[i].iov_len;
+
+        // translate the buffer DMA address
+#ifdef UNVME_IDENTITY_MAP_DMA
+        fb->addr = (u64)fb->buf & dev->vfiodev.iovamask;
+#else
+        fb->addr = -1L;
+        unvme_lockr(&dev->iomem.lock);
+        int m = unvme_iomem_find(&dev->iomem, fb->buf);
+        vfio_dma_t* dma = m >= 0 ? dev->iomem.map[m] : NULL;
+        if (dma && (fb->buf + fb->size) <= (dma->buf + dma->size))
+            fb->addr = dma->addr + (u64)(fb->buf - dma->buf);
+        unvme_unlockr(&dev->iomem.lock);
+#endif
+        if (fb->addr == -1L || (fb->addr & 3) || fb->size < ns->blocksize) {
+            ERROR("invalid fixed buffer %d %p %#lx", i, fb->buf, fb->size);
+            unvme_fixbuf_free(fixbufs, fixprp, nchunk);
+            return -1;
+        }
+
+        // build the PRP list of the pages after the first one
+        u64 offset = fb->addr & (ns->pagesize - 1);
+        u64 npages = (offset + fb->size + ns->pagesize - 1) >> ns->pageshift;
+        if (npages > (nent + 1)) npages = nent + 1;
+        vfio_dma_t* chunk = fixprp[i / perchunk];
+        u64 prpoff = (u64)(i % perchunk) << slotshift;
+        if (npages > 2) {
+            nvme_prp_fill(chunk->buf + prpoff, fb->addr - offset + ns->pagesize,
+                          ns->pagesize, npages - 1);
+        }
+        fb->prplist = chunk->addr + prpoff;
+
+        // a prepared command is limited to the buffer, the max transfer size
+        // and the entries of the PRP list slot
+        u64 maxsize = (npages << ns->pageshift) - offset;
+        if (maxsize > fb->size) maxsize = fb->size;
+        fb->maxnlb = maxsize >> ns->blockshift;
+        if (fb->maxnlb > ns->maxbpio) fb->maxnlb = ns->maxbpio;
+    }
+
+    ses->fixprp = fixprp;
+    ses->fixchunks = nchunk;
+    ses->fixcount = count;
+    ses->fixbufs = fixbufs;
+    DEBUG_FN("%s %d buffers slot=%d", ns->device, count, 1 << slotshift);
+    return 0;
+}
+
+/**
+ * Unregister the fixed I/O buffers.
+ * @param   ns          namespace handle
+ * @return  0 if ok else -1 if none registered or prepared requests remain.
+ */
+int unvme_do_unregister_buffers(const unvme_ns_t* ns)
+{
+    unvme_session_t* ses = ns->ses;
+    if (!ses->fixbufs) {
+        ERROR("no buffers registered");
+        return -1;
+    }
+    if (ses->preps) {
+        ERROR("%d prepared requests remain", ses->preps);
+        return -1;
+    }
+    unvme_fixbuf_free(ses->fixbufs, ses->fixprp, ses->fixchunks);
+    ses->fixprp = NULL;
+    ses->fixchunks = 0;
+    ses->fixbufs = NULL;
+    ses->fixcount = 0;
+    return 0;
+}
+
+/**
+ * Create a prepared read/write request on a fixed buffer.  The request owns
+ * its descriptor and its command PRP fields are computed up front, so each
+ * submission only fills in the lba range.  Shared queues are not supported.
+ * @param   ns          namespace handle
+ * @param   qid         queue id
+ * @param   opc         op code (NVME_CMD_READ or NVME_CMD_WRITE)
+ * @param   bufidx      fixed buffer index
+ * @param   cb          completion callback (NULL for polled completion)
+ * @param   arg         user context
+ * @return  prepared request or NULL if error.
+ */
+unvme_prep_t* unvme_do_prep_create(const unvme_ns_t* ns, int qid, int opc,
+                                   int bufidx, unvme_cb_t cb, void* arg)
+{
+    unvme_session_t* ses = ns->ses;
+    if ((qid = unvme_ioqid(ns, qid)) < 0) return NULL;
+    unvme_queue_t* q = ses->dev->ioqs + qid;
+    if (bufidx < 0 || bufidx >= ses->fixcount || q->shared ||
+        (opc != NVME_CMD_READ && opc != NVME_CMD_WRITE)) {
+        ERROR("bad prepared request q%d opc=%#x buf=%d", qid, opc, bufidx);
+        return NULL;
+    }
+
+    unvme_fixbuf_t* fb = ses->fixbufs + bufidx;
+    unvme_prep_t* prep = zalloc(sizeof(unvme_prep_t));
+    prep->ns = ns;
+    prep->opc = opc;
+    prep->prp1 = fb->addr;
+    prep->offset = fb->addr & (ns->pagesize - 1);
+    prep->prp2 = fb->addr - prep->offset + ns->pagesize;
+    prep->prplist = fb->prplist;
+    prep->maxnlb = fb->maxnlb;
+
+    unvme_desc_t* desc = &prep->desc;
+    desc->q = q;
+    desc->qid = qid;
+    desc->opc = opc;
+    desc->buf = fb->buf;
+    desc->cb = cb;
+    desc->arg = arg;
+    desc->prep = 1;
+    unvme_lockw(&unvme_lock);
+    LIST_ADD(ses->preplist, prep);
+    ses->preps++;
+    unvme_unlockw(&unvme_lock);
+    return prep;
+}
+
+/**
+ * Destroy a prepared request.
+ * @param   prep        prepared request
+ * @return  0 if ok else -1 if the request is pending.
+ */
+int unvme_do_prep_destroy(unvme_prep_t* prep)
+{
+    if (prep->desc.sentinel) {
+        ERROR("prepared request pending");
+        return -1;
+    }
+    unvme_session_t* ses = prep->ns->ses;
+    unvme_lockw(&unvme_lock);
+    LIST_DEL(ses->preplist, prep);
+    ses->preps--;
+    unvme_unlockw(&unvme_lock);
+    free(prep);
+    return 0;
+}
+
+/**
+ * Submit a prepared request as a single command (up to the max blocks of
+ * its fixed buffer), bypassing the descriptor lists and the buffer DMA
+ * translation.  A request may only have one submission pending, which
+ * completes as any descriptor (i.e. via unvme_do_poll or the callback)
+ * except it is not returned by unvme_do_reap, and may be resubmitted from
+ * its callback.
+ * @param   prep        prepared request
+ * @param   slba        starting lba
+ * @param   nlb         number of logical blocks
+ * @return  the request descriptor or NULL if error.
+ */
+unvme_desc_t* unvme_do_prep_submit(unvme_prep_t* prep, u64 slba, u32 nlb)
+{
+    unvme_desc_t* desc = &prep->desc;
+    unvme_queue_t* q = desc->q;
+    if (desc->sentinel || nlb == 0 || nlb > prep->maxnlb) {
+        errno = desc->sentinel ? EBUSY : EINVAL;
+        return NULL;
+    }
+    if (q->ovfmax >= 0 && (q->ovfhead || (q->cidcount + 1) == q->size)) {
+        errno = EAGAIN;
+        return NULL;
+    }
+
+    desc->slba = slba;
+    desc->nlb = nlb;
+    desc->error = 0;
+    desc->done = 0;
+    u16 cid = unvme_get_cid(desc);
+    u64 end = prep->offset + ((u64)nlb << prep->ns->blockshift);
+    u64 prp2 = end > (2 * prep->ns->pagesize) ? prep->prplist :
+               end > prep->ns->pagesize ? prep->prp2 : 0;
+    if (nvme_cmd_rw(q->nvmeq, prep->opc, cid, prep->ns->id, slba, nlb,
+                    prep->prp1, prp2)) {
+        unvme_complete_cid(q, cid, -1);
+        return NULL;
+    }
+
+    PDEBUG("# PREP %c %#lx %#x q%d={%d %d %#lx}",
+           prep->opc == NVME_CMD_READ ? 'r' : 'w', slba, nlb,
+           q->nvmeq->id, cid, q->cidcount, *q->cidmask);
+    unvme_desc_submitted(desc);
+    return desc;
+}
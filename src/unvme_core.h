@@ -38,6 +38,7 @@
 #define _UNVME_CORE_H
 
 #include <sys/types.h>
+#include <pthread.h>
 
 #include "unvme_log.h"
 #include "unvme_vfio.h"
@@ -75,14 +76,52 @@ __BEGIN_DECLS
 /// Page size
 typedef char unvme_page_t[4096];
 
+/// Chained PRP list pool chunk size (within a 2MB hugepage allocation)
+#define UNVME_PRPCHUNK_SIZE     (2 * 1024 * 1024)
+
+/// Max number of passes over the published requests per combiner turn
+#define UNVME_FC_PASSES         8
+
+/// Busy poll time before yielding (for UNVME_WAIT_SPIN_YIELD)
+#define UNVME_SPIN_USEC         50
+
+/// Completion notifier nap time between checks of the armed queues (in microseconds)
+#define UNVME_NOTIFY_USEC       10
+
+/// Default fiber stack size
+#define UNVME_FIBER_STACK       (64 * 1024)
+
 /// IO memory allocation tracking info
 typedef struct _unvme_iomem {
-    vfio_dma_t**            map;        ///< dynamic array of allocated memory
+    vfio_dma_t**            map;        ///< allocated memory (sorted by buf)
     int                     size;       ///< array size
     int                     count;      ///< array count
     unvme_lock_t            lock;       ///< map access lock
+    u32                     gen;        ///< generation (changed upon free)
 } unvme_iomem_t;
 
+/// IO memory translation cache (last hit)
+typedef struct _unvme_dmacache {
+    void*                   buf;        ///< memory buffer
+    u64                     size;       ///< memory size
+    u64                     addr;       ///< memory DMA address
+    u32                     gen;        ///< IO memory generation
+} unvme_dmacache_t;
+
+/// Chained PRP list page
+typedef struct _unvme_prppage {
+    void*                   buf;        ///< page buffer
+    u64                     addr;       ///< page DMA address
+    struct _unvme_prppage*  next;       ///< next page node
+} unvme_prppage_t;
+
+/// Chained PRP list page pool chunk
+typedef struct _unvme_prpchunk {
+    vfio_dma_t*             dma;        ///< chunk DMA memory
+    struct _unvme_prpchunk* next;       ///< next chunk node
+    unvme_prppage_t         page[];     ///< chunk pages
+} unvme_prpchunk_t;
+
 /// IO full descriptor
 typedef struct _unvme_desc {
     void*                   buf;        ///< buffer
@@ -91,30 +130,91 @@ typedef struct _unvme_desc {
     u32                     qid;        ///< queue id
     u32                     opc;        ///< op code
     u32                     id;         ///< descriptor id
+    int                     error;      ///< error status
+    void*                   arg;        ///< user context
     void*                   sentinel;   ///< sentinel check
     struct _unvme_queue*    q;          ///< queue context owner
     struct _unvme_desc*     prev;       ///< previous descriptor node
     struct _unvme_desc*     next;       ///< next descriptor node
-    int                     error;      ///< error status
     int                     cidcount;   ///< number of pending cids
-    u64                     cidmask[];  ///< cid pending bit mask
+    int                     done;       ///< completed (in done list) flag
+    unvme_cb_t              cb;         ///< completion callback
+    int                     stripe;     ///< number of striped queues (or 0)
+    const unvme_ns_t*       ns;         ///< namespace handle (if deferred)
+    struct _unvme_desc*     ovfnext;    ///< next overflow queued descriptor
+    int                     prep;       ///< prepared request (not listed) flag
+    struct _unvme_desc*     cbnext;     ///< next deferred callback descriptor
 } unvme_desc_t;
 
+/// Reactor completion hand-off entry
+typedef struct _unvme_cqe {
+    u16                     cid;        ///< command id
+    u16                     stat;       ///< completion status
+    u32                     cs;         ///< command specific DW0
+} unvme_cqe_t;
+
+/// Reactor completion hand-off ring (single producer single consumer)
+typedef struct _unvme_cqring {
+    u32                     tail __attribute__((aligned(64))); ///< producer index
+    u32                     head __attribute__((aligned(64))); ///< consumer index
+    int                     waiters;    ///< consumers blocked on the tail
+    u32                     mask;       ///< ring size - 1
+    unvme_cqe_t             ent[];      ///< ring entries
+} unvme_cqring_t;
+
+/// Shared queue operation request (published for the combiner)
+typedef struct _unvme_fcreq {
+    void                    (*fn)(void*); ///< operation function
+    void*                   arg;        ///< operation arguments
+    int                     done;       ///< operation executed flag
+    struct _unvme_fcreq*    next;       ///< next published request
+} unvme_fcreq_t;
+
 /// IO queue entry
 typedef struct _unvme_queue {
+    struct _unvme_device*   dev;        ///< owner device context
     nvme_queue_t*           nvmeq;      ///< NVMe associated queue
     vfio_dma_t*             sqdma;      ///< submission queue mem
     vfio_dma_t*             cqdma;      ///< completion queue mem
     vfio_dma_t*             prplist;    ///< PRP list
+    unvme_prpchunk_t*       prpchunk;   ///< chained PRP list page pool
+    unvme_prppage_t*        prpfree;    ///< free chained PRP list pages
+    unvme_prppage_t**       cidprp;     ///< chained PRP list pages per cid
+    unvme_dmacache_t        dmacache;   ///< last DMA translation hit
     u32                     size;       ///< queue depth
-    u16                     cid;        ///< next cid to check and use
+    u16                     cid;        ///< last freed cid (search hint)
     int                     cidcount;   ///< number of pending cids
     int                     desccount;  ///< number of pending descriptors
     int                     masksize;   ///< bit mask size to allocate
     u64*                    cidmask;    ///< cid pending bit mask
+    unvme_desc_t**          cidtab;     ///< cid to owner descriptor table
     unvme_desc_t*           desclist;   ///< used descriptor list
+    unvme_desc_t*           descdone;   ///< completed descriptor list
     unvme_desc_t*           descfree;   ///< free descriptor list
-    unvme_desc_t*           descpend;   ///< pending descriptor list
+    int                     shared;     ///< shared (flat combining) flag
+    int                     fclock;     ///< combiner role lock
+    unvme_fcreq_t*          fcpub;      ///< published operation requests
+    int                     node;       ///< NUMA node of queue memory (or -1)
+    int                     bound;      ///< number of threads bound
+    int                     efd;        ///< completion eventfd (-1 if polled)
+    int                     efdshared;  ///< eventfd vector shared by queues
+    int                     wait;       ///< completion wait strategy
+    u64                     subtsc;     ///< last submission tsc (hybrid)
+    u64                     lattsc;     ///< mean completion latency (hybrid)
+    u64*                    cidtsc;     ///< submission tsc per cid (hybrid)
+    unvme_wait_stats_t      stats[UNVME_WAIT_COUNT]; ///< wait statistics
+    int                     wstats;     ///< wait statistics enabled flag
+    unvme_cqring_t*         cqring;     ///< reactor completion ring (or NULL)
+    int                     qfd;        ///< completion notification fd (or -1)
+    int                     armed;      ///< notify upon the next completion
+    int                     prpshift;   ///< PRP list slot size shift per cid
+    int                     ovfmax;     ///< overflow queue depth (-1 blocking)
+    int                     ovfcount;   ///< number of overflow queued requests
+    struct _unvme_desc*     ovfhead;    ///< overflow queue head
+    struct _unvme_desc*     ovftail;    ///< overflow queue tail
+    unvme_desc_t            ffdesc;     ///< descriptor-less write cid owner
+    unvme_io_t*             ffio;       ///< descriptor-less write per cid
+    unvme_ff_stats_t        ffstats;    ///< descriptor-less write counters
 } unvme_queue_t;
 
 /// Device context
@@ -126,23 +226,166 @@ typedef struct _unvme_device {
     unvme_iomem_t           iomem;      ///< IO memory tracker
     unvme_ns_t              ns;         ///< controller namespace (id=0)
     unvme_queue_t*          ioqs;       ///< pointer to IO queues
+    u32                     id;         ///< device instance id
+    int                     nefd;       ///< number of completion eventfds
+    int*                    efds;       ///< completion eventfds per vector
+    pthread_t               reactor;    ///< completion reactor thread
+    int                     rstop;      ///< reactor thread stop flag
+    int                     rsleep;     ///< reactor thread parked flag
+    pthread_t               notifier;   ///< completion notifier thread
+    int                     nstart;     ///< notifier thread started flag
+    int                     nstop;      ///< notifier thread stop flag
+    int                     nsleep;     ///< notifier thread blocked flag
+    int                     nwfd;       ///< notifier thread wake eventfd
 } unvme_device_t;
 
+/// Thread to I/O queue binding
+typedef struct _unvme_binding {
+    unvme_device_t*         dev;        ///< bound device
+    u32                     devid;      ///< bound device instance id
+    int                     qid;        ///< bound queue id
+    struct _unvme_binding*  next;       ///< next binding of the thread
+} unvme_binding_t;
+
+/// Poll group queue entry
+typedef struct _unvme_pgent {
+    unvme_queue_t*          q;          ///< queue
+    const unvme_ns_t*       ns;         ///< namespace handle
+    int                     qid;        ///< queue id
+    u32                     devid;      ///< device instance id
+} unvme_pgent_t;
+
+/// Poll group (queues polled together by a thread)
+struct _unvme_poll_group {
+    int                     count;      ///< number of queues
+    int                     size;       ///< number of allocated entries
+    int                     next;       ///< entry to start the next pass at
+    unvme_pgent_t*          ent;        ///< queue entries (by device and qid)
+};
+
+/// Fiber (user level thread)
+typedef struct _unvme_fiber {
+    void*                   sp;         ///< saved stack pointer
+    void*                   stack;      ///< stack memory (with guard page)
+    void                    (*fn)(void*); ///< fiber function
+    void*                   arg;        ///< fiber function argument
+    unvme_desc_t*           desc;       ///< descriptor waited on
+    u32*                    cqe_cs;     ///< CQE DW0 to return for the wait
+    u64                     deadline;   ///< wait timeout tsc
+    int                     err;        ///< wait result
+    int                     done;       ///< fiber function returned flag
+    struct _unvme_fiber*    prev;       ///< previous fiber node
+    struct _unvme_fiber*    next;       ///< next fiber node
+} unvme_fiber_t;
+
+/// Fiber scheduler (run by one thread)
+struct _unvme_fiber_sched {
+    void*                   sp;         ///< scheduler saved stack pointer
+    unvme_fiber_t*          current;    ///< running fiber (NULL if none)
+    unvme_fiber_t*          runq;       ///< runnable fibers
+    unvme_fiber_t*          waitq;      ///< fibers waiting for I/O completion
+    unvme_fiber_t*          freeq;      ///< exited fibers (stacks to reuse)
+    int                     nrun;       ///< number of runnable fibers
+    int                     count;      ///< number of live fibers
+    size_t                  stacksize;  ///< fiber stack size
+};
+
+/// Registered fixed I/O buffer
+typedef struct _unvme_fixbuf {
+    void*                   buf;        ///< buffer address
+    u64                     size;       ///< buffer size
+    u64                     addr;       ///< buffer DMA address
+    u64                     prplist;    ///< PRP list DMA address
+    u32                     maxnlb;     ///< max blocks per prepared command
+} unvme_fixbuf_t;
+
+/// Prepared I/O request (command template on a fixed buffer)
+struct _unvme_prep {
+    unvme_desc_t            desc;       ///< owned descriptor
+    const unvme_ns_t*       ns;         ///< namespace handle
+    int                     opc;        ///< op code
+    u64                     prp1;       ///< PRP1 (buffer DMA address)
+    u64                     prp2;       ///< PRP2 of a 2 page transfer
+    u64                     prplist;    ///< PRP2 of a 3+ page transfer
+    u64                     offset;     ///< buffer offset in its first page
+    u32                     maxnlb;     ///< max blocks per submission
+    struct _unvme_prep*     prev;       ///< previous session request
+    struct _unvme_prep*     next;       ///< next session request
+};
+
 /// Session context
 typedef struct _unvme_session {
     struct _unvme_session*  prev;       ///< previous session node
     struct _unvme_session*  next;       ///< next session node
     unvme_device_t*         dev;        ///< device context
     unvme_ns_t              ns;         ///< namespace
+    unvme_fixbuf_t*         fixbufs;    ///< registered fixed buffers
+    int                     fixcount;   ///< number of fixed buffers
+    int                     preps;      ///< number of prepared requests
+    struct _unvme_prep*     preplist;   ///< prepared request list
+    vfio_dma_t**            fixprp;     ///< fixed buffer PRP list chunks
+    int                     fixchunks;  ///< number of PRP list chunks
 } unvme_session_t;
 
-unvme_ns_t* unvme_do_open(int pci, int nsid, int qcount, int qsize);
+extern __thread unvme_fiber_sched_t* unvme_fsched;
+
+/**
+ * Check if the calling thread is running a fiber.
+ * @return  1 if in a fiber else 0.
+ */
+static inline int unvme_in_fiber(void)
+{
+    return unvme_fsched && unvme_fsched->current;
+}
+
+unvme_ns_t* unvme_do_open(int pci, int nsid, const unvme_opts_t* opts);
 int unvme_do_close(const unvme_ns_t* ns);
+int unvme_do_bind(const unvme_ns_t* ns);
+int unvme_do_unbind(const unvme_ns_t* ns);
+int unvme_do_coalesce(const unvme_ns_t* ns, int qid, int enable);
+int unvme_do_queue_fd(const unvme_ns_t* ns, int qid);
+int unvme_do_set_wait(const unvme_ns_t* ns, int qid, int wait);
+int unvme_do_wait_stats(const unvme_ns_t* ns, int qid, unvme_wait_stats_t stats[]);
+int unvme_do_set_nonblock(const unvme_ns_t* ns, int qid, int ovfdepth);
+int unvme_do_occupancy(const unvme_ns_t* ns, int qid, int* queued);
 void* unvme_do_alloc(const unvme_ns_t* ns, u64 size);
 int unvme_do_free(const unvme_ns_t* ses, void* buf);
 int unvme_do_poll(unvme_desc_t* desc, int sec, u32* cqe_cs);
-unvme_desc_t* unvme_do_cmd(const unvme_ns_t* ns, int qid, int opc, int nsid, void* buf, u64 bufsz, u32 cdw10_15[6]);
-unvme_desc_t* unvme_do_rw(const unvme_ns_t* ns, int qid, int opc, void* buf, u64 slba, u32 nlb);
+int unvme_do_poll_wait(unvme_desc_t* desc, int sec, int wait, u32* cqe_cs);
+int unvme_do_reap(const unvme_ns_t* ns, int qid, int max, unvme_iod_t out[]);
+int unvme_do_process(const unvme_ns_t* ns, int qid, int max);
+int unvme_do_drain(const unvme_ns_t* ns, int qid);
+int unvme_do_ff_stats(const unvme_ns_t* ns, int qid, unvme_ff_stats_t* stats);
+int unvme_do_plug(const unvme_ns_t* ns, int qid, int plug);
+unvme_poll_group_t* unvme_do_pg_create(void);
+int unvme_do_pg_destroy(unvme_poll_group_t* pg);
+int unvme_do_pg_add(unvme_poll_group_t* pg, const unvme_ns_t* ns, int qid);
+int unvme_do_pg_remove(unvme_poll_group_t* pg, const unvme_ns_t* ns, int qid);
+int unvme_do_pg_process(unvme_poll_group_t* pg, int max);
+unvme_fiber_sched_t* unvme_do_fiber_sched_create(int stacksize);
+int unvme_do_fiber_sched_destroy(unvme_fiber_sched_t* fs);
+int unvme_do_fiber_create(unvme_fiber_sched_t* fs, void (*fn)(void*), void* arg);
+int unvme_do_fiber_run(unvme_fiber_sched_t* fs);
+void unvme_do_fiber_yield(void);
+int unvme_fiber_poll(unvme_desc_t* desc, int timeout, u32* cqe_cs);
+unvme_exec_t* unvme_do_exec_create(const unvme_ns_t* ns, int count, int depth, u32 flags);
+int unvme_do_exec_destroy(unvme_exec_t* ex);
+int unvme_do_exec_submit(unvme_exec_t* ex, int worker, const unvme_io_t* io, unvme_cb_t cb, void* arg);
+int unvme_do_exec_wait(unvme_exec_t* ex);
+int unvme_do_exec_stats(unvme_exec_t* ex, int worker, unvme_exec_stats_t* stats);
+int unvme_do_batch(const unvme_ns_t* ns, int qid, const unvme_io_t* io, int count, unvme_iod_t iods[]);
+unvme_desc_t* unvme_do_cmd(const unvme_ns_t* ns, int qid, int opc, int nsid, void* buf, u64 bufsz, u32 cdw10_15[6], unvme_cb_t cb, void* arg);
+unvme_desc_t* unvme_do_rw(const unvme_ns_t* ns, int qid, int opc, void* buf, u64 slba, u32 nlb, unvme_cb_t cb, void* arg);
+unvme_desc_t* unvme_do_rwv(const unvme_ns_t* ns, int qid, int opc, const struct iovec* iov, int iovcnt, u64 slba, unvme_cb_t cb, void* arg);
+int unvme_do_write_ff(const unvme_ns_t* ns, int qid, void* buf, u64 slba, u32 nlb);
+unvme_desc_t* unvme_do_rw_striped(const unvme_ns_t* ns, int qid, int qcount, int opc, void* buf, u64 slba, u32 nlb);
+int unvme_rw_ncmds(const unvme_ns_t* ns, int opc, u64 slba, u32 nlb);
+void unvme_ovf_drain(unvme_queue_t* q);
+int unvme_do_register_buffers(const unvme_ns_t* ns, const struct iovec* iov, int count);
+int unvme_do_unregister_buffers(const unvme_ns_t* ns);
+unvme_prep_t* unvme_do_prep_create(const unvme_ns_t* ns, int qid, int opc, int bufidx, unvme_cb_t cb, void* arg);
+int unvme_do_prep_destroy(unvme_prep_t* prep);
+unvme_desc_t* unvme_do_prep_submit(unvme_prep_t* prep, u64 slba, u32 nlb);
 
 __END_DECLS
 
@@ -0,0 +1,457 @@
+/**
+ * Copyright (c) 2015-2016, Micron Technology, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the copyright holder nor the names of its
+ *      contributors may be used to endorse or promote products derived
+ *      from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @brief UNVMe work-stealing I/O executor.
+ *
+ * Each worker thread owns an I/O queue and a deque of pending (not yet
+ * submitted) requests.  Requests are pushed to a worker deque by any
+ * thread, and the worker submits them as its queue entries free up.
+ * With UNVME_EXEC_STEAL, a worker with free queue entries and an empty
+ * deque steals the older half of the pending requests of the most loaded
+ * worker.  Submitted requests always complete on the submitting worker
+ * queue, where the completion callbacks are invoked.
+ */
+
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+
+#include "unvme_core.h"
+
+/// Default deque size (pending requests) per worker
+#define UNVME_EXEC_DEPTH        4096
+
+/// Max number of requests submitted per doorbell
+#define UNVME_EXEC_BATCH        32
+
+/// Executor pending request
+typedef struct _unvme_xreq {
+    unvme_io_t              io;         ///< I/O request
+    unvme_cb_t              cb;         ///< completion callback
+    void*                   arg;        ///< callback argument
+} unvme_xreq_t;
+
+struct _unvme_xworker;
+
+/// Executor in-flight request slot
+typedef struct _unvme_xslot {
+    struct _unvme_xworker*  w;          ///< owner worker
+    unvme_cb_t              cb;         ///< completion callback
+    void*                   arg;        ///< callback argument
+    int                     ncid;       ///< number of queue entries used
+    struct _unvme_xslot*    next;       ///< next free slot
+} unvme_xslot_t;
+
+/// Executor worker
+typedef struct _unvme_xworker {
+    // deque accessed by producers and thieves (under lock)
+    int                     lock __attribute__((aligned(64))); ///< deque lock
+    u32                     head;       ///< deque head (oldest request)
+    u32                     tail;       ///< deque tail
+    unvme_xreq_t*           deque;      ///< deque ring
+    // states only accessed by the worker thread
+    struct _unvme_exec*     ex __attribute__((aligned(64))); ///< executor
+    int                     qid;        ///< owned queue id
+    int                     ncid;       ///< number of queue entries in use
+    u64                     seed;       ///< random seed
+    unvme_xslot_t*          slots;      ///< in-flight request slots
+    unvme_xslot_t*          free;       ///< free slot list
+    pthread_t               thread;     ///< worker thread
+    unvme_exec_stats_t      stats;      ///< statistics
+} unvme_xworker_t;
+
+/// Executor
+struct _unvme_exec {
+    const unvme_ns_t*       ns;         ///< namespace handle
+    int                     count;      ///< number of workers
+    u32                     flags;      ///< options (UNVME_EXEC_*)
+    u32                     mask;       ///< deque ring mask
+    int                     stop;       ///< stop workers flag
+    u32                     next;       ///< next worker (round robin)
+    u64                     pending;    ///< requests not yet completed
+    int                     waiters;    ///< threads waiting for completion
+    pthread_mutex_t         wlock;      ///< completion wait lock
+    pthread_cond_t          wcond;      ///< completion wait condition
+    unvme_xworker_t*        workers;    ///< workers
+};
+
+
+/**
+ * Lock a worker deque.
+ * @param   w           worker
+ */
+static inline void unvme_xlock(unvme_xworker_t* w)
+{
+    while (__sync_lock_test_and_set(&w->lock, 1)) {
+        while (w->lock) __builtin_ia32_pause();
+    }
+}
+
+/**
+ * Unlock a worker deque.
+ * @param   w           worker
+ */
+static inline void unvme_xunlock(unvme_xworker_t* w)
+{
+    __sync_lock_release(&w->lock);
+}
+
+/**
+ * Get the number of queue entries a request takes (as split by unvme_do_rw).
+ * @param   ns          namespace handle
+ * @param   io          request
+ * @return  number of queue entries.
+ */
+static inline int unvme_xreq_cids(const unvme_ns_t* ns, const unvme_io_t* io)
+{
+    return unvme_rw_ncmds(ns, io->opc, io->slba, io->nlb);
+}
+
+/**
+ * Complete an executor request on its worker thread.  The callback gets
+ * the descriptor with the request argument (rather than the slot), and
+ * the waiters are woken up after the last pending request.
+ * @param   iod         I/O descriptor
+ * @param   arg         request slot
+ */
+static void unvme_exec_done(unvme_iod_t iod, void* arg)
+{
+    unvme_xslot_t* s = arg;
+    unvme_xworker_t* w = s->w;
+    unvme_exec_t* ex = w->ex;
+    iod->arg = s->arg;
+    s->cb(iod, s->arg);
+    w->ncid -= s->ncid;
+    s->next = w->free;
+    w->free = s;
+    if (__atomic_sub_fetch(&ex->pending, 1, __ATOMIC_SEQ_CST) == 0 &&
+        __atomic_load_n(&ex->waiters, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&ex->wlock);
+        pthread_cond_broadcast(&ex->wcond);
+        pthread_mutex_unlock(&ex->wlock);
+    }
+}
+
+/**
+ * Submit a request to a worker queue.
+ * @param   w           worker
+ * @param   r           request
+ */
+static void unvme_exec_issue(unvme_xworker_t* w, const unvme_xreq_t* r)
+{
+    const unvme_ns_t* ns = w->ex->ns;
+    unvme_xslot_t* s = w->free;
+    w->free = s->next;
+    s->cb = r->cb;
+    s->arg = r->arg;
+    s->ncid = unvme_xreq_cids(ns, &r->io);
+    w->ncid += s->ncid;
+
+    int err;
+    if (r->io.opc == NVME_CMD_WRITE)
+        err = unvme_awrite_cb(ns, w->qid, r->io.buf, r->io.slba, r->io.nlb,
+                              unvme_exec_done, s);
+    else
+        err = unvme_aread_cb(ns, w->qid, r->io.buf, r->io.slba, r->io.nlb,
+                             unvme_exec_done, s);
+    if (err) {
+        // complete the failed submission with an error descriptor
+        struct _unvme_iod iod = { .buf = r->io.buf, .slba = r->io.slba,
+                                  .nlb = r->io.nlb, .qid = w->qid,
+                                  .opc = r->io.opc, .error = -1,
+                                  .arg = r->arg };
+        unvme_exec_done(&iod, s);
+    }
+    w->stats.submitted++;
+}
+
+/**
+ * Submit the pending requests of a worker deque as its queue entries allow.
+ * @param   w           worker
+ * @return  number of requests submitted.
+ */
+static int unvme_exec_fill(unvme_xworker_t* w)
+{
+    unvme_exec_t* ex = w->ex;
+    const unvme_ns_t* ns = ex->ns;
+    unvme_xreq_t batch[UNVME_EXEC_BATCH];
+    int total = 0;
+
+    for (;;) {
+        if (__atomic_load_n(&w->head, __ATOMIC_RELAXED) ==
+            __atomic_load_n(&w->tail, __ATOMIC_ACQUIRE)) break;
+        int n = 0, ncid = w->ncid;
+        unvme_xslot_t* s = w->free;
+        unvme_xlock(w);
+        while (n < UNVME_EXEC_BATCH && s && w->head != w->tail) {
+            unvme_xreq_t* r = &w->deque[w->head & ex->mask];
+            ncid += unvme_xreq_cids(ns, &r->io);
+            if (ncid > ns->maxiopq) break;
+            batch[n++] = *r;
+            w->head++;
+            s = s->next;
+        }
+        unvme_xunlock(w);
+        if (!n) break;
+
+        int i;
+        unvme_plug(ns, w->qid);
+        for (i = 0; i < n; i++) unvme_exec_issue(w, batch + i);
+        unvme_unplug(ns, w->qid);
+        total += n;
+    }
+    return total;
+}
+
+/**
+ * Steal the older half of the pending requests of the most loaded worker.
+ * The deques are locked in worker order to avoid deadlock.
+ * @param   w           worker
+ * @return  number of requests stolen.
+ */
+static int unvme_exec_steal(unvme_xworker_t* w)
+{
+    unvme_exec_t* ex = w->ex;
+    unvme_xworker_t* v = NULL;
+    u32 most = 1;
+    int i;
+
+    // pick the victim with the largest backlog (starting at random)
+    w->seed ^= w->seed << 13;
+    w->seed ^= w->seed >> 7;
+    w->seed ^= w->seed << 17;
+    int k = w->seed % ex->count;
+    for (i = 0; i < ex->count; i++, k++) {
+        unvme_xworker_t* x = ex->workers + (k % ex->count);
+        u32 len = __atomic_load_n(&x->tail, __ATOMIC_RELAXED) -
+                  __atomic_load_n(&x->head, __ATOMIC_RELAXED);
+        if (x != w && (int)len > (int)most) {
+            most = len;
+            v = x;
+        }
+    }
+    if (!v) return 0;
+
+    unvme_xworker_t* first = v < w ? v : w;
+    unvme_xworker_t* second = v < w ? w : v;
+    unvme_xlock(first);
+    unvme_xlock(second);
+    u32 n = (v->tail - v->head + 1) >> 1;
+    u32 room = ex->mask + 1 - (w->tail - w->head);
+    if (n > room) n = room;
+    if (n > (u32)ex->ns->maxiopq) n = ex->ns->maxiopq;
+    u32 j;
+    for (j = 0; j < n; j++) {
+        w->deque[(w->tail + j) & ex->mask] = v->deque[(v->head + j) & ex->mask];
+    }
+    __atomic_store_n(&v->head, v->head + n, __ATOMIC_RELEASE);
+    __atomic_store_n(&w->tail, w->tail + n, __ATOMIC_RELEASE);
+    unvme_xunlock(second);
+    unvme_xunlock(first);
+
+    if (n) {
+        w->stats.steals++;
+        w->stats.stolen += n;
+    }
+    return n;
+}
+
+/**
+ * Worker thread to submit the requests of its deque (and steal when idle)
+ * and process its queue completions.
+ * @param   arg         worker
+ */
+static void* unvme_exec_worker(void* arg)
+{
+    unvme_xworker_t* w = arg;
+    unvme_exec_t* ex = w->ex;
+    int idle = 0;
+
+    for (;;) {
+        int n = unvme_process(ex->ns, w->qid, INT_MAX);
+        n += unvme_exec_fill(w);
+        if ((ex->flags & UNVME_EXEC_STEAL) && w->free &&
+            __atomic_load_n(&w->head, __ATOMIC_RELAXED) ==
+            __atomic_load_n(&w->tail, __ATOMIC_ACQUIRE) &&
+            unvme_exec_steal(w))
+            n += unvme_exec_fill(w);
+
+        if (n) {
+            idle = 0;
+            continue;
+        }
+        if (__atomic_load_n(&ex->stop, __ATOMIC_ACQUIRE) && !w->ncid) break;
+        w->stats.idle++;
+        if (++idle < 64) __builtin_ia32_pause();
+        else sched_yield();
+    }
+    return NULL;
+}
+
+/**
+ * Create an executor with a worker thread per I/O queue.
+ * @param   ns          namespace handle
+ * @param   count       number of workers (using queues 0 to count - 1)
+ * @param   depth       max pending requests per worker (0 for default)
+ * @param   flags       options (UNVME_EXEC_*)
+ * @return  executor or NULL if error.
+ */
+unvme_exec_t* unvme_do_exec_create(const unvme_ns_t* ns, int count,
+                                   int depth, u32 flags)
+{
+    if (count <= 0 || count > ns->qcount || depth < 0) {
+        ERROR("invalid worker count %d or depth %d", count, depth);
+        return NULL;
+    }
+    u32 size = 1;
+    while (size < (u32)(depth ? depth : UNVME_EXEC_DEPTH)) size <<= 1;
+
+    unvme_exec_t* ex = zalloc(sizeof(unvme_exec_t));
+    ex->ns = ns;
+    ex->count = count;
+    ex->flags = flags;
+    ex->mask = size - 1;
+    pthread_mutex_init(&ex->wlock, NULL);
+    pthread_cond_init(&ex->wcond, NULL);
+    if (posix_memalign((void**)&ex->workers, 64, count * sizeof(unvme_xworker_t)))
+        FATAL("posix_memalign");
+    memset(ex->workers, 0, count * sizeof(unvme_xworker_t));
+
+    int i, j;
+    for (i = 0; i < count; i++) {
+        unvme_xworker_t* w = ex->workers + i;
+        w->ex = ex;
+        w->qid = i;
+        w->seed = i + 1;
+        w->deque = zalloc(size * sizeof(unvme_xreq_t));
+        w->slots = zalloc(ns->maxiopq * sizeof(unvme_xslot_t));
+        for (j = 0; j < ns->maxiopq; j++) {
+            w->slots[j].w = w;
+            w->slots[j].next = w->free;
+            w->free = w->slots + j;
+        }
+    }
+    for (i = 0; i < count; i++) {
+        if (pthread_create(&ex->workers[i].thread, NULL, unvme_exec_worker,
+                           ex->workers + i))
+            FATAL("pthread_create");
+    }
+    DEBUG_FN("%s workers=%d depth=%u flags=%#x", ns->device, count, size, flags);
+    return ex;
+}
+
+/**
+ * Push a request to the deque of a worker.
+ * @param   ex          executor
+ * @param   worker      worker index (-1 for round robin)
+ * @param   io          request
+ * @param   cb          completion callback (invoked on the worker thread)
+ * @param   arg         callback argument
+ * @return  0 if ok else -1 if the worker deque is full.
+ */
+int unvme_do_exec_submit(unvme_exec_t* ex, int worker, const unvme_io_t* io,
+                         unvme_cb_t cb, void* arg)
+{
+    if (unvme_xreq_cids(ex->ns, io) > ex->ns->maxiopq) {
+        ERROR("nlb %u exceeds queue limit", io->nlb);
+        return -1;
+    }
+    if (worker < 0) worker = __atomic_fetch_add(&ex->next, 1, __ATOMIC_RELAXED) % ex->count;
+    unvme_xworker_t* w = ex->workers + worker;
+    unvme_xlock(w);
+    if ((w->tail - w->head) > ex->mask) {
+        unvme_xunlock(w);
+        return -1;
+    }
+    unvme_xreq_t* r = &w->deque[w->tail & ex->mask];
+    r->io = *io;
+    r->cb = cb;
+    r->arg = arg;
+    __atomic_add_fetch(&ex->pending, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&w->tail, w->tail + 1, __ATOMIC_RELEASE);
+    unvme_xunlock(w);
+    return 0;
+}
+
+/**
+ * Wait for all the requests pushed to an executor to complete, blocking
+ * until woken up by the completion of the last one.
+ * @param   ex          executor
+ * @return  0.
+ */
+int unvme_do_exec_wait(unvme_exec_t* ex)
+{
+    pthread_mutex_lock(&ex->wlock);
+    __atomic_add_fetch(&ex->waiters, 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&ex->pending, __ATOMIC_SEQ_CST))
+        pthread_cond_wait(&ex->wcond, &ex->wlock);
+    __atomic_sub_fetch(&ex->waiters, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&ex->wlock);
+    return 0;
+}
+
+/**
+ * Get the statistics of an executor worker.
+ * @param   ex          executor
+ * @param   worker      worker index
+ * @param   stats       returned statistics
+ * @return  0 if ok else -1.
+ */
+int unvme_do_exec_stats(unvme_exec_t* ex, int worker, unvme_exec_stats_t* stats)
+{
+    if (worker < 0 || worker >= ex->count) return -1;
+    *stats = ex->workers[worker].stats;
+    return 0;
+}
+
+/**
+ * Destroy an executor after completing all its requests.
+ * @param   ex          executor
+ * @return  0.
+ */
+int unvme_do_exec_destroy(unvme_exec_t* ex)
+{
+    unvme_do_exec_wait(ex);
+    __atomic_store_n(&ex->stop, 1, __ATOMIC_RELEASE);
+    int i;
+    for (i = 0; i < ex->count; i++) {
+        pthread_join(ex->workers[i].thread, NULL);
+        free(ex->workers[i].slots);
+        free(ex->workers[i].deque);
+    }
+    pthread_mutex_destroy(&ex->wlock);
+    pthread_cond_destroy(&ex->wcond);
+    free(ex->workers);
+    free(ex);
+    return 0;
+}
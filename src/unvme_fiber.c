@@ -0,0 +1,311 @@
+/**
+ * Copyright (c) 2015-2016, Micron Technology, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the copyright holder nor the names of its
+ *      contributors may be used to endorse or promote products derived
+ *      from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @brief UNVMe fiber (user level thread) scheduler.
+ *
+ * A blocking call (e.g. unvme_read or unvme_apoll with a timeout) made from
+ * a fiber submits its I/O and parks the fiber instead of polling, and the
+ * scheduler switches to the next runnable fiber.  When no fiber is
+ * runnable, the scheduler polls the descriptors of the parked fibers and
+ * resumes those that have completed (or timed out), so many synchronous
+ * clients per thread keep a deep queue.
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+#include "rdtsc.h"
+#include "unvme_core.h"
+
+/// Scheduler running on the calling thread
+__thread unvme_fiber_sched_t* unvme_fsched = NULL;
+
+/**
+ * Switch stacks saving the callee saved registers and the floating point
+ * control words of the current context on its stack.
+ * @param   from        where to save the current stack pointer
+ * @param   to          stack pointer to switch to
+ */
+void unvme_fiber_switch(void** from, void* to);
+__asm__(
+    ".text\n"
+    ".globl unvme_fiber_switch\n"
+    ".hidden unvme_fiber_switch\n"
+    ".type unvme_fiber_switch, @function\n"
+    "unvme_fiber_switch:\n"
+    "    pushq %rbp\n"
+    "    pushq %rbx\n"
+    "    pushq %r12\n"
+    "    pushq %r13\n"
+    "    pushq %r14\n"
+    "    pushq %r15\n"
+    "    subq $8, %rsp\n"
+    "    stmxcsr (%rsp)\n"
+    "    fnstcw 4(%rsp)\n"
+    "    movq %rsp, (%rdi)\n"
+    "    movq %rsi, %rsp\n"
+    "    ldmxcsr (%rsp)\n"
+    "    fldcw 4(%rsp)\n"
+    "    addq $8, %rsp\n"
+    "    popq %r15\n"
+    "    popq %r14\n"
+    "    popq %r13\n"
+    "    popq %r12\n"
+    "    popq %rbx\n"
+    "    popq %rbp\n"
+    "    ret\n"
+    ".size unvme_fiber_switch, .-unvme_fiber_switch\n"
+);
+
+/**
+ * Fiber entry point to run the current fiber function and then return to
+ * the scheduler for good.
+ */
+static void unvme_fiber_entry(void)
+{
+    unvme_fiber_sched_t* fs = unvme_fsched;
+    unvme_fiber_t* f = fs->current;
+    f->fn(f->arg);
+    f->done = 1;
+    unvme_fiber_switch(&f->sp, fs->sp);
+    __builtin_unreachable();
+}
+
+/**
+ * Switch from the running fiber back to the scheduler.
+ * @param   fs          scheduler
+ * @param   f           running fiber
+ */
+static inline void unvme_fiber_park(unvme_fiber_sched_t* fs, unvme_fiber_t* f)
+{
+    unvme_fiber_switch(&f->sp, fs->sp);
+}
+
+/**
+ * Create a fiber scheduler.
+ * @param   stacksize   fiber stack size (0 for default)
+ * @return  the scheduler.
+ */
+unvme_fiber_sched_t* unvme_do_fiber_sched_create(int stacksize)
+{
+    unvme_fiber_sched_t* fs = zalloc(sizeof(unvme_fiber_sched_t));
+    size_t size = stacksize > 0 ? stacksize : UNVME_FIBER_STACK;
+    fs->stacksize = (size + 4095) & ~4095UL;
+    return fs;
+}
+
+/**
+ * Destroy a fiber scheduler (with no live fibers).
+ * @param   fs          scheduler
+ * @return  0 if ok else -1.
+ */
+int unvme_do_fiber_sched_destroy(unvme_fiber_sched_t* fs)
+{
+    if (fs->count) {
+        ERROR("%d fibers are still live", fs->count);
+        return -1;
+    }
+    unvme_fiber_t* f;
+    while ((f = fs->freeq) != NULL) {
+        LIST_DEL(fs->freeq, f);
+        munmap(f->stack, fs->stacksize + 4096);
+        free(f);
+    }
+    free(fs);
+    return 0;
+}
+
+/**
+ * Create a fiber to be run by a scheduler.
+ * @param   fs          scheduler
+ * @param   fn          fiber function
+ * @param   arg         fiber function argument
+ * @return  0 if ok else -1.
+ */
+int unvme_do_fiber_create(unvme_fiber_sched_t* fs, void (*fn)(void*), void* arg)
+{
+    unvme_fiber_t* f = fs->freeq;
+    if (f) {
+        LIST_DEL(fs->freeq, f);
+    } else {
+        f = zalloc(sizeof(unvme_fiber_t));
+        // stack with a guard page below it
+        f->stack = mmap(NULL, fs->stacksize + 4096, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+        if (f->stack == MAP_FAILED) {
+            ERROR("mmap: %s", strerror(errno));
+            free(f);
+            return -1;
+        }
+        if (mprotect(f->stack, 4096, PROT_NONE)) {
+            ERROR("mprotect: %s", strerror(errno));
+            munmap(f->stack, fs->stacksize + 4096);
+            free(f);
+            return -1;
+        }
+    }
+    f->fn = fn;
+    f->arg = arg;
+    f->done = 0;
+    f->desc = NULL;
+
+    // initial frame popped by unvme_fiber_switch to return into the entry:
+    // control words, r15, r14, r13, r12, rbx, rbp, entry, dummy return
+    u64* sp = (u64*)((char*)f->stack + 4096 + fs->stacksize) - 9;
+    memset(sp, 0, 9 * sizeof(u64));
+    ((u32*)sp)[0] = 0x1f80;     // default MXCSR
+    ((u16*)sp)[2] = 0x037f;     // default x87 control word
+    sp[7] = (u64)unvme_fiber_entry;
+    f->sp = sp;
+
+    LIST_ADD(fs->runq, f);
+    fs->nrun++;
+    fs->count++;
+    return 0;
+}
+
+/**
+ * Park the calling fiber until an I/O descriptor completes (called by
+ * unvme_do_poll with a timeout from within a fiber).  The descriptor is
+ * released upon completion as unvme_do_poll does.
+ * @param   desc        I/O descriptor
+ * @param   timeout     in seconds
+ * @param   cqe_cs      CQE command specific DW0 returned
+ * @return  0 if ok else error status (-1 means timeout).
+ */
+int unvme_fiber_poll(unvme_desc_t* desc, int timeout, u32* cqe_cs)
+{
+    unvme_fiber_sched_t* fs = unvme_fsched;
+    unvme_fiber_t* f = fs->current;
+    f->desc = desc;
+    f->cqe_cs = cqe_cs;
+    f->deadline = rdtsc() + timeout * desc->q->nvmeq->dev->rdtsec;
+    LIST_ADD(fs->waitq, f);
+    unvme_fiber_park(fs, f);
+    return f->err;
+}
+
+/**
+ * Yield the calling fiber to the other runnable fibers (no-op if not
+ * called from a fiber).
+ */
+void unvme_do_fiber_yield(void)
+{
+    if (!unvme_in_fiber()) return;
+    unvme_fiber_sched_t* fs = unvme_fsched;
+    unvme_fiber_t* f = fs->current;
+    LIST_ADD(fs->runq, f);
+    fs->nrun++;
+    unvme_fiber_park(fs, f);
+}
+
+/**
+ * Resume the parked fibers whose descriptors have completed or timed out.
+ * @param   fs          scheduler
+ * @return  number of fibers resumed.
+ */
+static int unvme_fiber_wake(unvme_fiber_sched_t* fs)
+{
+    unvme_fiber_t* f = fs->waitq;
+    int i, n = 0, count = 0;
+    if (!f) return 0;
+    do {
+        count++;
+        f = f->next;
+    } while (f != fs->waitq);
+
+    u64 now = 0;
+    for (i = 0; i < count; i++) {
+        unvme_fiber_t* next = f->next;
+        // a non-blocking poll reaps the queue completions as needed
+        int err = unvme_do_poll(f->desc, 0, f->cqe_cs);
+        if (err == -1) {
+            if (!now) now = rdtsc();
+            if (now < f->deadline) {
+                f = next;
+                continue;
+            }
+        }
+        f->err = err;
+        f->desc = NULL;
+        LIST_DEL(fs->waitq, f);
+        LIST_ADD(fs->runq, f);
+        fs->nrun++;
+        n++;
+        f = next;
+    }
+    return n;
+}
+
+/**
+ * Run the fibers of a scheduler on the calling thread until they all exit.
+ * @param   fs          scheduler
+ * @return  0 if ok else -1.
+ */
+int unvme_do_fiber_run(unvme_fiber_sched_t* fs)
+{
+    if (unvme_fsched) {
+        ERROR("a fiber scheduler is already running");
+        return -1;
+    }
+    unvme_fsched = fs;
+    int idle = 0;
+    while (fs->count) {
+        // run a round of the runnable fibers
+        int n = fs->nrun;
+        while (n--) {
+            unvme_fiber_t* f = fs->runq;
+            LIST_DEL(fs->runq, f);
+            fs->nrun--;
+            fs->current = f;
+            unvme_fiber_switch(&fs->sp, f->sp);
+            fs->current = NULL;
+            if (f->done) {
+                fs->count--;
+                LIST_ADD(fs->freeq, f);
+            }
+        }
+
+        if (unvme_fiber_wake(fs) || fs->nrun) {
+            idle = 0;
+        } else if (++idle < 64) {
+            __builtin_ia32_pause();
+        } else {
+            sched_yield();
+        }
+    }
+    unvme_fsched = NULL;
+    return 0;
+}
@@ -13,7 +13,6 @@
 
 #define NR_HUGEPAGE_PATH					\
     "/sys/kernel/mm/hugepages/hugepages-2048kB/nr_hugepages"
-#define HUGEPAGE_SIZE 2 * 1024 * 1024	/* 2048kB */
 
 static hugetlb_ctx hctx;
 
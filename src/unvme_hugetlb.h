@@ -6,6 +6,8 @@
 #include "unvme.h"
 #include "unvme_vfio.h"
 
+#define HUGEPAGE_SIZE (2 * 1024 * 1024)	/* 2048kB */
+
 typedef struct _hugetlb_ctx {
     int		size;		///< number of hugepages
     int		assigned;	///< number of assigned hugepages
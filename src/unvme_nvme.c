@@ -37,6 +37,8 @@
 #include <sys/mman.h>
 #include <string.h>
 #include <errno.h>
+#include <cpuid.h>
+#include <immintrin.h>
 
 #include "rdtsc.h"
 #include "unvme_log.h"
@@ -73,6 +75,113 @@ static inline void w64(nvme_device_t* dev, u64* addr, u64 val)
 
 /// @endcond
 
+/// Submission queue entry store method in use
+static int nvme_sqe_method = NVME_SQE_STORE_SCALAR;
+
+
+/**
+ * Store a submission queue entry with 32-byte vector stores.
+ * @param   d           submission queue entry (64-byte aligned)
+ * @param   v0          entry bytes 0-15
+ * @param   v1          entry bytes 16-31
+ * @param   v2          entry bytes 32-47
+ * @param   v3          entry bytes 48-63
+ */
+__attribute__((target("avx")))
+static inline void nvme_sqe_store_avx(__m128i* d, __m128i v0, __m128i v1,
+                                      __m128i v2, __m128i v3)
+{
+    _mm256_store_si256((__m256i*)d, _mm256_set_m128i(v1, v0));
+    _mm256_store_si256((__m256i*)d + 1, _mm256_set_m128i(v3, v2));
+}
+
+/**
+ * Store a submission queue entry with a single 64-byte direct store.
+ * @param   d           submission queue entry (64-byte aligned)
+ * @param   v0          entry bytes 0-15
+ * @param   v1          entry bytes 16-31
+ * @param   v2          entry bytes 32-47
+ * @param   v3          entry bytes 48-63
+ */
+__attribute__((noinline))
+static void nvme_sqe_store_movdir64b(__m128i* d, __m128i v0, __m128i v1,
+                                     __m128i v2, __m128i v3)
+{
+    __m128i sqe[4] __attribute__((aligned(64))) = { v0, v1, v2, v3 };
+    asm volatile ("movdir64b (%1), %0" : : "r" (d), "r" (sqe) : "memory");
+}
+
+/**
+ * Store a submission queue entry with vector stores of the selected method.
+ * @param   d           submission queue entry (64-byte aligned)
+ * @param   v0          entry bytes 0-15
+ * @param   v1          entry bytes 16-31
+ * @param   v2          entry bytes 32-47
+ * @param   v3          entry bytes 48-63
+ */
+__attribute__((noinline))
+static void nvme_sqe_store_vector(__m128i* d, __m128i v0, __m128i v1,
+                                  __m128i v2, __m128i v3)
+{
+    switch (nvme_sqe_method) {
+    case NVME_SQE_STORE_MOVDIR64B:
+        nvme_sqe_store_movdir64b(d, v0, v1, v2, v3);
+        break;
+    case NVME_SQE_STORE_AVX:
+        nvme_sqe_store_avx(d, v0, v1, v2, v3);
+        break;
+    default:
+        _mm_store_si128(d, v0);
+        _mm_store_si128(d + 1, v1);
+        _mm_store_si128(d + 2, v2);
+        _mm_store_si128(d + 3, v3);
+        break;
+    }
+}
+
+/**
+ * Store a read/write submission queue entry at the queue tail from its
+ * nonzero 64-bit words.  The entry is written with plain 8-byte stores,
+ * unless a vector store method has been selected (e.g. for device memory
+ * queues), which is then done out of line.
+ * @param   q           queue
+ * @param   cdw0_1      command dword 0 (opc, psdt, cid) and 1 (nsid)
+ * @param   dptr0       data pointer first word (PRP1 or SGL address)
+ * @param   dptr1       data pointer second word (PRP2 or SGL length/type)
+ * @param   slba        starting lba (cdw 10-11)
+ * @param   cdw12       command dword 12 (nlb and control)
+ */
+static inline void nvme_sqe_store_rw(nvme_queue_t* q, u64 cdw0_1,
+                                     u64 dptr0, u64 dptr1, u64 slba, u64 cdw12)
+{
+    if (__builtin_expect(nvme_sqe_method != NVME_SQE_STORE_SCALAR, 0)) {
+        nvme_sqe_store_vector((__m128i*)&q->sq[q->sq_tail],
+                              _mm_set_epi64x(0, cdw0_1), _mm_set_epi64x(dptr0, 0),
+                              _mm_set_epi64x(slba, dptr1), _mm_set_epi64x(0, cdw12));
+        return;
+    }
+    u64* d = (u64*)&q->sq[q->sq_tail];
+    d[0] = cdw0_1;
+    d[1] = 0;
+    d[2] = 0;
+    d[3] = dptr0;
+    d[4] = dptr1;
+    d[5] = slba;
+    d[6] = cdw12;
+    d[7] = 0;
+}
+
+/**
+ * Write the submission queue tail doorbell.  Weakly ordered direct stores
+ * must be fenced before the doorbell write.
+ * @param   q           queue
+ */
+static inline void nvme_sq_doorbell(nvme_queue_t* q)
+{
+    if (nvme_sqe_method == NVME_SQE_STORE_MOVDIR64B) _mm_sfence();
+    w32(q->dev, q->sq_doorbell, q->sq_tail);
+}
+
 
 /**
  * Wait for controller enabled/disabled state.
@@ -125,6 +234,7 @@ static int nvme_ctlr_enable(nvme_device_t* dev, nvme_controller_config_t cc)
 
 /**
  * Submit an entry at submission queue tail.
+ * If the queue is plugged, the doorbell write is deferred until flushed.
  * @param   q           queue
  * @return  0 if ok else -1.
  */
@@ -142,18 +252,57 @@ static int nvme_submit_cmd(nvme_queue_t* q)
     }
 #endif
     q->sq_tail = tail;
-    w32(q->dev, q->sq_doorbell, tail);
+    if (q->sq_plug) {
+        q->sq_pending++;
+        return 0;
+    }
+    nvme_sq_doorbell(q);
     return 0;
 }
 
 /**
- * Check a completion queue and return the completed command id and status.
+ * Write the submission queue tail doorbell if there are pending entries.
+ * @param   q           queue
+ */
+void nvme_sq_flush(nvme_queue_t* q)
+{
+    if (q->sq_pending) {
+        DEBUG_FN("q=%d sq=%d-%d n=%d", q->id, q->sq_head, q->sq_tail, q->sq_pending);
+        q->sq_pending = 0;
+        nvme_sq_doorbell(q);
+    }
+}
+
+/**
+ * Plug a submission queue so that subsequent submissions are accumulated
+ * and published with a single doorbell write upon unplug or flush.
+ * @param   q           queue
+ */
+void nvme_sq_plug(nvme_queue_t* q)
+{
+    q->sq_plug = 1;
+}
+
+/**
+ * Unplug a submission queue and write the doorbell for pending entries.
+ * @param   q           queue
+ */
+void nvme_sq_unplug(nvme_queue_t* q)
+{
+    q->sq_plug = 0;
+    nvme_sq_flush(q);
+}
+
+/**
+ * Consume a completion queue entry without updating the head doorbell
+ * and return the completed command id and status.  The caller is to
+ * invoke nvme_cq_flush() after consuming a batch of entries.
  * @param   q           queue
  * @param   stat        completion status returned
  * @param   cqe_cs      CQE command specific DW0 returned
  * @return  the completed command id or -1 if there's no completion.
  */
-int nvme_check_completion(nvme_queue_t* q, int* stat, u32* cqe_cs)
+int nvme_reap_completion(nvme_queue_t* q, int* stat, u32* cqe_cs)
 {
     *stat = 0;
     nvme_cq_entry_t* cqe = &q->cq[q->cq_head];
@@ -165,7 +314,7 @@ int nvme_check_completion(nvme_queue_t* q, int* stat, u32* cqe_cs)
         q->cq_phase = !q->cq_phase;
     }
     if (cqe_cs) *cqe_cs = cqe->cs;
-    w32(q->dev, q->cq_doorbell, q->cq_head);
+    q->cq_pending++;
 
 #if 0
     // Some SSD does not advance sq_head properly (e.g. Intel DC D3600)
@@ -183,6 +332,60 @@ int nvme_check_completion(nvme_queue_t* q, int* stat, u32* cqe_cs)
     return cqe->cid;
 }
 
+/**
+ * Write the completion queue head doorbell if there are consumed entries.
+ * @param   q           queue
+ */
+void nvme_cq_flush(nvme_queue_t* q)
+{
+    if (q->cq_pending) {
+        q->cq_pending = 0;
+        w32(q->dev, q->cq_doorbell, q->cq_head);
+    }
+}
+
+/**
+ * Check if the CPU supports waiting on a completion queue entry with
+ * UMONITOR/UMWAIT (see nvme_cq_umwait).
+ * @return  1 if supported else 0.
+ */
+int nvme_cq_umwait_supported(void)
+{
+    u32 eax, ebx, ecx, edx;
+    return __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) &&
+           (ecx & bit_WAITPKG);
+}
+
+/**
+ * Wait in a light power state for the next completion queue entry to be
+ * posted (or the deadline) by monitoring its cache line with UMONITOR
+ * and UMWAIT.  The wait may also end early (e.g. by the OS time limit),
+ * so the caller is to check the completion queue upon return.
+ * @param   q           queue
+ * @param   endtsc      wait deadline (in rdtsc)
+ */
+__attribute__((target("waitpkg")))
+void nvme_cq_umwait(nvme_queue_t* q, u64 endtsc)
+{
+    volatile nvme_cq_entry_t* cqe = &q->cq[q->cq_head];
+    _umonitor((void*)cqe);
+    if (cqe->p == q->cq_phase) _umwait(1, endtsc);
+}
+
+/**
+ * Check a completion queue and return the completed command id and status.
+ * @param   q           queue
+ * @param   stat        completion status returned
+ * @param   cqe_cs      CQE command specific DW0 returned
+ * @return  the completed command id or -1 if there's no completion.
+ */
+int nvme_check_completion(nvme_queue_t* q, int* stat, u32* cqe_cs)
+{
+    int cid = nvme_reap_completion(q, stat, cqe_cs);
+    if (cid >= 0) nvme_cq_flush(q);
+    return cid;
+}
+
 /**
  * Wait for a given command completion until timeout.
  * @param   q           queue
@@ -364,6 +567,10 @@ int nvme_acmd_create_cq(nvme_queue_t* ioq, u64 prp)
     cmd->pc = 1;
     cmd->qid = ioq->id;
     cmd->qsize = ioq->size - 1;
+    if (ioq->iv >= 0) {
+        cmd->ien = 1;
+        cmd->iv = ioq->iv;
+    }
 
     DEBUG_FN("sq=%d-%d cid=%#x cq=%d qs=%d", adminq->sq_head, adminq->sq_tail, cid, ioq->id, ioq->size);
     int err = nvme_submit_cmd(adminq);
@@ -490,22 +697,66 @@ int nvme_cmd_vs(nvme_queue_t* q, int opc, u16 cid, int nsid,
 int nvme_cmd_rw(nvme_queue_t* ioq, int opc, u16 cid, int nsid,
                 u64 slba, int nlb, u64 prp1, u64 prp2)
 {
-    nvme_command_rw_t* cmd = &ioq->sq[ioq->sq_tail].rw;
-
-    memset(cmd, 0, sizeof (*cmd));
-    cmd->common.opc = opc;
-    cmd->common.cid = cid;
-    cmd->common.nsid = nsid;
-    cmd->common.prp1 = prp1;
-    cmd->common.prp2 = prp2;
-    cmd->slba = slba;
-    cmd->nlb = nlb - 1;
+    nvme_sqe_store_rw(ioq, opc | ((u32)cid << 16) | ((u64)(u32)nsid << 32),
+                      prp1, prp2, slba, (u16)(nlb - 1));
     DEBUG_FN("q=%d sq=%d-%d cid=%#x nsid=%d lba=%#lx nb=%#x prp=%#lx.%#lx (%c)",
              ioq->id, ioq->sq_head, ioq->sq_tail, cid, nsid, slba, nlb, prp1, prp2,
              opc == NVME_CMD_READ? 'R' : 'W');
     return nvme_submit_cmd(ioq);
 }
 
+/**
+ * NVMe submit a read/write command with an SGL data descriptor.
+ * @param   ioq         io queue
+ * @param   opc         op code
+ * @param   cid         command id
+ * @param   nsid        namespace
+ * @param   slba        startling logical block address
+ * @param   nlb         number of logical blocks
+ * @param   sgl         SGL entry 1 (data block or last segment descriptor)
+ * @return  0 if ok else -1.
+ */
+int nvme_cmd_rw_sgl(nvme_queue_t* ioq, int opc, u16 cid, int nsid,
+                    u64 slba, int nlb, const nvme_sgl_desc_t* sgl)
+{
+    u64 dptr[2];
+    memcpy(dptr, sgl, sizeof(dptr));
+    nvme_sqe_store_rw(ioq, opc | (NVME_PSDT_SGL_MPTR_CONTIG << 14) |
+                           ((u32)cid << 16) | ((u64)(u32)nsid << 32),
+                      dptr[0], dptr[1], slba, (u16)(nlb - 1));
+    DEBUG_FN("q=%d sq=%d-%d cid=%#x nsid=%d lba=%#lx nb=%#x sgl=%d.%#lx.%#x (%c)",
+             ioq->id, ioq->sq_head, ioq->sq_tail, cid, nsid, slba, nlb,
+             sgl->type, sgl->addr, sgl->length,
+             opc == NVME_CMD_READ? 'R' : 'W');
+    return nvme_submit_cmd(ioq);
+}
+
+/**
+ * Select the submission queue entry store method used by the read/write
+ * command submissions.
+ * @param   method      store method (-1 to select the default)
+ * @return  the selected method or -1 if not supported by the CPU.
+ */
+int nvme_sqe_store_select(int method)
+{
+    u32 eax, ebx, ecx, edx;
+    int movdir64b = __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) &&
+                    (ecx & bit_MOVDIR64B);
+    int avx = __builtin_cpu_supports("avx");
+
+    // for host memory queues, the vector stores are no faster than plain
+    // stores and MOVDIR64B (bypassing the cache) is much slower, so they are
+    // only used when explicitly selected (e.g. for device memory queues)
+    if (method < 0) method = NVME_SQE_STORE_SCALAR;
+    if ((method == NVME_SQE_STORE_MOVDIR64B && !movdir64b) ||
+        (method == NVME_SQE_STORE_AVX && !avx) ||
+        method > NVME_SQE_STORE_MOVDIR64B) return -1;
+
+    DEBUG_FN("%d", method);
+    nvme_sqe_method = method;
+    return method;
+}
+
 /**
  * NVMe submit a read command.
  * @param   ioq         io queue
@@ -550,10 +801,12 @@ int nvme_cmd_write(nvme_queue_t* ioq, u16 cid, int nsid,
  * @param   sqpa        submission queue IO physical address
  * @param   cqbuf       completion queue buffer
  * @param   cqpa        admin completion IO physical address
+ * @param   iv          MSIX interrupt vector (-1 for polled completion)
  * @return  pointer to the created io queue or NULL if failure.
  */
 nvme_queue_t* nvme_ioq_create(nvme_device_t* dev, nvme_queue_t* ioq,
-            int id, int qsize, void* sqbuf, u64 sqpa, void* cqbuf, u64 cqpa)
+            int id, int qsize, void* sqbuf, u64 sqpa, void* cqbuf, u64 cqpa,
+            int iv)
 {
     if (!ioq) ioq = zalloc(sizeof(*ioq));
     else ioq->ext = 1;
@@ -563,6 +816,7 @@ nvme_queue_t* nvme_ioq_create(nvme_device_t* dev, nvme_queue_t* ioq,
     ioq->size = qsize;
     ioq->sq = sqbuf;
     ioq->cq = cqbuf;
+    ioq->iv = iv;
     ioq->sq_doorbell = dev->reg->sq0tdbl + (2 * id * dev->dbstride);
     ioq->cq_doorbell = ioq->sq_doorbell + dev->dbstride;
 
@@ -664,6 +918,7 @@ nvme_device_t* nvme_create(nvme_device_t* dev, int mapfd)
 
     dev->cmbloc.val = r32(dev, &dev->reg->cmbloc.val);
     dev->cmbsz.val = r32(dev, &dev->reg->cmbsz.val);
+    (void)nvme_sqe_store_select(-1);
 
     DEBUG_FN("cap=%#lx mps=%u-%u to=%u maxqs=%u dbs=%u cmbloc=%#x cmbsz=%#x",
              cap.val, cap.mpsmin, cap.mpsmax, cap.to, dev->maxqsize,
@@ -85,6 +85,41 @@ enum {
     NVME_ACMD_FW_DOWNLOAD   = 0x11,     ///< firmware image download
 };
 
+/// NVMe SGL descriptor types
+enum {
+    NVME_SGL_DATA_BLOCK     = 0x0,      ///< data block
+    NVME_SGL_BIT_BUCKET     = 0x1,      ///< bit bucket
+    NVME_SGL_SEGMENT        = 0x2,      ///< segment
+    NVME_SGL_LAST_SEGMENT   = 0x3,      ///< last segment
+};
+
+/// NVMe PRP or SGL for data transfer (PSDT)
+enum {
+    NVME_PSDT_PRP           = 0x0,      ///< PRP
+    NVME_PSDT_SGL_MPTR_CONTIG = 0x1,    ///< SGL with contiguous metadata buffer
+    NVME_PSDT_SGL_MPTR_SGL  = 0x2,      ///< SGL with metadata SGL descriptor
+};
+
+/// NVMe identify controller SGL support (sgls) fields
+enum {
+    NVME_SGLS_SUPPORT       = 0x3,      ///< SGL support mask (0 if none)
+    NVME_SGLS_DWORD_ALIGN   = 0x2,      ///< SGL data block dword alignment
+    NVME_SGLS_BIT_BUCKET    = 0x10000,  ///< SGL bit bucket support
+};
+
+/// NVMe identify namespace features (nsfeat) fields
+enum {
+    NVME_NSFEAT_OPTPERF     = 0x10,     ///< NPWG, NPWA, NPDG, NPDA and NOWS valid
+};
+
+/// Submission queue entry store methods
+enum {
+    NVME_SQE_STORE_SCALAR   = 0,        ///< 8-byte stores
+    NVME_SQE_STORE_SSE      = 1,        ///< 16-byte vector stores
+    NVME_SQE_STORE_AVX      = 2,        ///< 32-byte vector stores
+    NVME_SQE_STORE_MOVDIR64B = 3,       ///< 64-byte direct store
+};
+
 /// NVMe feature identifiers
 enum {
     NVME_FEATURE_ARBITRATION = 0x1,     ///< arbitration
@@ -210,17 +245,32 @@ typedef struct _nvme_controller_reg {
     u32                     sq0tdbl[1024]; ///< sq0 tail doorbell at 0x1000
 } nvme_controller_reg_t;
 
+/// SGL descriptor
+typedef struct _nvme_sgl_desc {
+    u64                     addr;       ///< address
+    u32                     length;     ///< length
+    u8                      rsvd[3];    ///< reserved
+    u8                      subtype : 4; ///< descriptor sub type
+    u8                      type : 4;   ///< descriptor type
+} nvme_sgl_desc_t;
+
 /// Common command header (cdw 0-9)
 typedef struct _nvme_command_common {
     u8                      opc;        ///< opcode
     u8                      fuse : 2;   ///< fuse
-    u8                      rsvd : 6;   ///< reserved
+    u8                      rsvd : 4;   ///< reserved
+    u8                      psdt : 2;   ///< PRP or SGL for data transfer
     u16                     cid;        ///< command id
     u32                     nsid;       ///< namespace id
     u64                     cdw2_3;     ///< reserved (cdw 2-3)
     u64                     mptr;       ///< metadata pointer
-    u64                     prp1;       ///< PRP entry 1
-    u64                     prp2;       ///< PRP entry 2
+    union {
+        struct {
+            u64             prp1;       ///< PRP entry 1
+            u64             prp2;       ///< PRP entry 2
+        };
+        nvme_sgl_desc_t     sgl1;       ///< SGL entry 1
+    };
 } nvme_command_common_t;
 
 /// NVMe command:  Read & Write
@@ -341,7 +391,9 @@ typedef struct _nvme_identify_ctlr {
     u16                     awun;       ///< atomic write unit normal
     u16                     awupf;      ///< atomic write unit power fail
     u8                      nvscc;      ///< NVM vendor specific config
-    u8                      rsvd531[173]; ///< reserved (531-703)
+    u8                      rsvd531[5]; ///< reserved (531-535)
+    u32                     sgls;       ///< SGL support
+    u8                      rsvd540[164]; ///< reserved (540-703)
     u8                      rsvd704[1344]; ///< reserved (704-2047)
     u8                      psd[1024];  ///< power state 0-31 descriptors
     u8                      vs[1024];   ///< vendor specific
@@ -366,7 +418,24 @@ typedef struct _nvme_identify_ns {
     u8                      mc;         ///< metadata capabilities
     u8                      dpc;        ///< data protection capabilities
     u8                      dps;        ///< data protection settings
-    u8                      rsvd30[98]; ///< reserved (30-127)
+    u8                      nmic;       ///< multi-path I/O and sharing capabilities
+    u8                      rescap;     ///< reservation capabilities
+    u8                      fpi;        ///< format progress indicator
+    u8                      dlfeat;     ///< deallocate logical block features
+    u16                     nawun;      ///< atomic write unit normal
+    u16                     nawupf;     ///< atomic write unit power fail
+    u16                     nacwu;      ///< atomic compare & write unit
+    u16                     nabsn;      ///< atomic boundary size normal
+    u16                     nabo;       ///< atomic boundary offset
+    u16                     nabspf;     ///< atomic boundary size power fail
+    u16                     noiob;      ///< optimal I/O boundary (0 if none)
+    u64                     nvmcap[2];  ///< NVM capacity
+    u16                     npwg;       ///< preferred write granularity (0's based)
+    u16                     npwa;       ///< preferred write alignment (0's based)
+    u16                     npdg;       ///< preferred deallocate granularity (0's based)
+    u16                     npda;       ///< preferred deallocate alignment (0's based)
+    u16                     nows;       ///< optimal write size (0's based)
+    u8                      rsvd74[54]; ///< reserved (74-127)
     nvme_lba_format_t       lbaf[16];   ///< lba format support
     u8                      rsvd192[192]; ///< reserved (383-192)
     u8                      vs[3712];   ///< vendor specific
@@ -566,6 +635,10 @@ typedef struct _nvme_queue {
     int                     cq_head;    ///< completion queue head
     u16                     cq_phase;   ///< completion queue phase bit
     u16                     ext;        ///< externally allocated flag
+    int                     sq_plug;    ///< defer sq doorbell (plugged) flag
+    int                     sq_pending; ///< submitted entries pending doorbell
+    int                     cq_pending; ///< consumed entries pending doorbell
+    int                     iv;         ///< interrupt vector (-1 if disabled)
 } nvme_queue_t;
 
 /// Device context
@@ -586,12 +659,49 @@ typedef struct _nvme_device {
 } nvme_device_t;
 
 
+/// PRP list vector of 2 entries
+typedef u64 nvme_prp2_t __attribute__((vector_size(16)));
+
+/**
+ * Fill a PRP list with consecutive page addresses (4 entries at a time).
+ * @param   prplist     PRP list entries
+ * @param   addr        first page address
+ * @param   pagesize    page size
+ * @param   count       number of entries
+ */
+static inline void nvme_prp_fill(u64* prplist, u64 addr, u64 pagesize, int count)
+{
+    nvme_prp2_t v0 = { addr, addr + pagesize };
+    nvme_prp2_t v1 = { addr + 2 * pagesize, addr + 3 * pagesize };
+    nvme_prp2_t step = { 4 * pagesize, 4 * pagesize };
+    int i;
+    for (i = 0; (i + 4) <= count; i += 4) {
+        __builtin_memcpy(prplist + i, &v0, sizeof(v0));
+        __builtin_memcpy(prplist + i + 2, &v1, sizeof(v1));
+        v0 += step;
+        v1 += step;
+    }
+    for (; i < count; i++) prplist[i] = addr + (u64)i * pagesize;
+}
+
+/**
+ * Check if the next completion queue entry has been posted (without
+ * consuming it).
+ * @param   q           queue
+ * @return  1 if a completion is ready else 0.
+ */
+static inline int nvme_cq_ready(const nvme_queue_t* q)
+{
+    const volatile nvme_cq_entry_t* cqe = q->cq + q->cq_head;
+    return cqe->p != q->cq_phase;
+}
+
 // Export functions
 nvme_device_t* nvme_create(nvme_device_t* dev, int mapfd);
 void nvme_delete(nvme_device_t* dev);
 
 nvme_queue_t* nvme_adminq_setup(nvme_device_t* dev, int qsize, void* sqbuf, u64 sqpa, void* cqbuf, u64 cqpa);
-nvme_queue_t* nvme_ioq_create(nvme_device_t* dev, nvme_queue_t* ioq, int id, int qsize, void* sqbuf, u64 sqpa, void* cqbuf, u64 cqpa);
+nvme_queue_t* nvme_ioq_create(nvme_device_t* dev, nvme_queue_t* ioq, int id, int qsize, void* sqbuf, u64 sqpa, void* cqbuf, u64 cqpa, int iv);
 int nvme_ioq_delete(nvme_queue_t* ioq);
 
 int nvme_acmd_identify(nvme_device_t* dev, int nsid, u64 prp1, u64 prp2);
@@ -605,10 +715,20 @@ int nvme_acmd_delete_sq(nvme_queue_t* ioq);
 
 int nvme_cmd_vs(nvme_queue_t* q, int opc, u16 cid, int nsid, u64 prp1, u64 prp2, u32 cdw10_15[6]);
 int nvme_cmd_rw(nvme_queue_t* ioq, int opc, u16 cid, int nsid, u64 slba, int nlb, u64 prp1, u64 prp2);
+int nvme_cmd_rw_sgl(nvme_queue_t* ioq, int opc, u16 cid, int nsid, u64 slba, int nlb, const nvme_sgl_desc_t* sgl);
+int nvme_sqe_store_select(int method);
 int nvme_cmd_read(nvme_queue_t* ioq, u16 cid, int nsid, u64 slba, int nlb, u64 prp1, u64 prp2);
 int nvme_cmd_write(nvme_queue_t* ioq, u16 cid, int nsid, u64 slba, int nlb, u64 prp1, u64 prp2);
 
+void nvme_sq_plug(nvme_queue_t* q);
+void nvme_sq_unplug(nvme_queue_t* q);
+void nvme_sq_flush(nvme_queue_t* q);
+
 int nvme_check_completion(nvme_queue_t* q, int* stat, u32* cqe_cs);
+int nvme_reap_completion(nvme_queue_t* q, int* stat, u32* cqe_cs);
+void nvme_cq_flush(nvme_queue_t* q);
+int nvme_cq_umwait_supported(void);
+void nvme_cq_umwait(nvme_queue_t* q, u64 endtsc);
 int nvme_wait_completion(nvme_queue_t* q, int cid, int timeout);
 
 __END_DECLS
@@ -85,7 +85,8 @@ static void vfio_write(vfio_device_t* dev, void* buf, size_t len, off_t off)
 }
 
 /**
- * Allocate VFIO memory.  The size will be rounded to page aligned size.
+ * Allocate VFIO memory.  The size will be rounded to page aligned size
+ * and the IO address aligned to the device DMA alignment (with IOMMU).
  * If pmb is set, it indicates memory has been premapped.
  * @param   dev         device context
  * @param   size        size
@@ -113,6 +114,7 @@ static vfio_mem_t* vfio_mem_alloc(vfio_device_t* dev, size_t size, void* pmb)
 
     pthread_mutex_lock(&dev->lock);
     if (!dev->noiommu) {
+	dev->iovanext = (dev->iovanext + dev->dmaalign - 1) & ~(dev->dmaalign - 1);
 
 	struct vfio_iommu_type1_dma_map map = {
 	    .argsz = sizeof(map),
@@ -344,6 +346,7 @@ vfio_device_t* vfio_create(vfio_device_t* dev, int pci, int noiommu)
     dev->iovabase = VFIO_IOVA;
     dev->iovanext = dev->iovabase;
     dev->noiommu  = noiommu;
+    dev->dmaalign = dev->pagesize;
     if (pthread_mutex_init(&dev->lock, 0)) return NULL;
 
     // map vfio context
@@ -438,10 +441,14 @@ vfio_device_t* vfio_create(vfio_device_t* dev, int pci, int noiommu)
             FATAL("VFIO_DEVICE_GET_IRQ_INFO MSIX count %d != %d", irq.count, dev->msixsize);
     }
 
+    // each buffer is a whole hugepage without IOMMU, while IO addresses
+    // are assigned (thus may be aligned as needed) with IOMMU
     if (dev->noiommu) {
+	dev->maxalign = HUGEPAGE_SIZE;
 	hugetlb_init();
 	return (vfio_device_t *)dev;
     }
+    dev->maxalign = (__u64)1 << 30;
 
 #ifdef  UNVME_IDENTITY_MAP_DMA
     // Set up mask to support identity IOVA map option
@@ -471,6 +478,7 @@ vfio_device_t* vfio_create(vfio_device_t* dev, int pci, int noiommu)
         map.iova <<= 1;
     }
     dev->iovamask = map.iova - 1;
+    dev->maxalign = dev->pagesize;
     (void) munmap((void*)map.vaddr, map.size);
     DEBUG_FN("iovamask=%#llx", dev->iovamask);
 #endif
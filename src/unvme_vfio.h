@@ -75,6 +75,8 @@ typedef struct _vfio_device {
     __u64                   iovabase;   ///< IO virtual address base
     __u64                   iovanext;   ///< next IO virtual address to use
     __u64                   iovamask;   ///< max IO virtual address mask
+    __u64                   dmaalign;   ///< DMA buffer IO address alignment
+    __u64                   maxalign;   ///< max DMA buffer alignment supported
     pthread_mutex_t         lock;       ///< multithreaded lock
     vfio_mem_t*             memlist;    ///< memory allocated list
 } vfio_device_t;
@@ -0,0 +1,191 @@
+/**
+ * Copyright (c) 2015-2016, Micron Technology, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the copyright holder nor the names of its
+ *      contributors may be used to endorse or promote products derived
+ *      from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @brief NVMe submission path microbenchmark against a host memory queue.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <err.h>
+
+#include "rdtsc.h"
+#include "unvme_nvme.h"
+
+/// Submission benchmark methods
+static const char* methods[] = { "scalar", "SSE", "AVX", "MOVDIR64B" };
+
+
+/**
+ * Legacy read/write submission writing the entry in place field by field
+ * (reference for comparison).
+ */
+__attribute__((noinline))
+static int legacy_cmd_rw(nvme_queue_t* q, int opc, u16 cid, int nsid,
+                         u64 slba, int nlb, u64 prp1, u64 prp2)
+{
+    nvme_command_rw_t* cmd = &q->sq[q->sq_tail].rw;
+
+    memset(cmd, 0, sizeof (*cmd));
+    cmd->common.opc = opc;
+    cmd->common.cid = cid;
+    cmd->common.nsid = nsid;
+    cmd->common.prp1 = prp1;
+    cmd->common.prp2 = prp2;
+    cmd->slba = slba;
+    cmd->nlb = nlb - 1;
+
+    if (++q->sq_tail == q->size) q->sq_tail = 0;
+    *q->sq_doorbell = q->sq_tail;
+    return 0;
+}
+
+/**
+ * Legacy PRP list fill one entry at a time (reference for comparison).
+ */
+__attribute__((noinline))
+static void legacy_prp_fill(u64* prplist, u64 addr, u64 pagesize, int count)
+{
+    int i;
+    for (i = 0; i < count; i++) {
+        *prplist++ = addr;
+        addr += pagesize;
+    }
+}
+
+/**
+ * Run submissions and return the average cycles per submission.
+ */
+static double bench_submit(nvme_queue_t* q, int count, int legacy)
+{
+    int i;
+    u64 tsc = rdtsc();
+    for (i = 0; i < count; i++) {
+        u64 prp = (u64)i << 12;
+        if (legacy) legacy_cmd_rw(q, NVME_CMD_READ, i % q->size, 1, i, 8, prp, 0);
+        else nvme_cmd_rw(q, NVME_CMD_READ, i % q->size, 1, i, 8, prp, 0);
+    }
+    return (double)rdtsc_elapse(tsc) / count;
+}
+
+/**
+ * Fill PRP lists and return the average cycles per list.
+ */
+static double bench_prp(u64* prplist, int nent, int count, int legacy)
+{
+    int i;
+    u64 tsc = rdtsc();
+    for (i = 0; i < count; i++) {
+        u64 addr = (u64)i << 21;
+        if (legacy) legacy_prp_fill(prplist, addr, 4096, nent);
+        else nvme_prp_fill(prplist, addr, 4096, nent);
+        asm volatile ("" : : "r" (prplist) : "memory");
+    }
+    return (double)rdtsc_elapse(tsc) / count;
+}
+
+/**
+ * Main.
+ */
+int main(int argc, char** argv)
+{
+    const char* usage = "Usage: %s [OPTION]...\n\
+           -n COUNT   number of submissions (default 10000000)\n\
+           -q QSIZE   queue size (default 256)";
+
+    int opt, count = 10000000, qsize = 256;
+    const char* prog = strrchr(argv[0], '/');
+    prog = prog ? prog + 1 : argv[0];
+
+    while ((opt = getopt(argc, argv, "n:q:")) != -1) {
+        switch (opt) {
+        case 'n':
+            count = strtol(optarg, 0, 0);
+            if (count <= 0) errx(1, "n must be > 0");
+            break;
+        case 'q':
+            qsize = strtol(optarg, 0, 0);
+            if (qsize < 2) errx(1, "q must be > 1");
+            break;
+        default:
+            warnx(usage, prog);
+            exit(1);
+        }
+    }
+    if (optind != argc) {
+        warnx(usage, prog);
+        exit(1);
+    }
+
+    // setup a host memory queue with a host memory doorbell
+    u32 doorbell = 0;
+    nvme_device_t dev;
+    nvme_queue_t q;
+    memset(&dev, 0, sizeof(dev));
+    memset(&q, 0, sizeof(q));
+    q.dev = &dev;
+    q.id = 1;
+    q.size = qsize;
+    q.sq = aligned_alloc(4096, qsize * sizeof(nvme_sq_entry_t));
+    q.sq_doorbell = &doorbell;
+    if (!q.sq) errx(1, "aligned_alloc");
+    memset(q.sq, 0, qsize * sizeof(nvme_sq_entry_t));
+
+    // warm up the queue memory and the CPU frequency
+    bench_submit(&q, count, 1);
+
+    printf("SQE submission (qs=%d n=%d) cycles per submission:\n", qsize, count);
+    printf("  %-10s %8.2f\n", "legacy", bench_submit(&q, count, 1));
+    int m;
+    for (m = NVME_SQE_STORE_SCALAR; m <= NVME_SQE_STORE_MOVDIR64B; m++) {
+        if (nvme_sqe_store_select(m) != m) {
+            printf("  %-10s %8s\n", methods[m], "n/a");
+            continue;
+        }
+        printf("  %-10s %8.2f\n", methods[m], bench_submit(&q, count, 0));
+    }
+
+    int nent = 4096 / sizeof(u64);
+    int lists = count / nent;
+    if (lists == 0) lists = 1;
+    u64* prplist = aligned_alloc(4096, 4096);
+    if (!prplist) errx(1, "aligned_alloc");
+    printf("PRP list fill (%d entries n=%d) cycles per list:\n", nent, lists);
+    printf("  %-10s %8.2f\n", "legacy", bench_prp(prplist, nent, lists, 1));
+    printf("  %-10s %8.2f\n", "vector", bench_prp(prplist, nent, lists, 0));
+
+    free(prplist);
+    free(q.sq);
+    return 0;
+}
@@ -16,7 +16,7 @@ class unvme_ns_t(ctypes.Structure):
         ("blockcount", c_uint64),   # total number of available blocks
         ("pagecount", c_uint64),    # total number of available pages
         ("blocksize", c_uint16),    # logical block size
-        ("pagesize", c_uint16),     # page size
+        ("pagesize", c_uint32),     # page size (controller memory page size)
         ("blockshift", c_uint16),   # block size shift value
         ("pageshift", c_uint16),    # page size shift value
         ("bpshift", c_uint16),      # block to page shift
@@ -29,7 +29,16 @@ class unvme_ns_t(ctypes.Structure):
         ("maxqcount", c_uint32),    # max number of queues supported
         ("qsize", c_uint32),        # I/O queue size
         ("maxqsize", c_uint32),     # max queue size supported
-        ("ses", c_void_p)           # associated session
+        ("ses", c_void_p),          # associated session
+        ("sgls", c_uint32),         # SGL support in use (0 if PRP only)
+        ("shared", c_uint32),       # I/O queues are shared among threads
+        ("intr", c_uint32),         # I/O completion interrupts enabled
+        ("reactor", c_uint32),      # completions reaped by reactor thread
+        ("noiob", c_uint32),        # optimal I/O boundary in blocks (or 0)
+        ("npwg", c_uint32),         # preferred write granularity in blocks (or 0)
+        ("npwa", c_uint32),         # preferred write alignment in blocks (or 0)
+        ("nows", c_uint32),         # optimal write size in blocks (or 0)
+        ("optsplit", c_uint32)      # I/O split on the optimal boundaries
     ]
 
 # I/O descriptor structure
@@ -40,7 +49,9 @@ class unvme_iod_t(ctypes.Structure):
         ("nlb", c_uint32),          # number of blocks (submitted)
         ("qid", c_uint32),          # queue id (submitted)
         ("opc", c_uint32),          # op code
-        ("id", c_uint32)            # descriptor id
+        ("id", c_uint32),           # descriptor id
+        ("error", c_int32),         # error status (set upon completion)
+        ("arg", c_void_p)           # user context (as submitted)
     ]
 
 # Load libunvme
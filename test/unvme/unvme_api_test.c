@@ -98,6 +98,7 @@ int main(int argc, char** argv)
     u64 slba, size, w, *p;
     unvme_iod_t* iod = malloc(iocount * sizeof(unvme_iod_t));
     void** buf = malloc(iocount * sizeof(void*));
+    struct iovec* iov = malloc(iocount * sizeof(struct iovec));
 
     time_t tstart = time(0);
     for (q = 0; q < ns->qcount; q++) {
@@ -175,6 +176,70 @@ int main(int argc, char** argv)
             slba += nlb;
         }
 
+        printf("Test writev\n");
+        srandom(t);
+        for (i = 0; i < iocount; i++) {
+            nlb = random() % maxnlb + 1;
+            size = nlb * ns->blocksize / sizeof(u64);
+            p = buf[i];
+            for (w = 0; w < size; w++) p[w] = (w << 32) + i + iocount;
+            iov[i].iov_base = p;
+            iov[i].iov_len = nlb * ns->blocksize;
+        }
+        if (unvme_writev(ns, q, iov, iocount, 0))
+            errx(1, "writev failed");
+
+        printf("Test readv\n");
+        for (i = 0; i < iocount; i++) bzero(iov[i].iov_base, iov[i].iov_len);
+        if (unvme_readv(ns, q, iov, iocount, 0))
+            errx(1, "readv failed");
+
+        printf("Test verify.readv\n");
+        for (i = 0; i < iocount; i++) {
+            size = iov[i].iov_len / sizeof(u64);
+            p = buf[i];
+            for (w = 0; w < size; w++) {
+                if (p[w] != ((w << 32) + i + iocount))
+                    errx(1, "miscompare at segment %d offset %#lx", i, w * sizeof(w));
+            }
+        }
+
+        // segments of a block not starting on a page boundary, one crossing
+        // a page boundary and (with SGLs) one only dword aligned
+        printf("Test writev.unaligned\n");
+        u64 bs = ns->blocksize, ps = ns->pagesize;
+        char* sbuf = unvme_alloc(ns, 8 * ps);
+        if (!sbuf) errx(1, "alloc.unaligned failed");
+        struct iovec siov[4] = {
+            { sbuf + (bs < ps ? bs : 0), bs },
+            { sbuf + 3 * ps - bs, 2 * bs },
+            { sbuf + 5 * ps + (bs < ps ? bs : 0), bs },
+            { sbuf + 6 * ps + 4, bs },
+        };
+        int sivcnt = ns->sgls ? 4 : 3;
+        for (i = 0; i < sivcnt; i++) {
+            p = siov[i].iov_base;
+            for (w = 0; w < siov[i].iov_len / sizeof(u64); w++)
+                p[w] = (w << 32) + i + 2 * iocount;
+        }
+        if (unvme_writev(ns, q, siov, sivcnt, 0))
+            errx(1, "writev.unaligned failed");
+
+        printf("Test readv.unaligned\n");
+        for (i = 0; i < sivcnt; i++) bzero(siov[i].iov_base, siov[i].iov_len);
+        if (unvme_readv(ns, q, siov, sivcnt, 0))
+            errx(1, "readv.unaligned failed");
+        for (i = 0; i < sivcnt; i++) {
+            p = siov[i].iov_base;
+            for (w = 0; w < siov[i].iov_len / sizeof(u64); w++) {
+                if (p[w] != ((w << 32) + i + 2 * iocount))
+                    errx(1, "miscompare at unaligned segment %d offset %#lx",
+                         i, w * sizeof(w));
+            }
+        }
+        if (unvme_free(ns, sbuf))
+            errx(1, "free.unaligned failed");
+
         printf("Test free\n");
         for (i = 0; i < iocount; i++) {
             VERBOSE("  free.%-2d\n", i);
@@ -183,6 +248,7 @@ int main(int argc, char** argv)
         }
     }
 
+    free(iov);
     free(buf);
     free(iod);
     unvme_close(ns);
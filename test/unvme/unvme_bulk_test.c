@@ -0,0 +1,210 @@
+/**
+ * Copyright (c) 2015-2016, Micron Technology, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the copyright holder nor the names of its
+ *      contributors may be used to endorse or promote products derived
+ *      from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @brief UNVMe bulk write test (descriptor-less vs descriptor writes).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <err.h>
+
+#include "unvme.h"
+#include "rdtsc.h"
+
+// Global variables
+static const unvme_ns_t* ns;    ///< unvme namespace pointer
+static u64 count = 100000;      ///< number of writes
+static u32 nlb = 8;             ///< blocks per write
+static u64 slba = 0;            ///< starting lba
+static int verify = 0;          ///< read back and verify flag
+
+/**
+ * Fill a write buffer with its lba tags.
+ */
+static void fill(u64* buf, u64 lba)
+{
+    u64 i, w = ns->blocksize / sizeof(u64);
+    for (i = 0; i < nlb * w; i++) buf[i] = lba + i / w;
+}
+
+/**
+ * Write the range with a descriptor per write (reaped in batches) or with
+ * descriptor-less writes and a final drain, and return the elapsed seconds.
+ */
+static double run_test(void** bufs, int nbufs, int ff)
+{
+    unvme_iod_t* iods = malloc(ns->qsize * sizeof(unvme_iod_t));
+    u64 pending = 0;
+    u64 i;
+
+    u64 start = rdtsc();
+    for (i = 0; i < count; i++) {
+        u64 lba = slba + i * nlb;
+        void* buf = bufs[i % nbufs];
+        if (ff) {
+            if (unvme_awrite_ff(ns, 0, buf, lba, nlb))
+                errx(1, "awrite_ff lba %#lx failed", lba);
+        } else {
+            if (!unvme_awrite(ns, 0, buf, lba, nlb))
+                errx(1, "awrite lba %#lx failed", lba);
+            if (++pending >= ns->qsize / 2) {
+                int n = unvme_reap(ns, 0, ns->qsize, iods);
+                while (n--) {
+                    if (iods[n]->error) errx(1, "lba %#lx error %#x",
+                                             iods[n]->slba, iods[n]->error);
+                    pending--;
+                }
+            }
+        }
+    }
+    if (ff) {
+        int stat = unvme_drain(ns, 0);
+        if (stat) errx(1, "drain error %#x", stat);
+    } else {
+        u64 endtsc = rdtsc() + UNVME_TIMEOUT * rdtsc_second();
+        while (pending) {
+            int n = unvme_reap(ns, 0, ns->qsize, iods);
+            if (!n && rdtsc() > endtsc) errx(1, "reap timeout");
+            while (n--) {
+                if (iods[n]->error) errx(1, "lba %#lx error %#x",
+                                         iods[n]->slba, iods[n]->error);
+                pending--;
+            }
+        }
+    }
+    double secs = (double)(rdtsc() - start) / rdtsc_second();
+    free(iods);
+    return secs;
+}
+
+/**
+ * Main program.
+ */
+int main(int argc, char* argv[])
+{
+    const char* usage = "Usage: %s [OPTION]... PCINAME\n\
+           -c COUNT    number of writes (default 100000)\n\
+           -n NLB      blocks per write (default 8)\n\
+           -s LBA      starting lba (default 0)\n\
+           -v          read back and verify the written data\n\
+           PCINAME     PCI device name (as 01:00.0[/1] format)";
+
+    char* prog = strrchr(argv[0], '/');
+    prog = prog ? prog + 1 : argv[0];
+
+    int opt;
+    while ((opt = getopt(argc, argv, "c:n:s:v")) != -1) {
+        switch (opt) {
+        case 'c':
+            count = strtoull(optarg, 0, 0);
+            if (count == 0) errx(1, "c must be > 0");
+            break;
+        case 'n':
+            nlb = strtoul(optarg, 0, 0);
+            if (nlb == 0) errx(1, "n must be > 0");
+            break;
+        case 's':
+            slba = strtoull(optarg, 0, 0);
+            break;
+        case 'v':
+            verify = 1;
+            break;
+        default:
+            warnx(usage, prog);
+            exit(1);
+        }
+    }
+    if ((optind + 1) != argc) {
+        warnx(usage, prog);
+        exit(1);
+    }
+
+    printf("BULK TEST BEGIN\n");
+    time_t tstart = time(0);
+    if (!(ns = unvme_openq(argv[optind], 1, 0))) exit(1);
+    if ((slba + count * nlb) > ns->blockcount)
+        errx(1, "range exceeds %lu blocks", ns->blockcount);
+    printf("%s qsize=%u count=%lu nlb=%u slba=%#lx\n",
+           ns->device, ns->qsize, count, nlb, slba);
+
+    // each write buffer is reused only after a full queue of writes
+    int i, nbufs = count < ns->qsize ? count : ns->qsize;
+    void** bufs = calloc(nbufs, sizeof(void*));
+    for (i = 0; i < nbufs; i++) {
+        if (!(bufs[i] = unvme_alloc(ns, (u64)nlb * ns->blocksize)))
+            errx(1, "alloc failed");
+    }
+
+    double mb = (double)count * nlb * ns->blocksize / 1000000;
+    double secs = run_test(bufs, nbufs, 0);
+    printf("iod: IOPS=%.0f MB/s=%.1f\n", count / secs, mb / secs);
+    if (verify) {
+        for (i = 0; i < nbufs; i++) fill(bufs[i], slba + (u64)i * nlb);
+    }
+    secs = run_test(bufs, nbufs, 1);
+    printf("ff:  IOPS=%.0f MB/s=%.1f\n", count / secs, mb / secs);
+
+    unvme_ff_stats_t st;
+    unvme_get_ff_stats(ns, 0, &st);
+    printf("ff: submitted=%lu completed=%lu errors=%lu\n",
+           st.submitted, st.completed, st.errors);
+    if (st.errors) {
+        errx(1, "first error %#x lba %#lx nlb %u",
+             st.errstat, st.errslba, st.errnlb);
+    }
+
+    if (verify) {
+        // only the writes of the first buffer round carry their own tags
+        u64* rbuf = unvme_alloc(ns, (u64)nlb * ns->blocksize);
+        u64* wbuf = malloc((u64)nlb * ns->blocksize);
+        for (i = 0; i < nbufs; i++) {
+            u64 lba = slba + (u64)i * nlb;
+            if (unvme_read(ns, 0, rbuf, lba, nlb)) errx(1, "read lba %#lx", lba);
+            fill(wbuf, lba);
+            if (memcmp(rbuf, wbuf, (u64)nlb * ns->blocksize))
+                errx(1, "lba %#lx miscompare", lba);
+        }
+        printf("verified %d writes\n", nbufs);
+        free(wbuf);
+        unvme_free(ns, rbuf);
+    }
+
+    for (i = 0; i < nbufs; i++) unvme_free(ns, bufs[i]);
+    free(bufs);
+    unvme_close(ns);
+    printf("BULK TEST COMPLETE (%ld secs)\n", time(0) - tstart);
+    return 0;
+}
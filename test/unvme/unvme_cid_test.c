@@ -0,0 +1,172 @@
+/**
+ * Copyright (c) 2015-2016, Micron Technology, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the copyright holder nor the names of its
+ *      contributors may be used to endorse or promote products derived
+ *      from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @brief UNVMe cid owner test (out of order completion of split I/O).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <err.h>
+
+#include "unvme.h"
+
+/// I/O slot (single or multiple command request)
+typedef struct {
+    u64*                buf;            ///< IO buffer
+    u64                 slba;           ///< starting lba
+    u32                 nlb;            ///< number of blocks
+    unvme_iod_t         iod;            ///< IO descriptor
+} slot_t;
+
+// Global variables
+static const unvme_ns_t* ns;    ///< unvme namespace pointer
+static int rounds = 16;         ///< number of write-read rounds
+static int every = 16;          ///< every n-th request is split
+
+/**
+ * Fill the buffer of a slot for a round.
+ */
+static void slot_fill(slot_t* s, int round)
+{
+    size_t words = ((size_t)s->nlb << ns->blockshift) / sizeof(u64);
+    size_t w;
+    for (w = 0; w < words; w++) s->buf[w] = (s->slba << 24) | ((u64)round << 16) | w;
+}
+
+/**
+ * Main program.
+ */
+int main(int argc, char* argv[])
+{
+    const char* usage = "Usage: %s [OPTION]... PCINAME\n\
+           -n ROUNDS   number of write-read rounds (default 16)\n\
+           -s EVERY    split every n-th request (default 16)\n\
+           PCINAME     PCI device name (as 01:00.0[/1] format)";
+
+    char* prog = strrchr(argv[0], '/');
+    prog = prog ? prog + 1 : argv[0];
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:s:")) != -1) {
+        switch (opt) {
+        case 'n':
+            rounds = strtol(optarg, 0, 0);
+            if (rounds <= 0) errx(1, "n must be > 0");
+            break;
+        case 's':
+            every = strtol(optarg, 0, 0);
+            if (every <= 0) errx(1, "s must be > 0");
+            break;
+        default:
+            warnx(usage, prog);
+            exit(1);
+        }
+    }
+    if ((optind + 1) != argc) {
+        warnx(usage, prog);
+        exit(1);
+    }
+
+    printf("CID OWNER TEST BEGIN\n");
+    time_t tstart = time(0);
+    if (!(ns = unvme_open(argv[optind]))) exit(1);
+
+    // fill the queue with single and split requests (up to qsize - 1 cids)
+    slot_t* slots = calloc(ns->qsize, sizeof(slot_t));
+    int count = 0, cids = 0, split = 0;
+    u64 slba = 0;
+    for (;;) {
+        slot_t* s = slots + count;
+        s->nlb = (count % every) ? 1 + count % 8 : (u32)ns->maxbpio + 1;
+        int n = (s->nlb + ns->maxbpio - 1) / ns->maxbpio;
+        if (cids + n > ns->qsize - 1) break;
+        if (slba + s->nlb > ns->blockcount) errx(1, "not enough disk space");
+        s->slba = slba;
+        s->buf = unvme_alloc(ns, (u64)s->nlb << ns->blockshift);
+        if (!s->buf) errx(1, "alloc failed");
+        slba += s->nlb;
+        cids += n;
+        if (n > 1) split++;
+        count++;
+    }
+    printf("%s qs=%d maxbpio=%d requests=%d split=%d cids=%d\n",
+           ns->device, ns->qsize, ns->maxbpio, count, split, cids);
+
+    // complete the requests in reverse and interleaved submission order
+    int r, i;
+    for (r = 0; r < rounds; r++) {
+        for (i = 0; i < count; i++) {
+            slot_fill(slots + i, r);
+            slots[i].iod = unvme_awrite(ns, 0, slots[i].buf, slots[i].slba, slots[i].nlb);
+            if (!slots[i].iod) errx(1, "awrite lba %#lx failed", slots[i].slba);
+        }
+        for (i = count - 1; i >= 0; i--) {
+            if (unvme_apoll(slots[i].iod, UNVME_TIMEOUT))
+                errx(1, "apoll write lba %#lx failed", slots[i].slba);
+        }
+
+        for (i = 0; i < count; i++) {
+            memset(slots[i].buf, 0, (size_t)slots[i].nlb << ns->blockshift);
+            slots[i].iod = unvme_aread(ns, 0, slots[i].buf, slots[i].slba, slots[i].nlb);
+            if (!slots[i].iod) errx(1, "aread lba %#lx failed", slots[i].slba);
+        }
+        for (i = 1; i < count; i += 2) {
+            if (unvme_apoll(slots[i].iod, UNVME_TIMEOUT))
+                errx(1, "apoll read lba %#lx failed", slots[i].slba);
+        }
+        for (i = 0; i < count; i += 2) {
+            if (unvme_apoll(slots[i].iod, UNVME_TIMEOUT))
+                errx(1, "apoll read lba %#lx failed", slots[i].slba);
+        }
+
+        for (i = 0; i < count; i++) {
+            slot_t* s = slots + i;
+            size_t words = ((size_t)s->nlb << ns->blockshift) / sizeof(u64);
+            size_t w;
+            for (w = 0; w < words; w++) {
+                if (s->buf[w] != ((s->slba << 24) | ((u64)r << 16) | w))
+                    errx(1, "miscompare at lba %#lx offset %#lx", s->slba, w * sizeof(u64));
+            }
+        }
+    }
+    printf("rounds=%d ios=%lu\n", rounds, (u64)rounds * count * 2);
+
+    for (i = 0; i < count; i++) unvme_free(ns, slots[i].buf);
+    free(slots);
+    unvme_close(ns);
+    printf("CID OWNER TEST COMPLETE (%ld secs)\n", time(0) - tstart);
+    return 0;
+}
@@ -0,0 +1,153 @@
+/**
+ * Copyright (c) 2015-2016, Micron Technology, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the copyright holder nor the names of its
+ *      contributors may be used to endorse or promote products derived
+ *      from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @brief UNVMe C++ coroutine wrapper test.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <vector>
+#include <unistd.h>
+#include <err.h>
+
+#include "unvme.hpp"
+
+// Global variables
+static int numcor = 64;         ///< number of concurrent coroutines
+static int numio = 256;         ///< number of write-read per coroutine
+static u32 nlb = 8;             ///< number of blocks per I/O
+
+/**
+ * Write and read back a region of blocks repeatedly, verifying the data.
+ */
+static unvme::task test_region(unvme::queue q, unvme::memory_resource& mr,
+                               int id, u64 slba)
+{
+    const unvme_ns_t* ns = q.ns();
+    size_t words = ((size_t)nlb << ns->blockshift) / sizeof(u64);
+    std::pmr::vector<u64> wbuf(words, &mr);
+    unvme::dma_buffer rbuf(ns, words * sizeof(u64));
+    u64* r = rbuf.as<u64>();
+
+    for (int i = 0; i < numio; i++) {
+        for (size_t w = 0; w < words; w++) wbuf[w] = ((u64)id << 48) | ((u64)i << 24) | w;
+        int err = co_await q.write(wbuf.data(), slba, nlb);
+        if (err) errx(1, "c%d write lba %#lx error %#x", id, slba, err);
+        memset(r, 0, rbuf.size());
+        if ((err = co_await q.read(r, slba, nlb)))
+            errx(1, "c%d read lba %#lx error %#x", id, slba, err);
+        if (memcmp(r, wbuf.data(), rbuf.size()))
+            errx(1, "c%d lba %#lx data miscompare", id, slba);
+    }
+}
+
+/**
+ * Run all the region coroutines concurrently and then flush.
+ */
+static unvme::task test_all(unvme::queue q, unvme::memory_resource& mr)
+{
+    std::vector<unvme::task> tasks;
+    tasks.reserve(numcor);
+    for (int c = 0; c < numcor; c++) tasks.push_back(test_region(q, mr, c, (u64)c * nlb));
+    for (auto& t : tasks) co_await t;
+    int err = co_await q.flush();
+    if (err) errx(1, "flush error %#x", err);
+}
+
+/**
+ * Main program.
+ */
+int main(int argc, char* argv[])
+{
+    const char* usage = "Usage: %s [OPTION]... PCINAME\n\
+           -c COUNT    number of concurrent coroutines (default 64)\n\
+           -n COUNT    number of write-read per coroutine (default 256)\n\
+           -b NLB      number of blocks per I/O (default 8)\n\
+           PCINAME     PCI device name (as 01:00.0[/1] format)";
+
+    char* prog = strrchr(argv[0], '/');
+    prog = prog ? prog + 1 : argv[0];
+
+    int opt;
+    while ((opt = getopt(argc, argv, "c:n:b:")) != -1) {
+        switch (opt) {
+        case 'c':
+            numcor = strtol(optarg, 0, 0);
+            if (numcor <= 0) errx(1, "c must be > 0");
+            break;
+        case 'n':
+            numio = strtol(optarg, 0, 0);
+            if (numio <= 0) errx(1, "n must be > 0");
+            break;
+        case 'b':
+            nlb = strtol(optarg, 0, 0);
+            if (nlb == 0) errx(1, "b must be > 0");
+            break;
+        default:
+            warnx(usage, prog);
+            exit(1);
+        }
+    }
+    if ((optind + 1) != argc) {
+        warnx(usage, prog);
+        exit(1);
+    }
+
+    printf("COROUTINE TEST BEGIN\n");
+    time_t tstart = time(0);
+    unvme::device dev(argv[optind]);
+    if (nlb > dev->maxbpio) errx(1, "nlb limit %d", dev->maxbpio);
+    if ((u64)numcor * nlb > dev->blockcount) errx(1, "not enough disk space");
+    printf("%s qc=%d qs=%d bc=%#lx bs=%d coroutines=%d ios=%d nlb=%u\n",
+           dev->device, dev->qcount, dev->qsize, dev->blockcount,
+           dev->blocksize, numcor, numio, nlb);
+
+    unvme::memory_resource mr(dev);
+    unvme::queue q(dev, 0);
+    unvme::task t = test_all(q, mr);
+    unvme::run(t, q);
+
+    // oversubscribe the queue so submissions wait on a full queue while
+    // the completions resume other coroutines that submit to it
+    numcor = dev->qsize * 2 + 1;
+    numio = 4;
+    if ((u64)numcor * nlb > dev->blockcount) errx(1, "not enough disk space");
+    printf("oversubscribed coroutines=%d ios=%d\n", numcor, numio);
+    unvme::task t2 = test_all(q, mr);
+    unvme::run(t2, q);
+
+    printf("COROUTINE TEST COMPLETE (%ld secs)\n", time(0) - tstart);
+    return 0;
+}
@@ -0,0 +1,186 @@
+/**
+ * Copyright (c) 2015-2016, Micron Technology, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the copyright holder nor the names of its
+ *      contributors may be used to endorse or promote products derived
+ *      from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @brief UNVMe DMA translation test (I/O across many allocations).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <err.h>
+
+#include "unvme.h"
+
+/// Allocated region
+typedef struct {
+    char*               buf;            ///< buffer
+    u64                 size;           ///< size
+} region_t;
+
+// Global variables
+static const unvme_ns_t* ns;    ///< unvme namespace pointer
+static region_t* regions;       ///< allocated regions
+static int count = 4096;        ///< number of regions
+static int numio = 10000;       ///< number of write-read per pass
+static u64 seed = 1;            ///< random seed
+
+/**
+ * Get a random number.
+ */
+static u64 rnd(void)
+{
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    return seed;
+}
+
+/**
+ * Allocate a region of 1 to 4 pages.
+ */
+static void region_alloc(region_t* r)
+{
+    r->size = (1 + rnd() % 4) * ns->pagesize;
+    if (!(r->buf = unvme_alloc(ns, r->size))) errx(1, "alloc failed");
+}
+
+/**
+ * Get a random block within a region.
+ */
+static char* region_block(region_t* r)
+{
+    return r->buf + (rnd() % (r->size >> ns->blockshift) << ns->blockshift);
+}
+
+/**
+ * Write from and read back into blocks of random regions.
+ */
+static void test_io(const char* name)
+{
+    printf("Test %s regions=%d ios=%d\n", name, count, numio);
+    int i, j;
+    for (i = 0; i < numio; i++) {
+        char* wbuf = region_block(regions + rnd() % count);
+        char* rbuf = region_block(regions + rnd() % count);
+        u64 slba = rnd() % ns->blockcount;
+        for (j = 0; j < ns->blocksize; j += sizeof(u64)) *(u64*)(wbuf + j) = slba + j;
+
+        // write twice from the same buffer (translation cache hit)
+        if (unvme_write(ns, 0, wbuf, slba, 1) || unvme_write(ns, 0, wbuf, slba, 1))
+            errx(1, "write lba %#lx failed", slba);
+        if (rbuf == wbuf) continue;
+        memset(rbuf, 0, ns->blocksize);
+        if (unvme_read(ns, 0, rbuf, slba, 1))
+            errx(1, "read lba %#lx failed", slba);
+        if (memcmp(wbuf, rbuf, ns->blocksize))
+            errx(1, "miscompare at lba %#lx", slba);
+    }
+}
+
+/**
+ * Main program.
+ */
+int main(int argc, char* argv[])
+{
+    const char* usage = "Usage: %s [OPTION]... PCINAME\n\
+           -a COUNT    number of allocated regions (default 4096)\n\
+           -n COUNT    number of write-read per pass (default 10000)\n\
+           PCINAME     PCI device name (as 01:00.0[/1] format)";
+
+    char* prog = strrchr(argv[0], '/');
+    prog = prog ? prog + 1 : argv[0];
+
+    int opt;
+    while ((opt = getopt(argc, argv, "a:n:")) != -1) {
+        switch (opt) {
+        case 'a':
+            count = strtol(optarg, 0, 0);
+            if (count <= 1) errx(1, "a must be > 1");
+            break;
+        case 'n':
+            numio = strtol(optarg, 0, 0);
+            if (numio <= 0) errx(1, "n must be > 0");
+            break;
+        default:
+            warnx(usage, prog);
+            exit(1);
+        }
+    }
+    if ((optind + 1) != argc) {
+        warnx(usage, prog);
+        exit(1);
+    }
+
+    printf("DMA TRANSLATION TEST BEGIN\n");
+    time_t tstart = time(0);
+    if (!(ns = unvme_open(argv[optind]))) exit(1);
+    printf("%s ps=%d bs=%d\n", ns->device, ns->pagesize, ns->blocksize);
+
+    regions = calloc(count, sizeof(region_t));
+    int i;
+    for (i = 0; i < count; i++) region_alloc(regions + i);
+
+    // only the exact start address of a region can be freed
+    printf("Test free.invalid\n");
+    if (!unvme_free(ns, regions[0].buf + ns->blocksize))
+        errx(1, "free of an interior address succeeded");
+    if (!unvme_free(ns, &count))
+        errx(1, "free of a non allocated address succeeded");
+
+    test_io("io");
+
+    // replace half of the regions in random order so that the buffers
+    // cached by the queue are freed and their addresses may be reused
+    printf("Test realloc\n");
+    int freed = 0;
+    while (freed < count / 2) {
+        region_t* r = regions + rnd() % count;
+        if (!r->buf) continue;
+        if (unvme_free(ns, r->buf)) errx(1, "free failed");
+        if (!unvme_free(ns, r->buf)) errx(1, "double free succeeded");
+        r->buf = NULL;
+        freed++;
+    }
+    for (i = 0; i < count; i++) {
+        if (!regions[i].buf) region_alloc(regions + i);
+    }
+    test_io("io.realloc");
+
+    for (i = 0; i < count; i++) unvme_free(ns, regions[i].buf);
+    free(regions);
+    unvme_close(ns);
+    printf("DMA TRANSLATION TEST COMPLETE (%ld secs)\n", time(0) - tstart);
+    return 0;
+}
@@ -0,0 +1,186 @@
+/**
+ * Copyright (c) 2015-2016, Micron Technology, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the copyright holder nor the names of its
+ *      contributors may be used to endorse or promote products derived
+ *      from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @brief UNVMe work-stealing executor test (skewed load with and without
+ * stealing).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <err.h>
+
+#include "unvme.h"
+#include "unvme_nvme.h"
+#include "rdtsc.h"
+
+/// I/O context (one per outstanding read)
+typedef struct {
+    void*               buf;    ///< IO buffer
+    u64                 seed;   ///< random seed
+} xio_t;
+
+// Global variables
+static const unvme_ns_t* ns;    ///< unvme namespace pointer
+static unvme_exec_t* ex;        ///< executor
+static int runtime = 10;        ///< run time in seconds per mode
+static int workers = 4;         ///< number of workers (queues)
+static int outstanding = 256;   ///< total number of outstanding reads
+static int skew = 90;           ///< percentage of requests to worker 0
+static u64 endtsc;              ///< end run tsc
+static u64 ioc;                 ///< completed read count
+
+static void io_submit(xio_t* x);
+
+/**
+ * Read completion callback (on a worker thread) to resubmit until the end.
+ */
+static void io_done(unvme_iod_t iod, void* arg)
+{
+    if (iod->error) errx(1, "read lba %#lx error %#x", iod->slba, iod->error);
+    __atomic_add_fetch(&ioc, 1, __ATOMIC_RELAXED);
+    if (rdtsc() < endtsc) io_submit(arg);
+}
+
+/**
+ * Push a page read at a random lba to a worker picked with skew.
+ */
+static void io_submit(xio_t* x)
+{
+    x->seed ^= x->seed << 13;
+    x->seed ^= x->seed >> 7;
+    x->seed ^= x->seed << 17;
+    int w = (int)(x->seed % 100) < skew ? 0 : 1 + (x->seed >> 8) % (workers - 1);
+    unvme_io_t io = { .buf = x->buf, .nlb = ns->nbpp, .opc = NVME_CMD_READ };
+    io.slba = ((x->seed >> 16) % (ns->blockcount - ns->nbpp)) & ~(u64)(ns->nbpp - 1);
+    if (unvme_exec_submit(ex, w, &io, io_done, x))
+        errx(1, "exec submit worker %d failed", w);
+}
+
+/**
+ * Run the skewed load for a mode (with or without stealing).
+ */
+static void run_test(const char* name, u32 flags, xio_t* xs)
+{
+    if (!(ex = unvme_exec_create(ns, workers, 0, flags)))
+        errx(1, "exec create failed");
+    ioc = 0;
+    u64 tsec = rdtsc_second();
+    u64 start = rdtsc();
+    endtsc = start + runtime * tsec;
+    int i;
+    for (i = 0; i < outstanding; i++) io_submit(xs + i);
+    unvme_exec_wait(ex);
+    double secs = (double)(rdtsc() - start) / tsec;
+
+    printf("%s: IOPS=%.0f\n", name, ioc / secs);
+    for (i = 0; i < workers; i++) {
+        unvme_exec_stats_t st;
+        unvme_exec_get_stats(ex, i, &st);
+        printf("%s: w%d submitted=%lu (%.1f%%) stolen=%lu steals=%lu idle=%lu\n",
+               name, i, st.submitted, st.submitted * 100.0 / ioc,
+               st.stolen, st.steals, st.idle);
+    }
+    unvme_exec_destroy(ex);
+}
+
+/**
+ * Main program.
+ */
+int main(int argc, char* argv[])
+{
+    const char* usage = "Usage: %s [OPTION]... PCINAME\n\
+           -t SECONDS  run time in seconds per mode (default 10)\n\
+           -w WORKERS  number of workers/queues (default 4)\n\
+           -o COUNT    total number of outstanding reads (default 256)\n\
+           -s SKEW     percentage of requests pushed to worker 0 (default 90)\n\
+           PCINAME     PCI device name (as 01:00.0[/1] format)";
+
+    char* prog = strrchr(argv[0], '/');
+    prog = prog ? prog + 1 : argv[0];
+
+    int opt;
+    while ((opt = getopt(argc, argv, "t:w:o:s:")) != -1) {
+        switch (opt) {
+        case 't':
+            runtime = strtol(optarg, 0, 0);
+            if (runtime <= 0) errx(1, "t must be > 0");
+            break;
+        case 'w':
+            workers = strtol(optarg, 0, 0);
+            if (workers < 2) errx(1, "w must be > 1");
+            break;
+        case 'o':
+            outstanding = strtol(optarg, 0, 0);
+            if (outstanding <= 0) errx(1, "o must be > 0");
+            break;
+        case 's':
+            skew = strtol(optarg, 0, 0);
+            if (skew < 0 || skew > 100) errx(1, "s must be 0 to 100");
+            break;
+        default:
+            warnx(usage, prog);
+            exit(1);
+        }
+    }
+    if ((optind + 1) != argc) {
+        warnx(usage, prog);
+        exit(1);
+    }
+
+    printf("EXECUTOR TEST BEGIN\n");
+    time_t tstart = time(0);
+    if (!(ns = unvme_openq(argv[optind], workers, 0))) exit(1);
+    if (ns->qcount < workers) errx(1, "qcount limit %d", ns->qcount);
+    printf("%s workers=%d qs=%d outstanding=%d skew=%d%% bc=%#lx bs=%d\n",
+           ns->device, workers, ns->qsize, outstanding, skew,
+           ns->blockcount, ns->blocksize);
+
+    xio_t* xs = calloc(outstanding, sizeof(xio_t));
+    int i;
+    for (i = 0; i < outstanding; i++) {
+        if (!(xs[i].buf = unvme_alloc(ns, ns->pagesize))) errx(1, "alloc failed");
+        xs[i].seed = ((u64)tstart << 16) + i + 1;
+    }
+
+    run_test("nosteal", 0, xs);
+    run_test("steal", UNVME_EXEC_STEAL, xs);
+
+    for (i = 0; i < outstanding; i++) unvme_free(ns, xs[i].buf);
+    free(xs);
+    unvme_close(ns);
+    printf("EXECUTOR TEST COMPLETE (%ld secs)\n", time(0) - tstart);
+    return 0;
+}
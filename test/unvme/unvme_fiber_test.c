@@ -0,0 +1,163 @@
+/**
+ * Copyright (c) 2015-2016, Micron Technology, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the copyright holder nor the names of its
+ *      contributors may be used to endorse or promote products derived
+ *      from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @brief UNVMe fiber test (synchronous write/read/verify clients as fibers).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <err.h>
+
+#include "unvme.h"
+#include "rdtsc.h"
+
+/// Fiber client context
+typedef struct {
+    int                 id;     ///< client id
+    u64*                buf;    ///< IO buffer
+    u64                 seed;   ///< random seed
+} client_t;
+
+// Global variables
+static const unvme_ns_t* ns;    ///< unvme namespace pointer
+static int runtime = 10;        ///< run time in seconds
+static int qid = 0;             ///< queue id
+static u64 endtsc;              ///< end run tsc
+static u64 ioc;                 ///< completed I/O count
+
+/**
+ * Fiber client doing synchronous page write, read and verify at random lbas
+ * (each client in its own lba stripe) until the end time.
+ */
+static void client(void* arg)
+{
+    client_t* c = arg;
+    u32 nlb = ns->nbpp;
+    u64 stripes = ns->blockcount / nlb;
+    int i, n = ns->pagesize / sizeof(u64);
+
+    while (rdtsc() < endtsc) {
+        c->seed ^= c->seed << 13;
+        c->seed ^= c->seed >> 7;
+        c->seed ^= c->seed << 17;
+        u64 slba = (c->seed % stripes) * nlb;
+        for (i = 0; i < n; i++) c->buf[i] = slba + i + c->id;
+        if (unvme_write(ns, qid, c->buf, slba, nlb))
+            errx(1, "write lba %#lx failed", slba);
+        memset(c->buf, 0, ns->pagesize);
+        if (unvme_read(ns, qid, c->buf, slba, nlb))
+            errx(1, "read lba %#lx failed", slba);
+        for (i = 0; i < n; i++) {
+            // another client may have written the same lba
+            if (c->buf[i] - slba - i >= 1UL << 32)
+                errx(1, "client %d lba %#lx miscompare", c->id, slba);
+        }
+        ioc += 2;
+    }
+}
+
+/**
+ * Main program.
+ */
+int main(int argc, char* argv[])
+{
+    const char* usage = "Usage: %s [OPTION]... PCINAME\n\
+           -t SECONDS  run time in seconds (default 10)\n\
+           -f FIBERS   number of fiber clients (default qsize - 1)\n\
+           -q QID      queue id (default 0)\n\
+           PCINAME     PCI device name (as 01:00.0[/1] format)";
+
+    char* prog = strrchr(argv[0], '/');
+    prog = prog ? prog + 1 : argv[0];
+
+    int opt, fibers = 0;
+    while ((opt = getopt(argc, argv, "t:f:q:")) != -1) {
+        switch (opt) {
+        case 't':
+            runtime = strtol(optarg, 0, 0);
+            if (runtime <= 0) errx(1, "t must be > 0");
+            break;
+        case 'f':
+            fibers = strtol(optarg, 0, 0);
+            if (fibers <= 0) errx(1, "f must be > 0");
+            break;
+        case 'q':
+            qid = strtol(optarg, 0, 0);
+            if (qid < 0) errx(1, "q must be >= 0");
+            break;
+        default:
+            warnx(usage, prog);
+            exit(1);
+        }
+    }
+    if ((optind + 1) != argc) {
+        warnx(usage, prog);
+        exit(1);
+    }
+
+    printf("FIBER TEST BEGIN\n");
+    time_t tstart = time(0);
+    if (!(ns = unvme_open(argv[optind]))) exit(1);
+    if (qid >= ns->qcount) errx(1, "qid limit %d", ns->qcount - 1);
+    if (!fibers) fibers = ns->qsize - 1;
+    printf("%s qid=%d fibers=%d qs=%d bc=%#lx bs=%d\n",
+           ns->device, qid, fibers, ns->qsize, ns->blockcount, ns->blocksize);
+
+    unvme_fiber_sched_t* fs = unvme_fiber_sched_create(0);
+    if (!fs) errx(1, "fiber scheduler create failed");
+    client_t* cs = calloc(fibers, sizeof(client_t));
+    int i;
+    for (i = 0; i < fibers; i++) {
+        cs[i].id = i;
+        cs[i].seed = ((u64)tstart << 16) + i + 1;
+        if (!(cs[i].buf = unvme_alloc(ns, ns->pagesize))) errx(1, "alloc failed");
+        if (unvme_fiber_create(fs, client, cs + i)) errx(1, "fiber create failed");
+    }
+
+    u64 tsec = rdtsc_second();
+    u64 start = rdtsc();
+    endtsc = start + runtime * tsec;
+    if (unvme_fiber_run(fs)) errx(1, "fiber run failed");
+    double secs = (double)(rdtsc() - start) / tsec;
+    printf("fibers=%d IOPS=%.0f\n", fibers, ioc / secs);
+
+    unvme_fiber_sched_destroy(fs);
+    for (i = 0; i < fibers; i++) unvme_free(ns, cs[i].buf);
+    free(cs);
+    unvme_close(ns);
+    printf("FIBER TEST COMPLETE (%ld secs)\n", time(0) - tstart);
+    return 0;
+}
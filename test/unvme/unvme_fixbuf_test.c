@@ -0,0 +1,189 @@
+/**
+ * Copyright (c) 2015-2016, Micron Technology, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the copyright holder nor the names of its
+ *      contributors may be used to endorse or promote products derived
+ *      from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @brief UNVMe fixed buffer test (prepared vs regular read/write requests).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <err.h>
+
+#include "unvme.h"
+#include "unvme_nvme.h"
+#include "rdtsc.h"
+
+/// I/O slot (one per outstanding request)
+typedef struct {
+    void*               buf;    ///< fixed buffer
+    unvme_prep_t*       prep;   ///< prepared request
+    unvme_iod_t         iod;    ///< pending IO descriptor
+    u64                 lba;    ///< request lba
+} slot_t;
+
+// Global variables
+static const unvme_ns_t* ns;    ///< unvme namespace pointer
+static int runtime = 5;         ///< run time in seconds per mode
+static int depth = 32;          ///< number of outstanding requests
+static u32 nlb = 8;             ///< blocks per request
+static int rw = 'r';            ///< read or write
+static u64 seed;                ///< random lba seed
+
+/**
+ * Submit a request of a slot at a random lba.
+ */
+static void submit(slot_t* s, int prepared)
+{
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    s->lba = seed % (ns->blockcount - nlb);
+    if (prepared) s->iod = unvme_prep_submit(s->prep, s->lba, nlb);
+    else if (rw == 'w') s->iod = unvme_awrite(ns, 0, s->buf, s->lba, nlb);
+    else s->iod = unvme_aread(ns, 0, s->buf, s->lba, nlb);
+    if (!s->iod) errx(1, "submit lba %#lx failed", s->lba);
+}
+
+/**
+ * Run the requests in a mode and print the submission cost and throughput.
+ */
+static void run_test(slot_t* slots, int prepared)
+{
+    u64 tsec = rdtsc_second();
+    u64 end = rdtsc() + runtime * tsec;
+    u64 ioc = 0, subtsc = 0;
+    int i;
+
+    u64 start = rdtsc();
+    for (i = 0; i < depth; i++) submit(slots + i, prepared);
+    for (i = 0; ; i = (i + 1) % depth) {
+        slot_t* s = slots + i;
+        if (!s->iod) break;
+        int stat = unvme_apoll(s->iod, UNVME_TIMEOUT);
+        if (stat) errx(1, "lba %#lx error %#x", s->lba, stat);
+        ioc++;
+        if (rdtsc() < end) {
+            u64 tsc = rdtsc();
+            submit(s, prepared);
+            subtsc += rdtsc() - tsc;
+        } else {
+            s->iod = NULL;
+        }
+    }
+    double secs = (double)(rdtsc() - start) / tsec;
+    printf("%s: IOPS=%.0f submit=%.0f ns\n", prepared ? "prepared" : "regular",
+           ioc / secs, (double)subtsc * 1000000000 / tsec / (ioc - depth + 1));
+}
+
+/**
+ * Main program.
+ */
+int main(int argc, char* argv[])
+{
+    const char* usage = "Usage: %s [OPTION]... PCINAME\n\
+           -w          random writes (default random reads)\n\
+           -t SECONDS  run time in seconds per mode (default 5)\n\
+           -d DEPTH    number of outstanding requests (default 32)\n\
+           -n NLB      blocks per request (default 8)\n\
+           PCINAME     PCI device name (as 01:00.0[/1] format)";
+
+    char* prog = strrchr(argv[0], '/');
+    prog = prog ? prog + 1 : argv[0];
+
+    int opt;
+    while ((opt = getopt(argc, argv, "wt:d:n:")) != -1) {
+        switch (opt) {
+        case 'w':
+            rw = 'w';
+            break;
+        case 't':
+            runtime = strtol(optarg, 0, 0);
+            if (runtime <= 0) errx(1, "t must be > 0");
+            break;
+        case 'd':
+            depth = strtol(optarg, 0, 0);
+            if (depth <= 0) errx(1, "d must be > 0");
+            break;
+        case 'n':
+            nlb = strtoul(optarg, 0, 0);
+            if (nlb == 0) errx(1, "n must be > 0");
+            break;
+        default:
+            warnx(usage, prog);
+            exit(1);
+        }
+    }
+    if ((optind + 1) != argc) {
+        warnx(usage, prog);
+        exit(1);
+    }
+
+    printf("FIXBUF TEST BEGIN\n");
+    time_t tstart = time(0);
+    if (!(ns = unvme_openq(argv[optind], 1, 0))) exit(1);
+    if (nlb > ns->maxbpio) errx(1, "n must be <= %u", ns->maxbpio);
+    if (depth >= ns->qsize) errx(1, "d must be < %u", ns->qsize);
+    printf("%s depth=%d nlb=%u (%c)\n", ns->device, depth, nlb, rw);
+    seed = time(0) | 1;
+
+    slot_t* slots = calloc(depth, sizeof(slot_t));
+    struct iovec* iov = calloc(depth, sizeof(struct iovec));
+    int i;
+    for (i = 0; i < depth; i++) {
+        iov[i].iov_len = (u64)nlb * ns->blocksize;
+        if (!(iov[i].iov_base = slots[i].buf = unvme_alloc(ns, iov[i].iov_len)))
+            errx(1, "alloc failed");
+    }
+    if (unvme_register_buffers(ns, iov, depth)) errx(1, "register failed");
+    int opc = rw == 'w' ? NVME_CMD_WRITE : NVME_CMD_READ;
+    for (i = 0; i < depth; i++) {
+        if (!(slots[i].prep = unvme_prep_create(ns, 0, opc, i, NULL, NULL)))
+            errx(1, "prep_create failed");
+    }
+
+    run_test(slots, 0);
+    run_test(slots, 1);
+
+    for (i = 0; i < depth; i++) {
+        if (unvme_prep_destroy(slots[i].prep)) errx(1, "prep_destroy failed");
+    }
+    if (unvme_unregister_buffers(ns)) errx(1, "unregister failed");
+    for (i = 0; i < depth; i++) unvme_free(ns, slots[i].buf);
+    free(iov);
+    free(slots);
+    unvme_close(ns);
+    printf("FIXBUF TEST COMPLETE (%ld secs)\n", time(0) - tstart);
+    return 0;
+}
@@ -64,6 +64,11 @@ int main(int argc, char** argv)
     printf("Page size :              %d\n", ns->pagesize);
     printf("Blocks per page:         %d\n", ns->nbpp);
     printf("Max blocks per IO:       %d\n", ns->maxbpio);
+    printf("Optimal IO boundary:     %u\n", ns->noiob);
+    printf("Pref write granularity:  %u\n", ns->npwg);
+    printf("Pref write alignment:    %u\n", ns->npwa);
+    printf("Optimal write size:      %u\n", ns->nows);
+    printf("SGL support:             %#x\n", ns->sgls);
     printf("Default IO queue count:  %d\n", ns->qcount);
     printf("Default IO queue size:   %d\n", ns->qsize);
     printf("Max IO queue count:      %d\n", ns->maxqcount);
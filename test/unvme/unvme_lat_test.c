@@ -64,6 +64,9 @@ static const unvme_ns_t* ns;    ///< unvme namespace pointer
 static int qcount = 1;          ///< queue count
 static int qsize = 8;           ///< queue size
 static int runtime = 15;        ///< run time in seconds
+static int wait = -1;           ///< completion wait strategy (-1 to poll)
+static int callwait = -1;       ///< per call wait strategy (-1 if none)
+static int rcpu = -1;           ///< reactor thread CPU + 1 (-1 for no reactor)
 static u64 endtsc;              ///< end run tsc
 static u64 timeout;             ///< tsc elapsed timeout
 static sem_t sm_ready;          ///< semaphore to start thread
@@ -133,7 +136,15 @@ static void* run_thread(void* arg)
     do {
         p = pages + i;
         if (p->iod) {
-            if (unvme_apoll(p->iod, 0) == 0) {
+            int err;
+            if (callwait > 0) {
+                errno = 0;
+                err = unvme_apoll_wait(p->iod, UNVME_TIMEOUT, callwait);
+                if (err && errno == EINVAL) errx(1, "call wait %d not supported", callwait);
+            } else {
+                err = unvme_apoll(p->iod, wait < 0 ? 0 : UNVME_TIMEOUT);
+            }
+            if (err == 0) {
                 u64 tc = rdtsc_elapse(p->tsc);
                 if (min_clat > tc) min_clat = tc;
                 if (max_clat < tc) max_clat = tc;
@@ -208,6 +219,24 @@ void run_test(const char* name, int rw)
             min_clat, max_clat, avg_clat/ioc, ioc);
     */
 
+    // print the wait statistics (accumulated since open) of each queue
+    if (wait >= 0 || callwait > 0) {
+        for (q = 0; q < qcount; q++) {
+            unvme_wait_stats_t st[UNVME_WAIT_COUNT];
+            unvme_get_wait_stats(ns, q, st);
+            int w;
+            for (w = 0; w < UNVME_WAIT_COUNT; w++) {
+                if (!st[w].waits) continue;
+                printf("%s: q%d wait=%d waits=%lu polls=%lu "
+                       "wait=(%.2f %.2f) cpu=%.2f usecs\n",
+                       name, q, w, st[w].waits, st[w].polls,
+                       (double)st[w].wait_ns/st[w].waits/1000,
+                       (double)st[w].max_ns/1000,
+                       (double)st[w].cpu_ns/st[w].waits/1000);
+            }
+        }
+    }
+
     sem_destroy(&sm_ready);
     sem_destroy(&sm_start);
 }
@@ -221,13 +250,17 @@ int main(int argc, char* argv[])
            -t SECONDS  run time in seconds (default 15)\n\
            -q QCOUNT   number of queues/threads (default 2)\n\
            -d QDEPTH   queue depth (default 8)\n\
+           -w WAIT     wait for completion with strategy (default poll)\n\
+                       1=yield 2=spin 3=spin-yield 4=hybrid 5=umwait 6=intr\n\
+           -c WAIT     wait with strategy per poll call (overriding -w)\n\
+           -r CPU      reap completions on a reactor thread (on CPU if >= 0)\n\
            PCINAME     PCI device name (as 01:00.0[/1] format)";
 
     char* prog = strrchr(argv[0], '/');
     prog = prog ? prog + 1 : argv[0];
 
     int opt;
-    while ((opt = getopt(argc, argv, "t:q:d:")) != -1) {
+    while ((opt = getopt(argc, argv, "t:q:d:w:c:r:")) != -1) {
         switch (opt) {
         case 't':
             runtime = strtol(optarg, 0, 0);
@@ -239,6 +272,18 @@ int main(int argc, char* argv[])
         case 'd':
             qsize = strtol(optarg, 0, 0);
             break;
+        case 'w':
+            wait = strtol(optarg, 0, 0);
+            if (wait <= 0 || wait >= UNVME_WAIT_COUNT) errx(1, "invalid wait");
+            break;
+        case 'c':
+            callwait = strtol(optarg, 0, 0);
+            if (callwait <= 0 || callwait >= UNVME_WAIT_COUNT) errx(1, "invalid wait");
+            break;
+        case 'r':
+            rcpu = strtol(optarg, 0, 0) + 1;
+            if (rcpu < 0) rcpu = 0;
+            break;
         default:
             warnx(usage, prog);
             exit(1);
@@ -252,7 +297,19 @@ int main(int argc, char* argv[])
 
     printf("LATENCY TEST BEGIN\n");
     time_t tstart = time(0);
-    if (!(ns = unvme_open(pciname))) exit(1);
+    unvme_opts_t opts = { .wait = wait < 0 ? 0 : wait };
+    if (wait >= 0 || callwait > 0) opts.flags = UNVME_OPT_WAIT_STATS;
+    if (wait == UNVME_WAIT_INTR || callwait == UNVME_WAIT_INTR)
+        opts.flags |= UNVME_OPT_INTR;
+    if (rcpu >= 0) {
+        opts.flags |= UNVME_OPT_REACTOR;
+        opts.rcpu = rcpu;
+    }
+    if (!(ns = unvme_openx(pciname, &opts))) exit(1);
+    int q;
+    for (q = 0; wait >= 0 && q < ns->qcount; q++) {
+        if (unvme_set_wait(ns, q, wait)) errx(1, "wait %d not supported", wait);
+    }
     if (qcount <= 0 || qcount > ns->qcount) errx(1, "qcount limit %d", ns->qcount);
     if (qsize <= 1 || qsize > ns->qsize) errx(1, "qsize limit %d", ns->qsize);
 
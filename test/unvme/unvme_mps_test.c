@@ -0,0 +1,163 @@
+/**
+ * Copyright (c) 2015-2016, Micron Technology, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the copyright holder nor the names of its
+ *      contributors may be used to endorse or promote products derived
+ *      from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @brief UNVMe memory page size test (largest MPS with PRP I/O).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <err.h>
+
+#include "unvme.h"
+
+/// I/O slot
+typedef struct {
+    char*               buf;            ///< allocated buffer
+    u64*                data;           ///< I/O data (a block into buf if odd)
+    u64                 slba;           ///< starting lba
+    unvme_iod_t         iod;            ///< IO descriptor
+} slot_t;
+
+// Global variables
+static const unvme_ns_t* ns;    ///< unvme namespace pointer
+static int depth = 32;          ///< number of concurrent I/O
+
+/**
+ * Write and read back concurrent I/O of nlb blocks on a queue.  Each one
+ * uses its own PRP list slot, so an undersized slot corrupts the list of
+ * the next cid.
+ */
+static void test_io(int q, u32 nlb)
+{
+    size_t size = (size_t)nlb << ns->blockshift;
+    size_t words = size / sizeof(u64);
+    slot_t* slots = calloc(depth, sizeof(slot_t));
+    int i;
+    size_t w;
+
+    printf("Test q=%d nlb=%u depth=%d\n", q, nlb, depth);
+    for (i = 0; i < depth; i++) {
+        slot_t* s = slots + i;
+        if (!(s->buf = unvme_alloc(ns, size + ns->blocksize))) errx(1, "alloc failed");
+        s->data = (u64*)(s->buf + ((i & 1) ? ns->blocksize : 0));
+        s->slba = (u64)i * nlb;
+        for (w = 0; w < words; w++) s->data[w] = (s->slba << 24) | w;
+        if (!(s->iod = unvme_awrite(ns, q, s->data, s->slba, nlb)))
+            errx(1, "awrite lba %#lx failed", s->slba);
+    }
+    for (i = 0; i < depth; i++) {
+        if (unvme_apoll(slots[i].iod, UNVME_TIMEOUT)) errx(1, "apoll write failed");
+        memset(slots[i].data, 0, size);
+    }
+    for (i = 0; i < depth; i++) {
+        slot_t* s = slots + i;
+        if (!(s->iod = unvme_aread(ns, q, s->data, s->slba, nlb)))
+            errx(1, "aread lba %#lx failed", s->slba);
+    }
+    for (i = 0; i < depth; i++) {
+        slot_t* s = slots + i;
+        if (unvme_apoll(s->iod, UNVME_TIMEOUT)) errx(1, "apoll read failed");
+        for (w = 0; w < words; w++) {
+            if (s->data[w] != ((s->slba << 24) | w))
+                errx(1, "miscompare at lba %#lx offset %#lx", s->slba, w * sizeof(u64));
+        }
+        unvme_free(ns, s->buf);
+    }
+    free(slots);
+}
+
+/**
+ * Main program.
+ */
+int main(int argc, char* argv[])
+{
+    const char* usage = "Usage: %s [OPTION]... PCINAME\n\
+           -d DEPTH    number of concurrent I/O per queue (default 32)\n\
+           PCINAME     PCI device name (as 01:00.0[/1] format)";
+
+    char* prog = strrchr(argv[0], '/');
+    prog = prog ? prog + 1 : argv[0];
+
+    int opt;
+    while ((opt = getopt(argc, argv, "d:")) != -1) {
+        switch (opt) {
+        case 'd':
+            depth = strtol(optarg, 0, 0);
+            if (depth <= 0) errx(1, "d must be > 0");
+            break;
+        default:
+            warnx(usage, prog);
+            exit(1);
+        }
+    }
+    if ((optind + 1) != argc) {
+        warnx(usage, prog);
+        exit(1);
+    }
+
+    // PRP lists are only used when SGLs are not
+    setenv(UNVME_SGL_ENV, "0", 1);
+
+    printf("MPS TEST BEGIN\n");
+    time_t tstart = time(0);
+    if (!(ns = unvme_open(argv[optind]))) exit(1);
+    u32 minps = ns->pagesize;
+    u32 minppio = ns->maxppio;
+    unvme_close(ns);
+
+    unvme_opts_t opts = { .flags = UNVME_OPT_LARGE_MPS };
+    if (!(ns = unvme_openx(argv[optind], &opts))) exit(1);
+    printf("%s ps=%u/%u maxppio=%d/%u maxbpio=%d bs=%d\n", ns->device,
+           minps, ns->pagesize, ns->maxppio, minppio, ns->maxbpio, ns->blocksize);
+    if (ns->pagesize < minps || (ns->pagesize & (ns->pagesize - 1)))
+        errx(1, "invalid page size %u", ns->pagesize);
+    if (ns->pagesize != (1U << ns->pageshift) ||
+        ns->nbpp != (ns->pagesize >> ns->blockshift))
+        errx(1, "inconsistent page size fields");
+    if (depth > ns->qsize - 1) depth = ns->qsize - 1;
+    if ((u64)depth * ns->maxbpio > ns->blockcount) errx(1, "not enough disk space");
+
+    // a block crossing into the next page, and the max transfer, per queue
+    int q;
+    for (q = 0; q < ns->qcount; q++) {
+        test_io(q, ns->nbpp + 1 < ns->maxbpio ? ns->nbpp + 1 : ns->maxbpio);
+        test_io(q, ns->maxbpio);
+    }
+
+    unvme_close(ns);
+    printf("MPS TEST COMPLETE (%ld secs)\n", time(0) - tstart);
+    return 0;
+}
@@ -51,6 +51,8 @@
 static int numses = 4;          ///< number of thread sessions
 static int qcount = 4;          ///< number of queues per session
 static int maxnlb = 1024;       ///< maximum number of blocks per IO
+static int share = 1;           ///< number of threads sharing a queue
+static int autobind = 0;        ///< bind threads to queues automatically
 static sem_t sm_ready;          ///< semaphore for ready
 static sem_t sm_start;          ///< semaphore for start
 static const unvme_ns_t* ns;    ///< driver namespace handle
@@ -72,6 +74,8 @@ void* test_queue(void* arg)
     u64 slba, wlen, w, *p;
     int nlb, l, i;
 
+    if (autobind && (ses->qid = unvme_bind_queue(ns)) < 0)
+        errx(1, "bind.%d failed", ses->id);
     printf("Test s%d q%-2d lba %#lx started\n", ses->id, ses->qid, ses->slba);
     sem_post(&sm_ready);
     sem_wait(&sm_start);
@@ -177,7 +181,7 @@ void* test_session(void* arg)
     int q;
     for (q = 0; q < qcount; q++) {
         sarg[q].id = sid;
-        sarg[q].qid = q + sesid * qcount;
+        sarg[q].qid = (q + sesid * qcount) / share;
         sarg[q].slba = bpq * (sesid * qcount + q);
         pthread_create(&sqt[q], 0, test_queue, &sarg[q]);
     }
@@ -200,13 +204,15 @@ int main(int argc, char* argv[])
            -t THREADS  number of thread sessions (default 4)\n\
            -q QCOUNT   number of queues per session (default 4)\n\
            -m MAXNLB   maximum number of blocks per I/O (default 1024)\n\
+           -s SHARE    number of threads sharing a queue (default 1)\n\
+           -a          bind threads to queues automatically\n\
            PCINAME     PCI device name (as 01:00.0[/1] format)";
 
     char* prog = strrchr(argv[0], '/');
     prog = prog ? prog + 1 : argv[0];
 
     int opt, i;
-    while ((opt = getopt(argc, argv, "t:q:m:")) != -1) {
+    while ((opt = getopt(argc, argv, "t:q:m:s:a")) != -1) {
         switch (opt) {
         case 't':
             numses = strtol(optarg, 0, 0);
@@ -220,6 +226,13 @@ int main(int argc, char* argv[])
             maxnlb = strtol(optarg, 0, 0);
             if (maxnlb <= 0) errx(1, "m must be > 0");
             break;
+        case 's':
+            share = strtol(optarg, 0, 0);
+            if (share <= 0) errx(1, "s must be > 0");
+            break;
+        case 'a':
+            autobind = 1;
+            break;
         default:
             warnx(usage, prog);
             exit(1);
@@ -232,13 +245,14 @@ int main(int argc, char* argv[])
     char* pciname = argv[optind];
 
     printf("MULTI-SESSION TEST BEGIN\n");
-    if (!(ns = unvme_open(pciname))) exit(1);
-    if ((numses * qcount) > ns->maxqcount)
-        errx(1, "%d threads %d queues each exceeds limit of %d queues",
-              numses, qcount, ns->maxqcount);
-    printf("%s ses=%d qc=%d/%d qs=%d/%d bc=%#lx bs=%d maxnlb=%d/%d\n",
+    unvme_opts_t opts = { .flags = share > 1 ? UNVME_OPT_SHARED : 0 };
+    if (!(ns = unvme_openx(pciname, &opts))) exit(1);
+    if ((numses * qcount) > (ns->maxqcount * share))
+        errx(1, "%d threads %d queues each (%d threads per queue) exceeds "
+              "limit of %d queues", numses, qcount, share, ns->maxqcount);
+    printf("%s ses=%d qc=%d/%d qs=%d/%d bc=%#lx bs=%d maxnlb=%d/%d share=%d\n",
             ns->device, numses, qcount, ns->qcount, ns->qsize, ns->maxqsize,
-            ns->blockcount, ns->blocksize, maxnlb, ns->maxbpio);
+            ns->blockcount, ns->blocksize, maxnlb, ns->maxbpio, share);
 
     if ((u64)(numses * qcount * ns->qsize * maxnlb) > ns->blockcount)
         errx(1, "not enough disk space");
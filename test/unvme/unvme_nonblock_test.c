@@ -0,0 +1,171 @@
+/**
+ * Copyright (c) 2015-2016, Micron Technology, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the copyright holder nor the names of its
+ *      contributors may be used to endorse or promote products derived
+ *      from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @brief UNVMe non-blocking submission test (queue saturation with
+ * overflow queue and backpressure).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <err.h>
+
+#include "unvme.h"
+#include "rdtsc.h"
+
+// Global variables
+static const unvme_ns_t* ns;    ///< unvme namespace pointer
+static int runtime = 10;        ///< run time in seconds
+static int ovfdepth = 64;       ///< overflow queue depth
+static u32 nlb = 8;             ///< blocks per request
+static int rw = 'w';            ///< write or read
+static u64 completed;           ///< number of completed requests
+static u64 errors;              ///< number of failed requests
+
+/**
+ * Request completion callback.
+ */
+static void done(unvme_iod_t iod, void* arg)
+{
+    if (iod->error) errors++;
+    completed++;
+}
+
+/**
+ * Main program.
+ */
+int main(int argc, char* argv[])
+{
+    const char* usage = "Usage: %s [OPTION]... PCINAME\n\
+           -r          random reads (default random writes)\n\
+           -t SECONDS  run time in seconds (default 10)\n\
+           -o DEPTH    overflow queue depth (default 64, 0 for none)\n\
+           -n NLB      blocks per request (default 8)\n\
+           PCINAME     PCI device name (as 01:00.0[/1] format)";
+
+    char* prog = strrchr(argv[0], '/');
+    prog = prog ? prog + 1 : argv[0];
+
+    int opt;
+    while ((opt = getopt(argc, argv, "rt:o:n:")) != -1) {
+        switch (opt) {
+        case 'r':
+            rw = 'r';
+            break;
+        case 't':
+            runtime = strtol(optarg, 0, 0);
+            if (runtime <= 0) errx(1, "t must be > 0");
+            break;
+        case 'o':
+            ovfdepth = strtol(optarg, 0, 0);
+            if (ovfdepth < 0) errx(1, "o must be >= 0");
+            break;
+        case 'n':
+            nlb = strtoul(optarg, 0, 0);
+            if (nlb == 0) errx(1, "n must be > 0");
+            break;
+        default:
+            warnx(usage, prog);
+            exit(1);
+        }
+    }
+    if ((optind + 1) != argc) {
+        warnx(usage, prog);
+        exit(1);
+    }
+
+    printf("NONBLOCK TEST BEGIN\n");
+    time_t tstart = time(0);
+    if (!(ns = unvme_openq(argv[optind], 1, 0))) exit(1);
+    if (nlb >= ns->blockcount) errx(1, "n must be < %lu", ns->blockcount);
+    if (unvme_set_nonblock(ns, 0, ovfdepth)) errx(1, "set_nonblock failed");
+    printf("%s qsize=%u ovfdepth=%d nlb=%u\n",
+           ns->device, ns->qsize, ovfdepth, nlb);
+
+    void* buf = unvme_alloc(ns, (u64)nlb * ns->blocksize);
+    if (!buf) errx(1, "alloc failed");
+
+    // submit until backpressure, then process completions (never blocking)
+    u64 tsec = rdtsc_second();
+    u64 start = rdtsc();
+    u64 end = start + runtime * tsec;
+    u64 submitted = 0, eagain = 0, loops = 0, occsum = 0;
+    int maxocc = 0, maxqueued = 0;
+    u64 seed = time(0) | 1;
+    while (rdtsc() < end) {
+        for (;;) {
+            seed ^= seed << 13;
+            seed ^= seed >> 7;
+            seed ^= seed << 17;
+            u64 lba = seed % (ns->blockcount - nlb);
+            int stat = rw == 'w' ? unvme_awrite_cb(ns, 0, buf, lba, nlb, done, 0)
+                                 : unvme_aread_cb(ns, 0, buf, lba, nlb, done, 0);
+            if (stat) {
+                if (errno != EAGAIN) errx(1, "submit lba %#lx failed", lba);
+                eagain++;
+                break;
+            }
+            submitted++;
+        }
+
+        int queued;
+        int occ = unvme_get_occupancy(ns, 0, &queued);
+        if (occ > maxocc) maxocc = occ;
+        if (queued > maxqueued) maxqueued = queued;
+        occsum += occ;
+        loops++;
+        unvme_process(ns, 0, ns->qsize);
+    }
+
+    // drain the pending and overflow queued requests
+    u64 endtsc = rdtsc() + UNVME_TIMEOUT * tsec;
+    while (completed < submitted) {
+        if (!unvme_process(ns, 0, ns->qsize) && rdtsc() > endtsc)
+            errx(1, "drain timeout (%lu pending)", submitted - completed);
+    }
+    double secs = (double)(rdtsc() - start) / tsec;
+
+    printf("submitted=%lu completed=%lu errors=%lu eagain=%lu\n",
+           submitted, completed, errors, eagain);
+    printf("occupancy avg=%.1f max=%d overflow max=%d IOPS=%.0f\n",
+           (double)occsum / loops, maxocc, maxqueued, completed / secs);
+
+    unvme_free(ns, buf);
+    unvme_close(ns);
+    if (errors) errx(1, "%lu requests failed", errors);
+    printf("NONBLOCK TEST COMPLETE (%ld secs)\n", time(0) - tstart);
+    return 0;
+}
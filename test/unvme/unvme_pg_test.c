@@ -0,0 +1,264 @@
+/**
+ * Copyright (c) 2015-2016, Micron Technology, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the copyright holder nor the names of its
+ *      contributors may be used to endorse or promote products derived
+ *      from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @brief UNVMe poll group (devices x cores) scaling test.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <time.h>
+#include <err.h>
+
+#include "unvme.h"
+#include "rdtsc.h"
+
+/// I/O context (one per outstanding read)
+typedef struct {
+    const unvme_ns_t*   ns;     ///< device namespace
+    int                 qid;    ///< queue id
+    void*               buf;    ///< IO buffer
+    struct _pg_thread*  th;     ///< owner thread
+} pg_io_t;
+
+/// thread context
+typedef struct _pg_thread {
+    int                 id;     ///< thread id (also the queue id)
+    int                 ndev;   ///< number of devices polled
+    int                 pending; ///< number of outstanding reads
+    u64                 ioc;    ///< number of completed reads
+    u64                 seed;   ///< random lba seed
+    pthread_t           thread; ///< thread
+} pg_thread_t;
+
+// Global variables
+static int runtime = 5;         ///< run time in seconds per configuration
+static int maxcores = 1;        ///< max number of threads (cores)
+static int qdepth = 32;         ///< outstanding reads per queue
+static int pin = 0;             ///< pin thread n to CPU n
+static int numdev;              ///< number of devices
+static const unvme_ns_t** nss;  ///< device namespaces
+static u64 endtsc;              ///< end run tsc
+static sem_t sm_ready;          ///< semaphore for ready
+static sem_t sm_start;          ///< semaphore for start
+
+static void io_submit(pg_io_t* io);
+
+/**
+ * Read completion callback to resubmit until the end of the run.
+ */
+static void io_done(unvme_iod_t iod, void* arg)
+{
+    pg_io_t* io = arg;
+    if (iod->error) errx(1, "%s q%d read lba %#lx error %#x",
+                         io->ns->device, io->qid, iod->slba, iod->error);
+    io->th->ioc++;
+    if (rdtsc() < endtsc) io_submit(io);
+    else io->th->pending--;
+}
+
+/**
+ * Submit a page read at a random lba.
+ */
+static void io_submit(pg_io_t* io)
+{
+    const unvme_ns_t* ns = io->ns;
+    pg_thread_t* th = io->th;
+    th->seed ^= th->seed << 13;
+    th->seed ^= th->seed >> 7;
+    th->seed ^= th->seed << 17;
+    u64 lba = (th->seed % (ns->blockcount - ns->nbpp)) & ~(u64)(ns->nbpp - 1);
+    if (unvme_aread_cb(ns, io->qid, io->buf, lba, ns->nbpp, io_done, io))
+        errx(1, "%s q%d aread lba %#lx failed", ns->device, io->qid, lba);
+}
+
+/**
+ * Thread to drive queue id (thread id) of each device through a poll group.
+ */
+static void* run_thread(void* arg)
+{
+    pg_thread_t* th = arg;
+    if (pin) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(th->id, &cpus);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus))
+            warnx("thread %d CPU affinity failed", th->id);
+    }
+
+    unvme_poll_group_t* pg = unvme_poll_group_create();
+    if (!pg) errx(1, "poll group create failed");
+    int nio = th->ndev * qdepth;
+    pg_io_t* ios = calloc(nio, sizeof(pg_io_t));
+    int d, i;
+    for (d = 0; d < th->ndev; d++) {
+        if (unvme_poll_group_add(pg, nss[d], th->id))
+            errx(1, "%s q%d poll group add failed", nss[d]->device, th->id);
+        for (i = 0; i < qdepth; i++) {
+            pg_io_t* io = ios + d * qdepth + i;
+            io->ns = nss[d];
+            io->qid = th->id;
+            io->th = th;
+            if (!(io->buf = unvme_alloc(nss[d], nss[d]->pagesize)))
+                errx(1, "%s alloc failed", nss[d]->device);
+        }
+    }
+
+    sem_post(&sm_ready);
+    sem_wait(&sm_start);
+
+    th->pending = nio;
+    for (i = 0; i < nio; i++) io_submit(ios + i);
+    while (th->pending) unvme_poll_group_process(pg, nio);
+
+    for (i = 0; i < nio; i++) unvme_free(ios[i].ns, ios[i].buf);
+    free(ios);
+    unvme_poll_group_destroy(pg);
+    return 0;
+}
+
+/**
+ * Run a configuration of a number of devices driven by a number of cores.
+ * @return  the number of completed reads per second.
+ */
+static double run_test(int ndev, int ncores)
+{
+    pg_thread_t* ths = calloc(ncores, sizeof(pg_thread_t));
+    sem_init(&sm_ready, 0, 0);
+    sem_init(&sm_start, 0, 0);
+
+    int t;
+    for (t = 0; t < ncores; t++) {
+        ths[t].id = t;
+        ths[t].ndev = ndev;
+        ths[t].seed = ((u64)time(0) << 8) + t + 1;
+        pthread_create(&ths[t].thread, 0, run_thread, ths + t);
+        sem_wait(&sm_ready);
+    }
+
+    u64 tsec = rdtsc_second();
+    u64 start = rdtsc();
+    endtsc = start + runtime * tsec;
+    for (t = 0; t < ncores; t++) sem_post(&sm_start);
+
+    u64 ioc = 0;
+    for (t = 0; t < ncores; t++) {
+        pthread_join(ths[t].thread, 0);
+        ioc += ths[t].ioc;
+    }
+    double secs = (double)(rdtsc() - start) / tsec;
+
+    sem_destroy(&sm_start);
+    sem_destroy(&sm_ready);
+    free(ths);
+    return ioc / secs;
+}
+
+/**
+ * Main program.
+ */
+int main(int argc, char* argv[])
+{
+    const char* usage = "Usage: %s [OPTION]... PCINAME...\n\
+           -t SECONDS  run time in seconds per configuration (default 5)\n\
+           -c CORES    max number of threads/cores (default 1)\n\
+           -d QDEPTH   outstanding reads per queue (default 32)\n\
+           -p          pin thread n to CPU n\n\
+           PCINAME     PCI device names (as 01:00.0[/1] format)";
+
+    char* prog = strrchr(argv[0], '/');
+    prog = prog ? prog + 1 : argv[0];
+
+    int opt;
+    while ((opt = getopt(argc, argv, "t:c:d:p")) != -1) {
+        switch (opt) {
+        case 't':
+            runtime = strtol(optarg, 0, 0);
+            if (runtime <= 0) errx(1, "t must be > 0");
+            break;
+        case 'c':
+            maxcores = strtol(optarg, 0, 0);
+            if (maxcores <= 0) errx(1, "c must be > 0");
+            break;
+        case 'd':
+            qdepth = strtol(optarg, 0, 0);
+            if (qdepth <= 0) errx(1, "d must be > 0");
+            break;
+        case 'p':
+            pin = 1;
+            break;
+        default:
+            warnx(usage, prog);
+            exit(1);
+        }
+    }
+    if (optind >= argc) {
+        warnx(usage, prog);
+        exit(1);
+    }
+
+    printf("POLL GROUP TEST BEGIN\n");
+    time_t tstart = time(0);
+    numdev = argc - optind;
+    nss = calloc(numdev, sizeof(unvme_ns_t*));
+    int d, c;
+    for (d = 0; d < numdev; d++) {
+        if (!(nss[d] = unvme_openq(argv[optind + d], maxcores, qdepth + 1)))
+            exit(1);
+        if (nss[d]->qcount < maxcores || nss[d]->maxiopq < qdepth)
+            errx(1, "%s qcount %d qsize %d limit", nss[d]->device,
+                 nss[d]->qcount, nss[d]->qsize);
+        printf("%s qc=%d qs=%d bc=%#lx bs=%d\n", nss[d]->device,
+               nss[d]->qcount, nss[d]->qsize, nss[d]->blockcount,
+               nss[d]->blocksize);
+    }
+
+    // scale the number of devices and the number of cores driving them
+    printf("%8s %8s %12s %12s\n", "devices", "cores", "IOPS", "IOPS/core");
+    for (d = 1; d <= numdev; d++) {
+        for (c = 1; ; c = (c << 1) < maxcores ? c << 1 : maxcores) {
+            double iops = run_test(d, c);
+            printf("%8d %8d %12.0f %12.0f\n", d, c, iops, iops / c);
+            if (c == maxcores) break;
+        }
+    }
+
+    for (d = 0; d < numdev; d++) unvme_close(nss[d]);
+    free(nss);
+    printf("POLL GROUP TEST COMPLETE (%ld secs)\n", time(0) - tstart);
+    return 0;
+}
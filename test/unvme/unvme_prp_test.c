@@ -0,0 +1,198 @@
+/**
+ * Copyright (c) 2015-2016, Micron Technology, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the copyright holder nor the names of its
+ *      contributors may be used to endorse or promote products derived
+ *      from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @brief UNVMe chained PRP list test (I/O sizes around the list page ends).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <err.h>
+
+#include "unvme.h"
+
+// Global variables
+static const unvme_ns_t* ns;    ///< unvme namespace pointer
+static int q;                   ///< queue id
+
+/**
+ * Fill a buffer with a pattern.
+ */
+static void fill(u64* buf, u32 nlb, u64 slba)
+{
+    size_t words = ((size_t)nlb << ns->blockshift) / sizeof(u64);
+    size_t w;
+    for (w = 0; w < words; w++) buf[w] = (slba << 24) | w;
+}
+
+/**
+ * Write and read back an I/O starting at a block offset within a page.
+ * @return  number of blocks tested.
+ */
+static u32 test_io(u64 slba, u32 nlb, int boff)
+{
+    if (nlb > ns->maxbpio) return 0;
+    size_t size = (size_t)nlb << ns->blockshift;
+    size_t off = (size_t)boff << ns->blockshift;
+    char* wbuf = unvme_alloc(ns, size + off);
+    char* rbuf = unvme_alloc(ns, size + off);
+    if (!wbuf || !rbuf) errx(1, "alloc failed");
+
+    printf("Test nlb=%u pages=%lu offset=%#lx\n", nlb,
+           (size + off + ns->pagesize - 1) >> ns->pageshift, off);
+    fill((u64*)(wbuf + off), nlb, slba);
+    memset(rbuf, 0, size + off);
+    if (unvme_write(ns, q, wbuf + off, slba, nlb))
+        errx(1, "write lba %#lx nlb %u failed", slba, nlb);
+    if (unvme_read(ns, q, rbuf + off, slba, nlb))
+        errx(1, "read lba %#lx nlb %u failed", slba, nlb);
+    if (memcmp(wbuf + off, rbuf + off, size))
+        errx(1, "miscompare at lba %#lx nlb %u", slba, nlb);
+
+    unvme_free(ns, wbuf);
+    unvme_free(ns, rbuf);
+    return nlb;
+}
+
+/**
+ * Write and read back concurrent max size I/O (each with its own chain).
+ */
+static void test_concurrent(u64 slba, int depth)
+{
+    u32 nlb = ns->maxbpio;
+    size_t size = (size_t)nlb << ns->blockshift;
+    u64** bufs = calloc(depth, sizeof(u64*));
+    unvme_iod_t* iods = calloc(depth, sizeof(unvme_iod_t));
+    int i;
+
+    printf("Test concurrent nlb=%u depth=%d\n", nlb, depth);
+    for (i = 0; i < depth; i++) {
+        if (!(bufs[i] = unvme_alloc(ns, size))) errx(1, "alloc failed");
+        fill(bufs[i], nlb, slba + (u64)i * nlb);
+        iods[i] = unvme_awrite(ns, q, bufs[i], slba + (u64)i * nlb, nlb);
+        if (!iods[i]) errx(1, "awrite lba %#lx failed", slba + (u64)i * nlb);
+    }
+    for (i = 0; i < depth; i++) {
+        if (unvme_apoll(iods[i], UNVME_TIMEOUT)) errx(1, "apoll write failed");
+        memset(bufs[i], 0, size);
+    }
+    for (i = 0; i < depth; i++) {
+        iods[i] = unvme_aread(ns, q, bufs[i], slba + (u64)i * nlb, nlb);
+        if (!iods[i]) errx(1, "aread lba %#lx failed", slba + (u64)i * nlb);
+    }
+    for (i = 0; i < depth; i++) {
+        if (unvme_apoll(iods[i], UNVME_TIMEOUT)) errx(1, "apoll read failed");
+        size_t words = size / sizeof(u64);
+        size_t w;
+        for (w = 0; w < words; w++) {
+            if (bufs[i][w] != (((slba + (u64)i * nlb) << 24) | w))
+                errx(1, "miscompare at lba %#lx offset %#lx",
+                     slba + (u64)i * nlb, w * sizeof(u64));
+        }
+        unvme_free(ns, bufs[i]);
+    }
+    free(bufs);
+    free(iods);
+}
+
+/**
+ * Main program.
+ */
+int main(int argc, char* argv[])
+{
+    const char* usage = "Usage: %s [OPTION]... PCINAME\n\
+           -q QID      queue id (default 0)\n\
+           -d DEPTH    number of concurrent max size I/O (default 8)\n\
+           PCINAME     PCI device name (as 01:00.0[/1] format)";
+
+    char* prog = strrchr(argv[0], '/');
+    prog = prog ? prog + 1 : argv[0];
+
+    int depth = 8;
+    int opt;
+    while ((opt = getopt(argc, argv, "q:d:")) != -1) {
+        switch (opt) {
+        case 'q':
+            q = strtol(optarg, 0, 0);
+            if (q < 0) errx(1, "q must be >= 0");
+            break;
+        case 'd':
+            depth = strtol(optarg, 0, 0);
+            if (depth <= 0) errx(1, "d must be > 0");
+            break;
+        default:
+            warnx(usage, prog);
+            exit(1);
+        }
+    }
+    if ((optind + 1) != argc) {
+        warnx(usage, prog);
+        exit(1);
+    }
+
+    // PRP lists are only used when SGLs are not
+    setenv(UNVME_SGL_ENV, "0", 1);
+
+    printf("PRP TEST BEGIN\n");
+    time_t tstart = time(0);
+    if (!(ns = unvme_open(argv[optind]))) exit(1);
+    if (q >= ns->qcount) errx(1, "q limit %d", ns->qcount - 1);
+    if (depth > ns->qsize - 1) depth = ns->qsize - 1;
+
+    // entries per list page (the last one chains to the next page)
+    u32 ppl = ns->pagesize / sizeof(u64);
+    printf("%s ps=%d maxppio=%d maxbpio=%d list=%u chained=%d\n",
+           ns->device, ns->pagesize, ns->maxppio, ns->maxbpio,
+           ppl, ns->maxppio > ppl);
+
+    // data pages (the first one in PRP1) filling up to 3 list pages exactly,
+    // one entry less and one more, page aligned and a block into a page
+    u64 slba = 0;
+    int n, d, boff;
+    for (boff = 0; boff <= (ns->nbpp > 1); boff++) {
+        for (n = 1; n <= 3; n++) {
+            for (d = -1; d <= 1; d++) {
+                u32 pages = 1 + n * (ppl - 1) + d;
+                slba += test_io(slba, (pages << ns->bpshift) - boff, boff);
+            }
+        }
+        slba += test_io(slba, ns->maxbpio, boff);
+    }
+    test_concurrent(slba, depth);
+
+    unvme_close(ns);
+    printf("PRP TEST COMPLETE (%ld secs)\n", time(0) - tstart);
+    return 0;
+}
@@ -0,0 +1,235 @@
+/**
+ * Copyright (c) 2015-2016, Micron Technology, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the copyright holder nor the names of its
+ *      contributors may be used to endorse or promote products derived
+ *      from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @brief UNVMe queue fd test (epoll driven write-read-verify per queue).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <err.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+
+#include "unvme.h"
+
+/// I/O slot (a buffer written, read back and verified in turn)
+typedef struct {
+    int                 q;              ///< queue id
+    u64                 slba;           ///< slot starting lba
+    u64*                wbuf;           ///< write buffer
+    u64*                rbuf;           ///< read buffer
+    int                 iter;           ///< current iteration
+} slot_t;
+
+// Global variables
+static const unvme_ns_t* ns;    ///< unvme namespace pointer
+static int qcount = 4;          ///< number of queues
+static int depth = 16;          ///< number of slots per queue
+static int numio = 64;          ///< number of write-read per slot
+static u32 nlb = 8;             ///< blocks per I/O
+static int active;              ///< number of active slots
+
+/**
+ * Get the process CPU time.
+ * @return  CPU time in microseconds.
+ */
+static u64 cpu_usec(void)
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000UL +
+           ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+/**
+ * Fill the write buffer of a slot for its current iteration.
+ */
+static void slot_fill(slot_t* s)
+{
+    size_t words = ((size_t)nlb << ns->blockshift) / sizeof(u64);
+    size_t w;
+    for (w = 0; w < words; w++) s->wbuf[w] = (s->slba << 24) | ((u64)s->iter << 16) | w;
+}
+
+/**
+ * Completion callback advancing a slot (write, read, verify).
+ */
+static void done(unvme_iod_t iod, void* arg)
+{
+    slot_t* s = arg;
+    if (iod->error) errx(1, "q%d lba %#lx error %#x", s->q, s->slba, iod->error);
+    if (iod->buf == s->wbuf) {
+        memset(s->rbuf, 0, (size_t)nlb << ns->blockshift);
+        if (unvme_aread_cb(ns, s->q, s->rbuf, s->slba, nlb, done, s))
+            errx(1, "q%d read lba %#lx failed", s->q, s->slba);
+        return;
+    }
+    if (memcmp(s->wbuf, s->rbuf, (size_t)nlb << ns->blockshift))
+        errx(1, "q%d lba %#lx data miscompare", s->q, s->slba);
+    if (++s->iter == numio) {
+        active--;
+        return;
+    }
+    slot_fill(s);
+    if (unvme_awrite_cb(ns, s->q, s->wbuf, s->slba, nlb, done, s))
+        errx(1, "q%d write lba %#lx failed", s->q, s->slba);
+}
+
+/**
+ * Main program.
+ */
+int main(int argc, char* argv[])
+{
+    const char* usage = "Usage: %s [OPTION]... PCINAME\n\
+           -q COUNT    number of queues (default 4)\n\
+           -d DEPTH    number of I/O slots per queue (default 16)\n\
+           -n COUNT    number of write-read per slot (default 64)\n\
+           -b NLB      number of blocks per I/O (default 8)\n\
+           -i          use completion interrupts\n\
+           -r          use the completion reactor thread\n\
+           PCINAME     PCI device name (as 01:00.0[/1] format)";
+
+    char* prog = strrchr(argv[0], '/');
+    prog = prog ? prog + 1 : argv[0];
+
+    unvme_opts_t opts = { 0 };
+    int opt;
+    while ((opt = getopt(argc, argv, "q:d:n:b:ir")) != -1) {
+        switch (opt) {
+        case 'q':
+            qcount = strtol(optarg, 0, 0);
+            if (qcount <= 0) errx(1, "q must be > 0");
+            break;
+        case 'd':
+            depth = strtol(optarg, 0, 0);
+            if (depth <= 0) errx(1, "d must be > 0");
+            break;
+        case 'n':
+            numio = strtol(optarg, 0, 0);
+            if (numio <= 0) errx(1, "n must be > 0");
+            break;
+        case 'b':
+            nlb = strtoul(optarg, 0, 0);
+            if (nlb == 0) errx(1, "b must be > 0");
+            break;
+        case 'i':
+            opts.flags |= UNVME_OPT_INTR;
+            break;
+        case 'r':
+            opts.flags |= UNVME_OPT_REACTOR;
+            break;
+        default:
+            warnx(usage, prog);
+            exit(1);
+        }
+    }
+    if ((optind + 1) != argc) {
+        warnx(usage, prog);
+        exit(1);
+    }
+
+    printf("QUEUE FD TEST BEGIN\n");
+    time_t tstart = time(0);
+    opts.qcount = qcount;
+    if (!(ns = unvme_openx(argv[optind], &opts))) exit(1);
+    if (ns->qcount < qcount) errx(1, "only %d queues", ns->qcount);
+    if (nlb > ns->maxbpio) errx(1, "b limit %d", ns->maxbpio);
+    if ((u64)qcount * depth * nlb > ns->blockcount) errx(1, "not enough disk space");
+    printf("%s qc=%d qs=%d intr=%d reactor=%d depth=%d ios=%d nlb=%u\n",
+           ns->device, qcount, ns->qsize, ns->intr, ns->reactor,
+           depth, numio, nlb);
+
+    int efd = epoll_create1(EPOLL_CLOEXEC);
+    if (efd < 0) err(1, "epoll_create1");
+    int q;
+    for (q = 0; q < qcount; q++) {
+        int fd = unvme_queue_fd(ns, q);
+        if (fd < 0) errx(1, "q%d queue_fd failed", q);
+        struct epoll_event ev = { .events = EPOLLIN, .data.u32 = q };
+        if (epoll_ctl(efd, EPOLL_CTL_ADD, fd, &ev)) err(1, "epoll_ctl");
+    }
+
+    // start every slot and then only process the queues signaled by their fd
+    size_t bsize = (size_t)nlb << ns->blockshift;
+    slot_t* slots = calloc(qcount * depth, sizeof(slot_t));
+    int i;
+    for (i = 0; i < qcount * depth; i++) {
+        slot_t* s = slots + i;
+        s->q = i % qcount;
+        s->slba = (u64)i * nlb;
+        s->wbuf = unvme_alloc(ns, bsize);
+        s->rbuf = unvme_alloc(ns, bsize);
+        if (!s->wbuf || !s->rbuf) errx(1, "alloc failed");
+        slot_fill(s);
+        if (unvme_awrite_cb(ns, s->q, s->wbuf, s->slba, nlb, done, s))
+            errx(1, "q%d write lba %#lx failed", s->q, s->slba);
+        active++;
+    }
+    u64 events = 0;
+    while (active) {
+        struct epoll_event evs[16];
+        int n = epoll_wait(efd, evs, 16, UNVME_TIMEOUT * 1000);
+        if (n < 0 && errno != EINTR) err(1, "epoll_wait");
+        if (n == 0) errx(1, "no queue fd event (%d slots active)", active);
+        for (i = 0; i < n; i++) {
+            q = evs[i].data.u32;
+            u64 val;
+            if (read(unvme_queue_fd(ns, q), &val, sizeof(val)) < 0 && errno != EAGAIN)
+                err(1, "q%d fd read", q);
+            while (unvme_process(ns, q, ns->qsize) > 0);
+            events++;
+        }
+    }
+    printf("events=%lu ios=%lu\n", events, (u64)qcount * depth * numio * 2);
+
+    // the armed queues have nothing pending, so no CPU should be used
+    u64 cpu = cpu_usec();
+    sleep(1);
+    cpu = cpu_usec() - cpu;
+    printf("idle cpu=%luus\n", cpu);
+    if (cpu > 50000 && !ns->reactor) errx(1, "idle notifier is busy");
+
+    for (i = 0; i < qcount * depth; i++) {
+        unvme_free(ns, slots[i].wbuf);
+        unvme_free(ns, slots[i].rbuf);
+    }
+    free(slots);
+    close(efd);
+    unvme_close(ns);
+    printf("QUEUE FD TEST COMPLETE (%ld secs)\n", time(0) - tstart);
+    return 0;
+}
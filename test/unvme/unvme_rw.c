@@ -51,6 +51,7 @@ int main(int argc, char** argv)
            -w|-r LBA         write|read at LBA\n\
            -n    BLOCKCOUNT  number of blocks (default 8)\n\
            -p    PATTERN     64-bit data pattern to write (default random)\n\
+           -s    QCOUNT      stripe the request across QCOUNT queues\n\
            PCINAME           PCI device name (as 02:00.0[/1] format)\n\n\
            (either -w or -r must be specified)\n";
 
@@ -62,8 +63,9 @@ int main(int argc, char** argv)
     u32 nlb = 8;
     u64 pat = 0L;
     int rnd = 1;
+    int qcount = 1;
 
-    while ((opt = getopt(argc, argv, "w:r:n:p:")) != -1) {
+    while ((opt = getopt(argc, argv, "w:r:n:p:s:")) != -1) {
         switch (opt) {
         case 'w':
         case 'r':
@@ -77,6 +79,10 @@ int main(int argc, char** argv)
             pat = strtoull(optarg, 0, 0);
             rnd = 0;
             break;
+        case 's':
+            qcount = strtol(optarg, 0, 0);
+            if (qcount <= 0) errx(1, "s must be > 0");
+            break;
         default:
             warnx(usage, prog);
             exit(1);
@@ -111,11 +117,21 @@ int main(int argc, char** argv)
             printf("Write pattern %#016lx at lba %#lx nlb %u\n", pat, lba, nlb);
             for (i = 0; i < len; i += sizeof(u64)) *p++ = pat;
         }
-        int stat = unvme_write(ns, 0, buf, lba, nlb);
+        if (qcount > 1) {
+            unvme_iod_t iod = unvme_awrite_striped(ns, 0, qcount, buf, lba, nlb);
+            stat = iod ? unvme_apoll(iod, UNVME_TIMEOUT) : -1;
+        } else {
+            stat = unvme_write(ns, 0, buf, lba, nlb);
+        }
         if (stat) errx(1, "unvme_write failed: lba=%#lx nlb=%#x stat=%#x", lba, nlb, stat);
     } else {
         printf("Read lba %#lx nlb %u\n", lba, nlb);
-        stat = unvme_read(ns, 0, buf, lba, nlb);
+        if (qcount > 1) {
+            unvme_iod_t iod = unvme_aread_striped(ns, 0, qcount, buf, lba, nlb);
+            stat = iod ? unvme_apoll(iod, UNVME_TIMEOUT) : -1;
+        } else {
+            stat = unvme_read(ns, 0, buf, lba, nlb);
+        }
         if (stat) errx(1, "unvme_read failed: lba=%#lx nlb=%#x stat=%#x", lba, nlb, stat);
 
         int skip = 0;
@@ -0,0 +1,197 @@
+/**
+ * Copyright (c) 2015-2016, Micron Technology, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the copyright holder nor the names of its
+ *      contributors may be used to endorse or promote products derived
+ *      from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @brief UNVMe SGL test (dword aligned buffers, segment lists, bit buckets).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <err.h>
+#include <sys/uio.h>
+
+#include "unvme.h"
+#include "unvme_nvme.h"
+
+// Global variables
+static const unvme_ns_t* ns;    ///< unvme namespace pointer
+
+/**
+ * Fill a buffer with a pattern.
+ */
+static void fill(void* buf, size_t size, u64 seed)
+{
+    u32* p = buf;
+    size_t i;
+    for (i = 0; i < size / sizeof(u32); i++) p[i] = (u32)(seed * 2654435761UL) + i;
+}
+
+/**
+ * Write and read back a single buffer at a dword aligned offset.
+ */
+static void test_buffer(int q, u64 slba, u32 nlb, int offset)
+{
+    size_t size = (size_t)nlb << ns->blockshift;
+    char* wbuf = unvme_alloc(ns, size + ns->pagesize);
+    char* rbuf = unvme_alloc(ns, size + ns->pagesize);
+    if (!wbuf || !rbuf) errx(1, "alloc failed");
+
+    fill(wbuf + offset, size, slba + offset);
+    memset(rbuf, 0, size + ns->pagesize);
+    if (unvme_write(ns, q, wbuf + offset, slba, nlb))
+        errx(1, "write lba %#lx nlb %u offset %d failed", slba, nlb, offset);
+    if (unvme_read(ns, q, rbuf + ns->pagesize - offset, slba, nlb))
+        errx(1, "read lba %#lx nlb %u offset %d failed", slba, nlb, offset);
+    if (memcmp(wbuf + offset, rbuf + ns->pagesize - offset, size))
+        errx(1, "miscompare at lba %#lx nlb %u offset %d", slba, nlb, offset);
+
+    unvme_free(ns, wbuf);
+    unvme_free(ns, rbuf);
+}
+
+/**
+ * Write and read back a list of non-contiguous dword aligned segments,
+ * enough to fill more than one SGL segment page per command.
+ */
+static void test_segments(int q, u64 slba, int count)
+{
+    size_t stride = ns->blocksize + 4 * sizeof(u32);
+    char* wbuf = unvme_alloc(ns, count * stride);
+    char* rbuf = unvme_alloc(ns, count * stride);
+    struct iovec* wiov = calloc(count, sizeof(struct iovec));
+    struct iovec* riov = calloc(count, sizeof(struct iovec));
+    if (!wbuf || !rbuf || !wiov || !riov) errx(1, "alloc failed");
+
+    int i;
+    for (i = 0; i < count; i++) {
+        wiov[i].iov_base = wbuf + i * stride + sizeof(u32);
+        wiov[i].iov_len = ns->blocksize;
+        riov[i].iov_base = rbuf + (count - 1 - i) * stride + 3 * sizeof(u32);
+        riov[i].iov_len = ns->blocksize;
+        fill(wiov[i].iov_base, ns->blocksize, slba + i);
+    }
+    memset(rbuf, 0, count * stride);
+    if (unvme_writev(ns, q, wiov, count, slba))
+        errx(1, "writev lba %#lx count %d failed", slba, count);
+    if (unvme_readv(ns, q, riov, count, slba))
+        errx(1, "readv lba %#lx count %d failed", slba, count);
+    for (i = 0; i < count; i++) {
+        if (memcmp(wiov[i].iov_base, riov[i].iov_base, ns->blocksize))
+            errx(1, "miscompare at segment %d", i);
+    }
+
+    // discard every other block of the read with bit buckets
+    if (ns->sgls & NVME_SGLS_BIT_BUCKET) {
+        memset(rbuf, 0, count * stride);
+        for (i = 0; i < count; i += 2) riov[i].iov_base = NULL;
+        if (unvme_readv(ns, q, riov, count, slba))
+            errx(1, "readv.bitbucket lba %#lx count %d failed", slba, count);
+        for (i = 1; i < count; i += 2) {
+            if (memcmp(wiov[i].iov_base, riov[i].iov_base, ns->blocksize))
+                errx(1, "miscompare at bit bucket segment %d", i);
+        }
+    }
+
+    free(wiov);
+    free(riov);
+    unvme_free(ns, wbuf);
+    unvme_free(ns, rbuf);
+}
+
+/**
+ * Main program.
+ */
+int main(int argc, char* argv[])
+{
+    const char* usage = "Usage: %s [OPTION]... PCINAME\n\
+           -q QID      queue id (default 0)\n\
+           PCINAME     PCI device name (as 01:00.0[/1] format)";
+
+    char* prog = strrchr(argv[0], '/');
+    prog = prog ? prog + 1 : argv[0];
+
+    int q = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "q:")) != -1) {
+        switch (opt) {
+        case 'q':
+            q = strtol(optarg, 0, 0);
+            if (q < 0) errx(1, "q must be >= 0");
+            break;
+        default:
+            warnx(usage, prog);
+            exit(1);
+        }
+    }
+    if ((optind + 1) != argc) {
+        warnx(usage, prog);
+        exit(1);
+    }
+
+    printf("SGL TEST BEGIN\n");
+    time_t tstart = time(0);
+    if (!(ns = unvme_open(argv[optind]))) exit(1);
+    if (q >= ns->qcount) errx(1, "q limit %d", ns->qcount - 1);
+    printf("%s sgls=%#x bs=%d ps=%d maxbpio=%d\n",
+           ns->device, ns->sgls, ns->blocksize, ns->pagesize, ns->maxbpio);
+    if (!ns->sgls) {
+        printf("SGL not in use (skipped)\n");
+        unvme_close(ns);
+        return 0;
+    }
+
+    // a block, a page and a block, and a max transfer at dword offsets
+    u32 nlbs[] = { 1, ns->nbpp + 1, ns->maxbpio };
+    int offsets[] = { 4, 8, 12, ns->blocksize / 2 + 4 };
+    u64 slba = 0;
+    unsigned i, j;
+    for (i = 0; i < sizeof(nlbs) / sizeof(nlbs[0]); i++) {
+        for (j = 0; j < sizeof(offsets) / sizeof(offsets[0]); j++) {
+            printf("Test buffer nlb=%u offset=%d\n", nlbs[i], offsets[j]);
+            test_buffer(q, slba, nlbs[i], offsets[j]);
+            slba += nlbs[i];
+        }
+    }
+
+    // more segments than a (4K) list page holds
+    int count = 2 * ns->pagesize / 16 + 1;
+    printf("Test segments count=%d bitbucket=%d\n",
+           count, !!(ns->sgls & NVME_SGLS_BIT_BUCKET));
+    test_segments(q, slba, count);
+
+    unvme_close(ns);
+    printf("SGL TEST COMPLETE (%ld secs)\n", time(0) - tstart);
+    return 0;
+}
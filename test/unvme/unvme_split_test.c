@@ -0,0 +1,190 @@
+/**
+ * Copyright (c) 2015-2016, Micron Technology, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the copyright holder nor the names of its
+ *      contributors may be used to endorse or promote products derived
+ *      from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @brief UNVMe I/O split test (boundary-aware vs naive splitting).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <err.h>
+
+#include "unvme.h"
+#include "rdtsc.h"
+
+/// I/O slot (one per outstanding request)
+typedef struct {
+    void*               buf;    ///< IO buffer
+    u64                 lba;    ///< request lba
+    unvme_iod_t         iod;    ///< IO descriptor
+    u64                 tsc;    ///< submission tsc
+} slot_t;
+
+// Global variables
+static const unvme_ns_t* ns;    ///< unvme namespace pointer
+static int runtime = 10;        ///< run time in seconds per mode
+static int depth = 8;           ///< number of outstanding requests
+static u32 nlb;                 ///< blocks per request
+static int rw = 'w';            ///< write or read
+static u64* lat;                ///< request latencies (tsc)
+static u64 maxlat = 1 << 22;    ///< max number of latencies recorded
+
+/**
+ * Compare two latencies for sorting.
+ */
+static int latcmp(const void* a, const void* b)
+{
+    u64 x = *(const u64*)a, y = *(const u64*)b;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * Submit a request at a random (block but not boundary aligned) lba.
+ */
+static void submit(slot_t* s, u64* seed)
+{
+    *seed ^= *seed << 13;
+    *seed ^= *seed >> 7;
+    *seed ^= *seed << 17;
+    s->lba = *seed % (ns->blockcount - nlb);
+    s->tsc = rdtsc();
+    if (rw == 'w') s->iod = unvme_awrite(ns, 0, s->buf, s->lba, nlb);
+    else s->iod = unvme_aread(ns, 0, s->buf, s->lba, nlb);
+    if (!s->iod) errx(1, "submit lba %#lx failed", s->lba);
+}
+
+/**
+ * Run the test in a split mode and print the throughput and latencies.
+ */
+static void run_test(const char* pciname, const char* name, u32 flags)
+{
+    unvme_opts_t opts = { .flags = flags };
+    if (!(ns = unvme_openx(pciname, &opts))) exit(1);
+    if (!nlb) nlb = ns->maxbpio + ns->maxbpio / 2;
+    printf("%s: optsplit=%d iob=%u pwg=%u pwa=%u ows=%u mbio=%u nlb=%u\n",
+           name, ns->optsplit, ns->noiob, ns->npwg, ns->npwa, ns->nows,
+           ns->maxbpio, nlb);
+
+    slot_t* slots = calloc(depth, sizeof(slot_t));
+    u64 seed = time(0) | 1;
+    int i;
+    for (i = 0; i < depth; i++) {
+        if (!(slots[i].buf = unvme_alloc(ns, (u64)nlb * ns->blocksize)))
+            errx(1, "alloc failed");
+    }
+
+    u64 tsec = rdtsc_second();
+    u64 start = rdtsc();
+    u64 end = start + runtime * tsec;
+    u64 ioc = 0, n = 0;
+    for (i = 0; i < depth; i++) submit(slots + i, &seed);
+    for (i = 0; ; i = (i + 1) % depth) {
+        slot_t* s = slots + i;
+        if (!s->iod) break;
+        int stat = unvme_apoll(s->iod, UNVME_TIMEOUT);
+        if (stat) errx(1, "lba %#lx error %#x", s->lba, stat);
+        if (n < maxlat) lat[n++] = rdtsc() - s->tsc;
+        ioc++;
+        if (rdtsc() < end) submit(s, &seed);
+        else s->iod = NULL;
+    }
+    double secs = (double)(rdtsc() - start) / tsec;
+
+    qsort(lat, n, sizeof(u64), latcmp);
+    double us = 1000000.0 / tsec;
+    u64 sum = 0;
+    for (i = 0; i < n; i++) sum += lat[i];
+    printf("%s: IOPS=%.0f MB/s=%.1f lat(us) avg=%.1f p99=%.1f p999=%.1f max=%.1f\n",
+           name, ioc / secs, ioc * nlb * (double)ns->blocksize / secs / 1000000,
+           sum * us / n, lat[n * 99 / 100] * us, lat[n * 999 / 1000] * us,
+           lat[n - 1] * us);
+
+    for (i = 0; i < depth; i++) unvme_free(ns, slots[i].buf);
+    free(slots);
+    unvme_close(ns);
+}
+
+/**
+ * Main program.
+ */
+int main(int argc, char* argv[])
+{
+    const char* usage = "Usage: %s [OPTION]... PCINAME\n\
+           -r          random reads (default random writes)\n\
+           -t SECONDS  run time in seconds per mode (default 10)\n\
+           -d DEPTH    number of outstanding requests (default 8)\n\
+           -n NLB      blocks per request (default 1.5 x max per command)\n\
+           PCINAME     PCI device name (as 01:00.0[/1] format)";
+
+    char* prog = strrchr(argv[0], '/');
+    prog = prog ? prog + 1 : argv[0];
+
+    int opt;
+    while ((opt = getopt(argc, argv, "rt:d:n:")) != -1) {
+        switch (opt) {
+        case 'r':
+            rw = 'r';
+            break;
+        case 't':
+            runtime = strtol(optarg, 0, 0);
+            if (runtime <= 0) errx(1, "t must be > 0");
+            break;
+        case 'd':
+            depth = strtol(optarg, 0, 0);
+            if (depth <= 0) errx(1, "d must be > 0");
+            break;
+        case 'n':
+            nlb = strtoul(optarg, 0, 0);
+            if (nlb == 0) errx(1, "n must be > 0");
+            break;
+        default:
+            warnx(usage, prog);
+            exit(1);
+        }
+    }
+    if ((optind + 1) != argc) {
+        warnx(usage, prog);
+        exit(1);
+    }
+
+    printf("SPLIT TEST BEGIN\n");
+    time_t tstart = time(0);
+    if (!(lat = malloc(maxlat * sizeof(u64)))) errx(1, "malloc failed");
+    run_test(argv[optind], "optimal", 0);
+    run_test(argv[optind], "naive", UNVME_OPT_NAIVE_SPLIT);
+    free(lat);
+    printf("SPLIT TEST COMPLETE (%ld secs)\n", time(0) - tstart);
+    return 0;
+}